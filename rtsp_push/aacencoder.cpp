@@ -1,5 +1,6 @@
 ﻿#include "aacencoder.h"
 #include "dlog.h"
+#include <algorithm>
 AACEncoder::AACEncoder()
 {
 
@@ -10,6 +11,10 @@ AACEncoder::~AACEncoder()
     if(ctx_) {
         avcodec_free_context(&ctx_);
     }
+    if(buffer_pool_) {
+        delete buffer_pool_;
+        buffer_pool_ = NULL;
+    }
 }
 
 RET_CODE AACEncoder::Init(const Properties &properties)
@@ -39,8 +44,16 @@ RET_CODE AACEncoder::Init(const Properties &properties)
     ctx_->sample_fmt    = AV_SAMPLE_FMT_FLTP;      // 默认aac编码需要planar格式PCM， 如果是fdk-aac
     ctx_->sample_rate   = sample_rate_;
     ctx_->bit_rate      = bitrate_;
+    // 送进来的pts是ms(AVPublishTime), 不设置时编码器按1/sample_rate理解, 输出包的duration会和pts单位不一致
+    ctx_->time_base     = AVRational{1, 1000};
     //Allow experimental codecs
     ctx_->strict_std_compliance = FF_COMPLIANCE_EXPERIMENTAL;
+    // 负载缓冲区按一帧码流的2倍估算, 至少能放下AAC一帧的上限(每个通道6144bit)
+    int buffer_size = std::max((int)((int64_t)bitrate_ / 8 * 1024 / sample_rate_ * 2), 768 * channels_);
+    buffer_pool_ = new PacketBufferPool(buffer_size);
+    if(buffer_pool_->Attach(ctx_)) {
+        LogInfo("AAC: packet buffer pool size:%d", buffer_size);
+    }
     if(avcodec_open2(ctx_, codec_, NULL) < 0) {
         LogError("AAC: can't avcodec_open2");
         avcodec_free_context(&ctx_);
@@ -83,11 +96,17 @@ AVPacket *AACEncoder::Encode(AVFrame *frame, const int64_t pts, int flush, int *
     if(flush) {     // 只能调用一次
         avcodec_flush_buffers(ctx_);//刷新（清空）解码器的内部缓冲区  并且  可以确保后续的解码不会受到之前已解码数据的影响
     }
-    AVPacket *packet = av_packet_alloc();
+    AVPacket *packet = PacketPool::GetInstance()->Alloc();
+    if(!packet) {
+        LogError("AAC: alloc packet failed");
+        *pkt_frame = 0;
+        *ret = RET_ERR_OUTOFMEMORY;
+        return NULL;
+    }
     ret1 = avcodec_receive_packet(ctx_, packet);
     if(ret1 < 0) {
         LogError("AAC: avcodec_receive_packet ret:%d", ret1);
-        av_packet_free(&packet);
+        PacketPool::GetInstance()->Free(&packet);
         *pkt_frame = 0;
         if(ret1 == AVERROR(EAGAIN)) {       // 需要继续发送frame我们才有packet读取
             *ret = RET_ERR_EAGAIN;
@@ -154,3 +173,91 @@ RET_CODE AACEncoder::GetAdtsHeader(uint8_t *adts_header, int aac_length)
 
 
 
+
+RET_CODE AACEncoder::EncodeFrame(AVFrame *frame, int64_t pts, const PacketSink &sink)
+{
+    if(!ctx_) {
+        return RET_FAIL;
+    }
+    if(flushed_) {
+        return RET_ERR_EOF;
+    }
+    if(!frame) {
+        return Flush(sink);
+    }
+    frame->pts = pts;
+    int ret = avcodec_send_frame(ctx_, frame);
+    if(ret == AVERROR(EAGAIN)) {
+        // 每次都取空了不会出现, 保险起见先取出再送一次
+        RET_CODE drain_ret = receivePackets(sink);
+        if(drain_ret != RET_OK) {
+            return drain_ret;
+        }
+        ret = avcodec_send_frame(ctx_, frame);
+    }
+    if(ret < 0) {
+        char buf[1024] = { 0 };
+        av_strerror(ret, buf, sizeof(buf) - 1);
+        LogError("AAC: avcodec_send_frame failed:%s", buf);
+        return ret == AVERROR_EOF ? RET_ERR_EOF : RET_FAIL;
+    }
+    return receivePackets(sink);
+}
+
+RET_CODE AACEncoder::EncodeFrame(AVFrame *frame, int64_t pts, std::vector<AVPacket *> *packets)
+{
+    return EncodeFrame(frame, pts, [packets](AVPacket *packet) {
+        packets->push_back(packet);
+    });
+}
+
+RET_CODE AACEncoder::Flush(const PacketSink &sink)
+{
+    if(!ctx_) {
+        return RET_FAIL;
+    }
+    if(flushed_) {
+        return RET_ERR_EOF;
+    }
+    flushed_ = true;
+    int ret = avcodec_send_frame(ctx_, NULL);
+    if(ret < 0 && ret != AVERROR_EOF) {
+        char buf[1024] = { 0 };
+        av_strerror(ret, buf, sizeof(buf) - 1);
+        LogError("AAC: flush failed:%s", buf);
+        return RET_FAIL;
+    }
+    int packets = 0;
+    RET_CODE drain_ret = receivePackets([&sink, &packets](AVPacket *packet) {
+        packets++;
+        sink(packet);
+    });
+    LogInfo("AAC: flush %d packets", packets);
+    return drain_ret == RET_ERR_EOF ? RET_OK : drain_ret;
+}
+
+RET_CODE AACEncoder::receivePackets(const PacketSink &sink)
+{
+    while(true) {
+        AVPacket *packet = PacketPool::GetInstance()->Alloc();
+        if(!packet) {
+            LogError("AAC: alloc packet failed");
+            return RET_ERR_OUTOFMEMORY;
+        }
+        int ret = avcodec_receive_packet(ctx_, packet);
+        if(ret < 0) {
+            PacketPool::GetInstance()->Free(&packet);
+            if(ret == AVERROR(EAGAIN)) {    // 需要继续送帧
+                return RET_OK;
+            }
+            if(ret == AVERROR_EOF) {        // flush之后已经全部取完
+                return RET_ERR_EOF;
+            }
+            char buf[1024] = { 0 };
+            av_strerror(ret, buf, sizeof(buf) - 1);
+            LogError("AAC: avcodec_receive_packet failed:%s", buf);
+            return RET_FAIL;
+        }
+        sink(packet);
+    }
+}
@@ -5,6 +5,7 @@ extern "C" {
 #include <libavcodec/avcodec.h>
 }
 #include "mediabase.h"
+#include "packetpool.h"
 class AACEncoder
 {
 public:
@@ -29,6 +30,17 @@ public:
      * @return
      */
     virtual AVPacket *Encode(AVFrame *frame, const int64_t pts, int flush, int *pkt_frame, RET_CODE *ret);
+    /**
+     * @brief EncodeFrame 送入一帧, 把编码器当前能输出的packet全部取出交给sink
+     *        编码器有priming延迟, 前面几帧可能没有输出, 之后一次也可能输出多个
+     * @param frame 为NULL时等同于Flush
+     * @return RET_OK; RET_ERR_EOF已经Flush过; RET_ERR_OUTOFMEMORY分配packet失败; RET_FAIL编码器出错
+     */
+    RET_CODE EncodeFrame(AVFrame *frame, int64_t pts, const PacketSink &sink);
+    // 同上, packet追加到packets后面, 调用者可以重复使用同一个vector(自己clear)
+    RET_CODE EncodeFrame(AVFrame *frame, int64_t pts, std::vector<AVPacket *> *packets);
+    // 结束时调用一次: 送入NULL, 取出编码器缓存的所有packet直到EOF; 之后EncodeFrame返回RET_ERR_EOF
+    RET_CODE Flush(const PacketSink &sink);
 
     RET_CODE GetAdtsHeader(uint8_t *adts_header, int aac_length);
 
@@ -59,6 +71,9 @@ public:
 //    virtual RET_CODE EncodeOutput(AVPacket *pkt);
 
 private:
+    // 取出所有能输出的packet, 返回RET_OK(需要更多输入)/RET_ERR_EOF(已经取完)/RET_ERR_OUTOFMEMORY/RET_FAIL
+    RET_CODE receivePackets(const PacketSink &sink);
+
     int sample_rate_ = 48000;
     int channels_    = 2;
     int bitrate_     = 128*1024;
@@ -66,6 +81,8 @@ private:
 
     AVCodec *codec_         = NULL;
     AVCodecContext  *ctx_   = NULL;
+    PacketBufferPool *buffer_pool_ = NULL;     // 输出packet的负载缓冲区
+    bool flushed_ = false;
 
 };
 
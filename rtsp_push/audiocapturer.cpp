@@ -2,28 +2,30 @@
 #include "dlog.h"
 #include "timesutil.h"
 #include "avpublishtime.h"
+#include "events.h"
+#include <string.h>
 
 extern "C" {
 #include <libavcodec/avcodec.h>
 }
 AudioCapturer::AudioCapturer(): CommonLooper()
 {
+    thread_name_ = "audio_capture";
 
 }
 
 AudioCapturer::~AudioCapturer()
 {
+    Stop();     // 基类析构里调用的是CommonLooper::Stop; 先等线程池上排队或执行中的Step结束, 再释放成员
     if(pcm_buf_) {
         delete [] pcm_buf_;
     }
-    if(pcm_fp_) {
-        fclose(pcm_fp_);
-    }
 }
 
 RET_CODE AudioCapturer::Init(const Properties properties)
 {
     audio_test_ = properties.GetProperty("audio_test", 0);
+    SetThreadProperties(properties.GetChildren("thread"));
     input_pcm_name_ = properties.GetProperty("input_pcm_name", "buweishui_48000_2_s16le.pcm");
     sample_rate_ = properties.GetProperty("sample_rate", 48000);
     channels_  = properties.GetProperty("channels", 2);
@@ -50,58 +52,134 @@ RET_CODE AudioCapturer::Init(const Properties properties)
 void AudioCapturer::Loop()
 {
     LogInfo("into loop");
-    pcm_total_duration_ = 0;
-    pcm_start_time_ = TimesUtil::GetTimeMillisecond();      // 初始化时间基
+    startCapture();
     while(true) {
         if(request_abort_) {
             break;          // 请求退出
         }
-        if(readPcmFile(pcm_buf_, pcm_buf_size_) == 0) {
-            if(!is_first_time_) {
-                is_first_time_ = true;
-                LogInfo("%s:t%u", AVPublishTime::GetInstance()->getAInTag(),
-                        AVPublishTime::GetInstance()->getCurrenTime());
-            }
-            if(callback_get_pcm_) {
-                callback_get_pcm_(pcm_buf_, pcm_buf_size_);
-            }
-        }
-        std::this_thread::sleep_for(std::chrono::milliseconds(2));
+        timer_.WaitNext();      // 睡到这一帧该读取的时间点
+        captureFrame();
     }
     request_abort_ = false;
     closePcmFile();
 }
 
+int64_t AudioCapturer::Step()
+{
+    if(step_deadline_ == 0) {
+        LogInfo("into step");
+        startCapture();
+        step_deadline_ = timer_.NextDeadline();
+    }
+    timer_.Reached(step_deadline_);
+    captureFrame();
+    step_deadline_ = timer_.NextDeadline();     // 下一帧该读取的时间点, 落后时马上再调度
+    return step_deadline_;
+}
+
+void AudioCapturer::Stop()
+{
+    CommonLooper::Stop();       // 返回时已经没有排队或者执行中的Step
+    step_deadline_ = 0;
+}
+
+void AudioCapturer::startCapture()
+{
+    pcm_total_duration_ = 0;
+    pcm_start_time_ = TimesUtil::GetTimeMillisecond();      // 初始化时间基
+    timer_.Start(frame_duration_ * 1000);   // 每帧一个deadline
+    pre_debug_time_ = pcm_start_time_;
+}
+
+void AudioCapturer::captureFrame()
+{
+    uint8_t *pcm = NULL;
+    int ret = readPcmFile(&pcm);
+    if(ret < 0 && !capture_error_) {
+        capture_error_ = true;
+        LogError("readPcmFile failed");
+        if(event_bus_) {
+            CaptureErrorEvent event;
+            event.media_type = E_AUDIO_TYPE;
+            event.error = ret;
+            event_bus_->Publish(event);
+        }
+    }
+    if(ret == 0) {
+        capture_error_ = false;
+        if(!is_first_time_) {
+            is_first_time_ = true;
+            LogInfo("%s:t%u", AVPublishTime::GetInstance()->getAInTag(),
+                    AVPublishTime::GetInstance()->getCurrenTime());
+        }
+        if(callback_get_pcm_) {
+            callback_get_pcm_(pcm, pcm_buf_size_);
+        }
+    }
+    int64_t cur_time = TimesUtil::GetTimeMillisecond();
+    if(cur_time - pre_debug_time_ > 5000) {
+        DeadlineTimerStats stats;
+        timer_.GetStats(&stats, true);
+        LogInfo("audio timer: ticks:%lld, wakeups:%lld, lateness p50:%lldus p99:%lldus max:%lldus",
+                stats.ticks, stats.wakeups, stats.lateness.p50, stats.lateness.p99, stats.lateness.max);
+        pre_debug_time_ = cur_time;
+    }
+}
+
 void AudioCapturer::AddCallback(function<void (uint8_t *, int32_t)> callback)
 {
     callback_get_pcm_ = callback;
 }
 
+void AudioCapturer::SetEventBus(EventBus *event_bus)
+{
+    event_bus_ = event_bus;
+}
+
+void AudioCapturer::GetTimerStats(DeadlineTimerStats *stats)
+{
+    timer_.GetStats(stats);
+}
+
 int AudioCapturer::openPcmFile(const char *file_name)
 {
-    pcm_fp_ = fopen(file_name, "rb");
-    if(!pcm_fp_)
+    pcm_file_ = MappedFile::Open(file_name);
+    if(!pcm_file_)
     {
         return -1;
     }
+    // 只使用整数个采样点, 循环读取时声道不会错位
+    int block_align = byte_per_sample_ * channels_;
+    pcm_data_size_ = pcm_file_->Size() / block_align * block_align;
+    if(pcm_data_size_ < pcm_buf_size_) {
+        LogError("%s size:%lld less than one frame:%d", file_name, pcm_file_->Size(), pcm_buf_size_);
+        pcm_file_.reset();
+        return -1;
+    }
+    pcm_offset_ = 0;
     return 0;
 }
 
-int AudioCapturer::readPcmFile(uint8_t *pcm_buf, int32_t pcm_buf_size)
+int AudioCapturer::readPcmFile(uint8_t **pcm)
 {
-    int64_t cur_time = TimesUtil::GetTimeMillisecond();     // 单位毫秒
-    int64_t dif = cur_time - pcm_start_time_;       // 目前经过的时间
-    if(((int64_t)pcm_total_duration_) > dif) {
-        return 1;          // 还没有到读取新一帧的时间
+    // 读取的时间点由Loop里的timer_控制
+    if(!pcm_file_) {
+        return -1;      // 文件已经关闭
     }
-    // 读取数据
-    size_t ret = fread(pcm_buf_, 1, pcm_buf_size, pcm_fp_);
-    if(ret != pcm_buf_size) {
-        ret = fseek(pcm_fp_, 0, SEEK_SET);      // 没有足够数据就从头继续开始读取
-        ret = fread(pcm_buf_, 1, pcm_buf_size, pcm_fp_);
-        if(ret != pcm_buf_size) {
-            return -1;      // 出错
-        }
+    const uint8_t *data = pcm_file_->Data();
+    if(pcm_offset_ + pcm_buf_size_ <= pcm_data_size_) {
+        *pcm = (uint8_t *)data + pcm_offset_;   // 直接指向映射的文件, 不拷贝
+        pcm_offset_ += pcm_buf_size_;
+    } else {
+        // 文件末尾不够一帧, 和文件开头的数据拼成一帧, 从头继续循环读取
+        int64_t tail = pcm_data_size_ - pcm_offset_;
+        memcpy(pcm_buf_, data + pcm_offset_, (size_t)tail);
+        memcpy(pcm_buf_ + tail, data, (size_t)(pcm_buf_size_ - tail));
+        pcm_offset_ = pcm_buf_size_ - tail;
+        *pcm = pcm_buf_;
+    }
+    if(pcm_offset_ == pcm_data_size_) {
+        pcm_offset_ = 0;
     }
 
     pcm_total_duration_ += frame_duration_;
@@ -110,7 +188,6 @@ int AudioCapturer::readPcmFile(uint8_t *pcm_buf, int32_t pcm_buf_size)
 
 int AudioCapturer::closePcmFile()
 {
-    if(pcm_fp_)
-        fclose(pcm_fp_);
+    pcm_file_.reset();      // 最后一个使用者释放时解除映射
     return 0;
 }
@@ -4,6 +4,9 @@
 #include <functional>
 #include "commonlooper.h"
 #include "mediabase.h"
+#include "eventbus.h"
+#include "deadlinetimer.h"
+#include "mappedfile.h"
 using std::function;
 class AudioCapturer : public CommonLooper
 {
@@ -13,25 +16,46 @@ public:
     RET_CODE Init(const Properties properties);
 
     virtual void Loop();
+    // 读文件不会长时间阻塞, 可以用Start(Executor*)在共享线程池上按帧调度
+    virtual bool Cooperative() {
+        return true;
+    }
+    virtual int64_t Step();
+    // 停止后step_deadline_清零, 再次Start(Executor*)时重新开始计时, 不会追赶停止期间的帧
+    virtual void Stop();
+    // 回调拿到的数据可能直接指向只读映射的测试文件, 只在回调期间有效, 不能修改
     void AddCallback(function<void(uint8_t*, int32_t)> callback);
+    // 采集出错时发布CaptureErrorEvent
+    void SetEventBus(EventBus *event_bus);
+    // 读取定时器的唤醒次数和延迟统计, 每5秒打印一次时会清零
+    void GetTimerStats(DeadlineTimerStats *stats);
 //    void AddCallback(std::function<void(uint8_t *, int32_t)> callback);
 private:
 
     // PCM file只是用来测试, 写死为s16格式 2通道 采样率48Khz
     // 1帧1024采样点持续的时间21.333333333333333333333333333333ms
+    // 文件用mmap映射, 使用同一个文件的采集模块共享一份映射, 读取时没有系统调用
     int openPcmFile(const char *file_name);
-    int readPcmFile(uint8_t *pcm_buf, int32_t pcm_buf_size);
+    // *pcm指向一帧数据, 跨过文件末尾时拼接到pcm_buf_
+    int readPcmFile(uint8_t **pcm);
     int closePcmFile();
+    void startCapture();
+    void captureFrame();        // 读取一帧并回调
 
     int audio_test_ = 0;
     std::string input_pcm_name_;    // 输入pcm测试文件的名字
-    FILE *pcm_fp_ = NULL;
+    std::shared_ptr<MappedFile> pcm_file_;
+    int64_t pcm_data_size_ = 0;     // 按采样点对齐后使用的文件大小
+    int64_t pcm_offset_ = 0;        // 下一帧在文件里的偏移
     int64_t pcm_start_time_ = 0;
     double pcm_total_duration_ = 0; // 推流时长的统计
     double frame_duration_ = 23.2;
+    DeadlineTimer timer_;           // 按帧时长的绝对时间点唤醒
+    int64_t step_deadline_ = 0;     // 协作模式下当前这一帧的deadline
+    int64_t pre_debug_time_ = 0;
 
     std::function<void(uint8_t *, int32_t)> callback_get_pcm_;
-    uint8_t *pcm_buf_;
+    uint8_t *pcm_buf_ = NULL;       // 只在跨过文件末尾时拼接数据用
     int32_t pcm_buf_size_;
     bool is_first_time_ = false;
     int sample_rate_ = 48000;
@@ -39,6 +63,9 @@ private:
     int byte_per_sample_ = 2;
     int format_ = 1;        // 目前固定s16先
     int channels_ = 2;
+
+    EventBus *event_bus_ = NULL;
+    bool capture_error_ = false;    // 已经发布过出错事件, 恢复正常前不再发布
 };
 
 #endif // AUDIOCAPTURER_H
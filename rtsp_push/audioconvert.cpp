@@ -0,0 +1,290 @@
+﻿#include <string.h>
+#include <atomic>
+#include "audioconvert.h"
+
+#ifdef SIMD_X86
+#include <emmintrin.h>
+#include <immintrin.h>
+#endif
+
+// 输出和原来的标量实现一致: s16/32768.0, 乘2的负幂次没有舍入误差, 用float计算结果逐位相同
+// s32先舍入成float再乘2^-31, 和用double算完再舍入成float的结果也相同
+static const float kS16Scale = 1.0f / 32768.0f;
+static const float kS32Scale = 1.0f / 2147483648.0f;
+
+// src: 交错格式, 按采样点下标[start, end)转换, SIMD实现用来处理尾巴
+typedef void (*ConvertFunc)(const uint8_t *src, int channels, int start, int end, float **dst);
+
+static void s16ToFltpC(const uint8_t *src, int channels, int start, int end, float **dst)
+{
+    const int16_t *s = (const int16_t *)src;
+    for(int c = 0; c < channels; c++) {     // 按通道输出, 内层循环不再有通道判断
+        float *d = dst[c];
+        for(int i = start; i < end; i++) {
+            d[i] = s[i * channels + c] * kS16Scale;
+        }
+    }
+}
+
+static void s32ToFltpC(const uint8_t *src, int channels, int start, int end, float **dst)
+{
+    const int32_t *s = (const int32_t *)src;
+    for(int c = 0; c < channels; c++) {
+        float *d = dst[c];
+        for(int i = start; i < end; i++) {
+            d[i] = (float)s[i * channels + c] * kS32Scale;
+        }
+    }
+}
+
+static void fltToFltpC(const uint8_t *src, int channels, int start, int end, float **dst)
+{
+    const float *s = (const float *)src;
+    if(channels == 1) {
+        memcpy(dst[0] + start, s + start, (end - start) * sizeof(float));
+        return;
+    }
+    for(int c = 0; c < channels; c++) {
+        float *d = dst[c];
+        for(int i = start; i < end; i++) {
+            d[i] = s[i * channels + c];
+        }
+    }
+}
+
+#ifdef SIMD_X86
+// ---------------- SSE2 ----------------
+static void s16ToFltp1chSse2(const uint8_t *src, int channels, int start, int end, float **dst)
+{
+    const int16_t *s = (const int16_t *)src;
+    const __m128 scale = _mm_set1_ps(kS16Scale);
+    int i = start;
+    for(; i + 8 <= end; i += 8) {
+        __m128i x = _mm_loadu_si128((const __m128i *)(s + i));
+        // 16位放到32位的高半部分再算术右移, 完成符号扩展
+        __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16);
+        __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(x, x), 16);
+        _mm_storeu_ps(dst[0] + i, _mm_mul_ps(_mm_cvtepi32_ps(lo), scale));
+        _mm_storeu_ps(dst[0] + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(hi), scale));
+    }
+    s16ToFltpC(src, channels, i, end, dst);
+}
+
+static void s16ToFltp2chSse2(const uint8_t *src, int channels, int start, int end, float **dst)
+{
+    const int16_t *s = (const int16_t *)src;
+    const __m128 scale = _mm_set1_ps(kS16Scale);
+    int i = start;
+    for(; i + 4 <= end; i += 4) {
+        __m128i x = _mm_loadu_si128((const __m128i *)(s + i * 2));    // L0 R0 L1 R1 L2 R2 L3 R3
+        // 每个32位是一对LR, 低16位是L, 高16位是R
+        __m128i l = _mm_srai_epi32(_mm_slli_epi32(x, 16), 16);
+        __m128i r = _mm_srai_epi32(x, 16);
+        _mm_storeu_ps(dst[0] + i, _mm_mul_ps(_mm_cvtepi32_ps(l), scale));
+        _mm_storeu_ps(dst[1] + i, _mm_mul_ps(_mm_cvtepi32_ps(r), scale));
+    }
+    s16ToFltpC(src, channels, i, end, dst);
+}
+
+static void s32ToFltp1chSse2(const uint8_t *src, int channels, int start, int end, float **dst)
+{
+    const int32_t *s = (const int32_t *)src;
+    const __m128 scale = _mm_set1_ps(kS32Scale);
+    int i = start;
+    for(; i + 4 <= end; i += 4) {
+        __m128i x = _mm_loadu_si128((const __m128i *)(s + i));
+        _mm_storeu_ps(dst[0] + i, _mm_mul_ps(_mm_cvtepi32_ps(x), scale));
+    }
+    s32ToFltpC(src, channels, i, end, dst);
+}
+
+// 32位的两通道交错: 按float拆分L/R, s32和flt共用
+static inline void deinterleave2chSse2(const void *src, __m128 *l, __m128 *r)
+{
+    __m128 a = _mm_loadu_ps((const float *)src);          // L0 R0 L1 R1
+    __m128 b = _mm_loadu_ps((const float *)src + 4);      // L2 R2 L3 R3
+    *l = _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+    *r = _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+}
+
+static void s32ToFltp2chSse2(const uint8_t *src, int channels, int start, int end, float **dst)
+{
+    const int32_t *s = (const int32_t *)src;
+    const __m128 scale = _mm_set1_ps(kS32Scale);
+    int i = start;
+    for(; i + 4 <= end; i += 4) {
+        __m128 l, r;
+        deinterleave2chSse2(s + i * 2, &l, &r);
+        _mm_storeu_ps(dst[0] + i, _mm_mul_ps(_mm_cvtepi32_ps(_mm_castps_si128(l)), scale));
+        _mm_storeu_ps(dst[1] + i, _mm_mul_ps(_mm_cvtepi32_ps(_mm_castps_si128(r)), scale));
+    }
+    s32ToFltpC(src, channels, i, end, dst);
+}
+
+static void fltToFltp2chSse2(const uint8_t *src, int channels, int start, int end, float **dst)
+{
+    const float *s = (const float *)src;
+    int i = start;
+    for(; i + 4 <= end; i += 4) {
+        __m128 l, r;
+        deinterleave2chSse2(s + i * 2, &l, &r);
+        _mm_storeu_ps(dst[0] + i, l);
+        _mm_storeu_ps(dst[1] + i, r);
+    }
+    fltToFltpC(src, channels, i, end, dst);
+}
+
+// ---------------- AVX2 ----------------
+SIMD_TARGET_AVX2 static void s16ToFltp1chAvx2(const uint8_t *src, int channels, int start, int end, float **dst)
+{
+    const int16_t *s = (const int16_t *)src;
+    const __m256 scale = _mm256_set1_ps(kS16Scale);
+    int i = start;
+    for(; i + 16 <= end; i += 16) {
+        __m256i lo = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *)(s + i)));
+        __m256i hi = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *)(s + i + 8)));
+        _mm256_storeu_ps(dst[0] + i, _mm256_mul_ps(_mm256_cvtepi32_ps(lo), scale));
+        _mm256_storeu_ps(dst[0] + i + 8, _mm256_mul_ps(_mm256_cvtepi32_ps(hi), scale));
+    }
+    s16ToFltp1chSse2(src, channels, i, end, dst);
+}
+
+SIMD_TARGET_AVX2 static void s16ToFltp2chAvx2(const uint8_t *src, int channels, int start, int end, float **dst)
+{
+    const int16_t *s = (const int16_t *)src;
+    const __m256 scale = _mm256_set1_ps(kS16Scale);
+    int i = start;
+    for(; i + 8 <= end; i += 8) {
+        __m256i x = _mm256_loadu_si256((const __m256i *)(s + i * 2));
+        __m256i l = _mm256_srai_epi32(_mm256_slli_epi32(x, 16), 16);
+        __m256i r = _mm256_srai_epi32(x, 16);
+        _mm256_storeu_ps(dst[0] + i, _mm256_mul_ps(_mm256_cvtepi32_ps(l), scale));
+        _mm256_storeu_ps(dst[1] + i, _mm256_mul_ps(_mm256_cvtepi32_ps(r), scale));
+    }
+    s16ToFltp2chSse2(src, channels, i, end, dst);
+}
+
+SIMD_TARGET_AVX2 static void s32ToFltp1chAvx2(const uint8_t *src, int channels, int start, int end, float **dst)
+{
+    const int32_t *s = (const int32_t *)src;
+    const __m256 scale = _mm256_set1_ps(kS32Scale);
+    int i = start;
+    for(; i + 8 <= end; i += 8) {
+        __m256i x = _mm256_loadu_si256((const __m256i *)(s + i));
+        _mm256_storeu_ps(dst[0] + i, _mm256_mul_ps(_mm256_cvtepi32_ps(x), scale));
+    }
+    s32ToFltp1chSse2(src, channels, i, end, dst);
+}
+
+SIMD_TARGET_AVX2 static inline void deinterleave2chAvx2(const void *src, __m256 *l, __m256 *r)
+{
+    __m256 a = _mm256_loadu_ps((const float *)src);       // L0 R0 L1 R1 | L2 R2 L3 R3
+    __m256 b = _mm256_loadu_ps((const float *)src + 8);   // L4 R4 L5 R5 | L6 R6 L7 R7
+    // shuffle在每个128位内进行: L0 L1 L4 L5 | L2 L3 L6 L7, 再按64位重排成顺序
+    __m256 lv = _mm256_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+    __m256 rv = _mm256_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+    *l = _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(lv), _MM_SHUFFLE(3, 1, 2, 0)));
+    *r = _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(rv), _MM_SHUFFLE(3, 1, 2, 0)));
+}
+
+SIMD_TARGET_AVX2 static void s32ToFltp2chAvx2(const uint8_t *src, int channels, int start, int end, float **dst)
+{
+    const int32_t *s = (const int32_t *)src;
+    const __m256 scale = _mm256_set1_ps(kS32Scale);
+    int i = start;
+    for(; i + 8 <= end; i += 8) {
+        __m256 l, r;
+        deinterleave2chAvx2(s + i * 2, &l, &r);
+        _mm256_storeu_ps(dst[0] + i, _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_castps_si256(l)), scale));
+        _mm256_storeu_ps(dst[1] + i, _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_castps_si256(r)), scale));
+    }
+    s32ToFltp2chSse2(src, channels, i, end, dst);
+}
+
+SIMD_TARGET_AVX2 static void fltToFltp2chAvx2(const uint8_t *src, int channels, int start, int end, float **dst)
+{
+    const float *s = (const float *)src;
+    int i = start;
+    for(; i + 8 <= end; i += 8) {
+        __m256 l, r;
+        deinterleave2chAvx2(s + i * 2, &l, &r);
+        _mm256_storeu_ps(dst[0] + i, l);
+        _mm256_storeu_ps(dst[1] + i, r);
+    }
+    fltToFltp2chSse2(src, channels, i, end, dst);
+}
+#endif
+
+static std::atomic<int> &currentSimdLevel()
+{
+    static std::atomic<int> s_level(CpuSimdLevel());
+    return s_level;
+}
+
+static ConvertFunc selectFunc(AVSampleFormat src_fmt, int channels, SimdLevel level)
+{
+#ifdef SIMD_X86
+    if(level >= SIMD_AVX2 && channels <= 2) {
+        switch(src_fmt) {
+        case AV_SAMPLE_FMT_S16:
+            return channels == 1 ? s16ToFltp1chAvx2 : s16ToFltp2chAvx2;
+        case AV_SAMPLE_FMT_S32:
+            return channels == 1 ? s32ToFltp1chAvx2 : s32ToFltp2chAvx2;
+        case AV_SAMPLE_FMT_FLT:
+            return channels == 1 ? fltToFltpC : fltToFltp2chAvx2;   // 单通道就是memcpy
+        default:
+            return NULL;
+        }
+    }
+    if(level >= SIMD_SSE2 && channels <= 2) {
+        switch(src_fmt) {
+        case AV_SAMPLE_FMT_S16:
+            return channels == 1 ? s16ToFltp1chSse2 : s16ToFltp2chSse2;
+        case AV_SAMPLE_FMT_S32:
+            return channels == 1 ? s32ToFltp1chSse2 : s32ToFltp2chSse2;
+        case AV_SAMPLE_FMT_FLT:
+            return channels == 1 ? fltToFltpC : fltToFltp2chSse2;
+        default:
+            return NULL;
+        }
+    }
+#endif
+    // 其他通道数用标量实现
+    switch(src_fmt) {
+    case AV_SAMPLE_FMT_S16:
+        return s16ToFltpC;
+    case AV_SAMPLE_FMT_S32:
+        return s32ToFltpC;
+    case AV_SAMPLE_FMT_FLT:
+        return fltToFltpC;
+    default:
+        return NULL;
+    }
+}
+
+int AudioConvertToFltp(const uint8_t *src, AVSampleFormat src_fmt, int channels, int nb_samples, float **dst)
+{
+    if(channels <= 0 || nb_samples < 0) {
+        return -1;
+    }
+    ConvertFunc func = selectFunc(src_fmt, channels,
+                                  (SimdLevel)currentSimdLevel().load(std::memory_order_relaxed));
+    if(!func) {
+        return -1;
+    }
+    func(src, channels, 0, nb_samples, dst);
+    return 0;
+}
+
+SimdLevel AudioConvertGetSimdLevel()
+{
+    return (SimdLevel)currentSimdLevel().load(std::memory_order_relaxed);
+}
+
+void AudioConvertSetSimdLevel(SimdLevel level)
+{
+    if(level > CpuSimdLevel()) {
+        level = CpuSimdLevel();
+    }
+    currentSimdLevel().store(level, std::memory_order_relaxed);
+}
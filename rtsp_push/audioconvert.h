@@ -0,0 +1,27 @@
+﻿#ifndef AUDIOCONVERT_H
+#define AUDIOCONVERT_H
+
+#include <stdint.h>
+#include "simdlevel.h"
+extern "C" {
+#include <libavutil/samplefmt.h>
+}
+
+/**
+ * @brief AudioConvertToFltp 交错格式 -> float planar, AAC编码器需要的输入格式
+ *        支持s16、s32、flt, 任意通道数; 1、2通道有SSE2/AVX2实现, 运行时按CPU支持的指令集选择
+ *        所有实现的输出和标量实现逐位相同(s16: x/32768, s32: x/2147483648, flt: 直接拆分)
+ * @param src           交错格式的输入
+ * @param src_fmt       AV_SAMPLE_FMT_S16/AV_SAMPLE_FMT_S32/AV_SAMPLE_FMT_FLT
+ * @param channels      通道数
+ * @param nb_samples    每个通道的采样点数
+ * @param dst           每个通道一个平面, 比如AVFrame::data
+ * @return 0成功, -1格式不支持
+ */
+int AudioConvertToFltp(const uint8_t *src, AVSampleFormat src_fmt, int channels, int nb_samples, float **dst);
+// 当前使用的指令集
+SimdLevel AudioConvertGetSimdLevel();
+// 限制使用的指令集(比如对比测试), 超过CPU支持的按CPU支持的
+void AudioConvertSetSimdLevel(SimdLevel level);
+
+#endif // AUDIOCONVERT_H
@@ -0,0 +1,126 @@
+﻿#include <stdlib.h>
+#include "audiofifo.h"
+#include "dlog.h"
+extern "C" {
+#include <libavutil/mathematics.h>
+#include <libavutil/mem.h>
+}
+
+AudioFifo::AudioFifo()
+{
+
+}
+
+AudioFifo::~AudioFifo()
+{
+    if(fifo_) {
+        av_audio_fifo_free(fifo_);
+    }
+    if(frame_buf_[0]) {
+        av_freep(&frame_buf_[0]);       // av_samples_alloc所有平面是一块内存
+    }
+}
+
+RET_CODE AudioFifo::Init(const Properties &properties)
+{
+    sample_fmt_ = properties.GetProperty("sample_fmt", AV_SAMPLE_FMT_S16);
+    channels_ = properties.GetProperty("channels", 2);
+    sample_rate_ = properties.GetProperty("sample_rate", 48000);
+    frame_samples_ = properties.GetProperty("frame_samples", 1024);
+    int resync_threshold = properties.GetProperty("resync_threshold", 100);
+
+    if(channels_ <= 0 || sample_rate_ <= 0 || frame_samples_ <= 0) {
+        LogError("AudioFifo: invalid channels:%d, sample_rate:%d, frame_samples:%d",
+                 channels_, sample_rate_, frame_samples_);
+        return RET_ERR_ARGUMENTOUTOFRANGE;
+    }
+    int bytes_per_sample = av_get_bytes_per_sample((AVSampleFormat)sample_fmt_);
+    if(av_sample_fmt_is_planar((AVSampleFormat)sample_fmt_)) {
+        if(channels_ > AV_NUM_DATA_POINTERS) {
+            LogError("AudioFifo: planar channels:%d not support", channels_);
+            return RET_ERR_NOT_SUPPORT;
+        }
+        planes_ = channels_;
+        sample_stride_ = bytes_per_sample;
+    } else {
+        planes_ = 1;
+        sample_stride_ = bytes_per_sample * channels_;
+    }
+    resync_threshold_ = av_rescale(resync_threshold, sample_rate_, 1000);
+    // 积压最多不到一帧, 按两帧分配, 一般不会再扩容
+    fifo_ = av_audio_fifo_alloc((AVSampleFormat)sample_fmt_, channels_, frame_samples_ * 2);
+    if(!fifo_ || av_samples_alloc(frame_buf_, NULL, channels_, frame_samples_,
+                                  (AVSampleFormat)sample_fmt_, 0) < 0) {
+        LogError("AudioFifo: alloc failed");
+        return RET_ERR_OUTOFMEMORY;
+    }
+    return RET_OK;
+}
+
+RET_CODE AudioFifo::Push(uint8_t **data, int nb_samples, int64_t pts,
+                         const std::function<void(uint8_t **, int64_t)> &callback)
+{
+    if(!fifo_) {
+        return RET_FAIL;
+    }
+    int fifo_samples = av_audio_fifo_size(fifo_);
+    // 这一块第一个采样点按采样点数推算的时间和采集时间比较, 偏差太大(采集中断、时钟漂移)时重新对齐
+    int64_t chunk_pts = av_rescale(pts, sample_rate_, 1000);
+    int64_t expected_pts = next_pts_ + fifo_samples;
+    if(!has_pts_ || llabs(chunk_pts - expected_pts) > resync_threshold_) {
+        if(has_pts_) {
+            resyncs_++;
+            LogWarn("AudioFifo: resync pts, drift:%lldms", av_rescale(chunk_pts - expected_pts, 1000, sample_rate_));
+        }
+        next_pts_ = chunk_pts - fifo_samples;
+        has_pts_ = true;
+    }
+
+    int offset = 0;
+    uint8_t *planes[AV_NUM_DATA_POINTERS];
+    if(fifo_samples > 0) {
+        // 先和fifo里的尾巴凑一帧
+        int need = frame_samples_ - fifo_samples;
+        if(nb_samples < need) {
+            need = nb_samples;
+        }
+        if(av_audio_fifo_write(fifo_, (void **)data, need) < need) {
+            LogError("AudioFifo: av_audio_fifo_write failed");
+            return RET_FAIL;
+        }
+        offset = need;
+        if(av_audio_fifo_size(fifo_) >= frame_samples_) {
+            av_audio_fifo_read(fifo_, (void **)frame_buf_, frame_samples_);
+            callback(frame_buf_, av_rescale(next_pts_, 1000, sample_rate_));
+            next_pts_ += frame_samples_;
+        }
+    }
+    // fifo已经空了, 整帧直接回调输入的数据
+    while(nb_samples - offset >= frame_samples_) {
+        offsetPlanes(data, offset, planes);
+        callback(planes, av_rescale(next_pts_, 1000, sample_rate_));
+        next_pts_ += frame_samples_;
+        offset += frame_samples_;
+    }
+    if(offset < nb_samples) {
+        offsetPlanes(data, offset, planes);
+        int remain = nb_samples - offset;
+        if(av_audio_fifo_write(fifo_, (void **)planes, remain) < remain) {
+            LogError("AudioFifo: av_audio_fifo_write failed");
+            return RET_FAIL;
+        }
+    }
+    return RET_OK;
+}
+
+void AudioFifo::offsetPlanes(uint8_t **data, int offset, uint8_t **planes)
+{
+    for(int i = 0; i < planes_; i++) {
+        planes[i] = data[i] + offset * sample_stride_;
+    }
+}
+
+int AudioFifo::GetSamples()
+{
+    return fifo_ ? av_audio_fifo_size(fifo_) : 0;
+}
@@ -0,0 +1,66 @@
+﻿#ifndef AUDIOFIFO_H
+#define AUDIOFIFO_H
+
+#include <functional>
+#include "mediabase.h"
+extern "C" {
+#include <libavutil/audio_fifo.h>
+#include <libavutil/samplefmt.h>
+#include <libavutil/frame.h>
+}
+
+// 采集和编码之间的缓冲: 采集每次回调的采样点数可以是任意值(480、960、256...),
+// 每凑够编码器一帧的采样点数输出一帧
+// 时间戳按采样点数推算, 帧之间的间隔精确到采样点, 不受采集回调时刻抖动的影响;
+// 采集时间和推算的时间偏差超过resync_threshold时以采集时间为准重新对齐
+// 交错格式只用data[0], planar格式每个通道一个平面(重采样之后的数据)
+class AudioFifo
+{
+public:
+    AudioFifo();
+    ~AudioFifo();
+    /**
+     * @brief Init
+     * @param "sample_fmt", 采样格式, 缺省AV_SAMPLE_FMT_S16
+     *        "channels", 通道数, 缺省2
+     *        "sample_rate", 采样率, 缺省48000
+     *        "frame_samples", 每次输出的采样点数(编码器一帧), 缺省1024
+     *        "resync_threshold", 重新对齐时间戳的阈值(ms), 缺省100
+     * @return
+     */
+    RET_CODE Init(const Properties &properties);
+    /**
+     * @brief Push 送入一块采样, 每凑够一帧调用一次callback(帧数据, 帧时间戳ms)
+     *        fifo里没有积压时整帧的数据直接从输入回调, 不经过拷贝, 只有不够一帧的尾巴放进fifo
+     * @param data          采样数据, 交错格式只有data[0]
+     * @param nb_samples    每个通道的采样点数
+     * @param pts           第一个采样点的采集时间(ms)
+     * @return
+     */
+    RET_CODE Push(uint8_t **data, int nb_samples, int64_t pts,
+                  const std::function<void(uint8_t **, int64_t)> &callback);
+    // fifo里积压的采样点数, 总是小于一帧
+    int GetSamples();
+    // 时间戳重新对齐的次数
+    int64_t GetResyncs() {
+        return resyncs_;
+    }
+private:
+    // 第offset个采样点在每个平面里的地址
+    void offsetPlanes(uint8_t **data, int offset, uint8_t **planes);
+
+    AVAudioFifo *fifo_ = NULL;
+    uint8_t *frame_buf_[AV_NUM_DATA_POINTERS] = { NULL };   // 从fifo读出一帧
+    int sample_fmt_ = AV_SAMPLE_FMT_S16;
+    int channels_ = 2;
+    int sample_rate_ = 48000;
+    int frame_samples_ = 1024;
+    int planes_ = 1;                // 交错格式1个平面, planar格式每个通道一个
+    int sample_stride_ = 4;         // 平面里一个采样点的字节数
+    int64_t resync_threshold_ = 0;  // 单位: 采样点
+    bool has_pts_ = false;
+    int64_t next_pts_ = 0;          // fifo里第一个采样点的时间, 单位: 采样点
+    int64_t resyncs_ = 0;
+};
+
+#endif // AUDIOFIFO_H
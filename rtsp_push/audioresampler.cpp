@@ -0,0 +1,148 @@
+﻿#include <stdlib.h>
+#include "audioresampler.h"
+#include "dlog.h"
+extern "C" {
+#include <libavutil/channel_layout.h>
+#include <libavutil/mathematics.h>
+#include <libavutil/mem.h>
+}
+
+AudioResampler::AudioResampler()
+{
+
+}
+
+AudioResampler::~AudioResampler()
+{
+    if(out_buf_) {
+        av_freep(&out_buf_[0]);
+        av_freep(&out_buf_);
+    }
+    if(swr_ctx_) {
+        swr_free(&swr_ctx_);
+    }
+}
+
+RET_CODE AudioResampler::Init(const Properties &properties)
+{
+    src_sample_fmt_ = properties.GetProperty("src_sample_fmt", AV_SAMPLE_FMT_S16);
+    src_sample_rate_ = properties.GetProperty("src_sample_rate", 48000);
+    src_channels_ = properties.GetProperty("src_channels", 2);
+    dst_sample_fmt_ = properties.GetProperty("dst_sample_fmt", AV_SAMPLE_FMT_FLTP);
+    dst_sample_rate_ = properties.GetProperty("dst_sample_rate", 48000);
+    dst_channels_ = properties.GetProperty("dst_channels", 2);
+    compensation_ = properties.GetProperty("compensation", 0) != 0;
+    compensation_interval_ = properties.GetProperty("compensation_interval", 1000);
+    int compensation_threshold = properties.GetProperty("compensation_threshold", 20);
+    max_compensation_ppm_ = properties.GetProperty("max_compensation_ppm", 1000);
+    if(src_sample_rate_ <= 0 || dst_sample_rate_ <= 0 || compensation_interval_ <= 0) {
+        LogError("AudioResampler: invalid src_sample_rate:%d, dst_sample_rate:%d, compensation_interval:%lld",
+                 src_sample_rate_, dst_sample_rate_, compensation_interval_);
+        return RET_ERR_ARGUMENTOUTOFRANGE;
+    }
+    compensation_threshold_ = av_rescale(compensation_threshold, dst_sample_rate_, 1000);
+
+    swr_ctx_ = swr_alloc_set_opts(NULL,
+                                  av_get_default_channel_layout(dst_channels_),
+                                  (AVSampleFormat)dst_sample_fmt_, dst_sample_rate_,
+                                  av_get_default_channel_layout(src_channels_),
+                                  (AVSampleFormat)src_sample_fmt_, src_sample_rate_,
+                                  0, NULL);
+    if(!swr_ctx_) {
+        LogError("AudioResampler: swr_alloc_set_opts failed");
+        return RET_ERR_OUTOFMEMORY;
+    }
+    int ret = swr_init(swr_ctx_);
+    if(ret < 0) {
+        char buf[1024] = { 0 };
+        av_strerror(ret, buf, sizeof(buf) - 1);
+        LogError("AudioResampler: swr_init failed:%s", buf);
+        return RET_FAIL;
+    }
+    if(compensation_) {
+        // 采样率相同时swr不会创建重采样器, 先打开, 避免推流中途第一次补偿时重新初始化丢掉缓存的数据
+        ret = swr_set_compensation(swr_ctx_, 0, 0);
+        if(ret < 0) {
+            LogError("AudioResampler: swr_set_compensation failed:%d", ret);
+            return RET_FAIL;
+        }
+    }
+    LogInfo("AudioResampler: %s %dHz %dch -> %s %dHz %dch, compensation:%d",
+            av_get_sample_fmt_name((AVSampleFormat)src_sample_fmt_), src_sample_rate_, src_channels_,
+            av_get_sample_fmt_name((AVSampleFormat)dst_sample_fmt_), dst_sample_rate_, dst_channels_,
+            compensation_);
+    return RET_OK;
+}
+
+int AudioResampler::Convert(const uint8_t **in, int nb_samples, int64_t pts, uint8_t ***out, int64_t *out_pts)
+{
+    if(!swr_ctx_) {
+        return -1;
+    }
+    // 重采样器里还缓存着之前输入的数据, 这次输出的第一个采样点比这块输入早delay个采样点
+    int64_t delay = swr_get_delay(swr_ctx_, dst_sample_rate_);
+    if(compensation_) {
+        updateCompensation(pts);
+    }
+    int need = swr_get_out_samples(swr_ctx_, nb_samples);
+    if(need < 0) {
+        return -1;
+    }
+    if(need > out_buf_samples_) {
+        if(out_buf_) {
+            av_freep(&out_buf_[0]);
+            av_freep(&out_buf_);
+        }
+        if(av_samples_alloc_array_and_samples(&out_buf_, NULL, dst_channels_, need,
+                                              (AVSampleFormat)dst_sample_fmt_, 0) < 0) {
+            LogError("AudioResampler: alloc %d samples failed", need);
+            out_buf_samples_ = 0;
+            return -1;
+        }
+        out_buf_samples_ = need;
+    }
+    int ret = swr_convert(swr_ctx_, out_buf_, out_buf_samples_, in, nb_samples);
+    if(ret < 0) {
+        char buf[1024] = { 0 };
+        av_strerror(ret, buf, sizeof(buf) - 1);
+        LogError("AudioResampler: swr_convert failed:%s", buf);
+        return ret;
+    }
+    out_samples_ += ret;
+    *out = out_buf_;
+    *out_pts = pts - av_rescale(delay, 1000, dst_sample_rate_);
+    return ret;
+}
+
+void AudioResampler::updateCompensation(int64_t pts)
+{
+    if(start_pts_ < 0) {
+        start_pts_ = pts;
+        next_compensation_pts_ = pts + compensation_interval_;
+        return;
+    }
+    if(pts < next_compensation_pts_) {
+        return;
+    }
+    next_compensation_pts_ = pts + compensation_interval_;
+    // 按采集时间应该输出的采样点数, 和实际输出的(加上重采样器里缓存的)比较
+    int64_t expected = av_rescale(pts - start_pts_, dst_sample_rate_, 1000);
+    int64_t produced = out_samples_ + swr_get_delay(swr_ctx_, dst_sample_rate_);
+    int64_t error = expected - produced;
+    int distance = (int)av_rescale(compensation_interval_, dst_sample_rate_, 1000);
+    int64_t max_delta = (int64_t)distance * max_compensation_ppm_ / 1000000;
+    int64_t delta = 0;
+    if(llabs(error) > compensation_threshold_) {
+        // 在下一个周期内补偿, 每个周期最多调整max_compensation_ppm, 听不出音调变化
+        delta = error > max_delta ? max_delta : (error < -max_delta ? -max_delta : error);
+    }
+    int ret = swr_set_compensation(swr_ctx_, (int)delta, distance);
+    if(ret < 0) {
+        LogWarn("AudioResampler: swr_set_compensation %lld/%d failed:%d", delta, distance, ret);
+        return;
+    }
+    compensated_samples_ += delta;
+    if(delta != 0) {
+        LogDebug("AudioResampler: drift %lld samples, compensate %lld/%d", error, delta, distance);
+    }
+}
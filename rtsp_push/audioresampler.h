@@ -0,0 +1,68 @@
+﻿#ifndef AUDIORESAMPLER_H
+#define AUDIORESAMPLER_H
+
+#include "mediabase.h"
+extern "C" {
+#include <libswresample/swresample.h>
+#include <libavutil/samplefmt.h>
+}
+
+// 采集和编码之间的重采样: 一个SwrContext一次完成采样格式、采样率、通道数的转换
+// 打开漂移补偿时, 按采集时间和实际采样点数的偏差调用swr_set_compensation微调输出的采样点数,
+// 长时间推流时音频跟随系统时钟(视频时间戳用的时钟), 不会因为声卡时钟的误差越差越多
+class AudioResampler
+{
+public:
+    AudioResampler();
+    ~AudioResampler();
+    /**
+     * @brief Init
+     * @param "src_sample_fmt", "src_sample_rate", "src_channels", 输入格式, 缺省s16 48000 2
+     *        "dst_sample_fmt", "dst_sample_rate", "dst_channels", 输出格式, 缺省fltp 48000 2
+     *        "compensation", 是否打开漂移补偿, 缺省0
+     *        "compensation_interval", 多长时间调整一次补偿(ms), 缺省1000
+     *        "compensation_threshold", 偏差超过多少开始补偿(ms), 缺省20, 小于这个值当作采集抖动
+     *        "max_compensation_ppm", 补偿的最大比例(百万分之一), 缺省1000, 即最多拉伸/压缩0.1%
+     * @return
+     */
+    RET_CODE Init(const Properties &properties);
+    /**
+     * @brief Convert 转换一块输入
+     * @param in            输入数据, 交错格式只有in[0]
+     * @param nb_samples    输入的采样点数
+     * @param pts           第一个输入采样点的采集时间(ms)
+     * @param out           输出数据, 指向内部缓冲区, 下一次Convert之前有效
+     * @param out_pts       第一个输出采样点的时间(ms), 已经扣除重采样器内部缓存的延迟
+     * @return 输出的采样点数, <0出错
+     */
+    int Convert(const uint8_t **in, int nb_samples, int64_t pts, uint8_t ***out, int64_t *out_pts);
+    // 漂移补偿累计增加(正)或减少(负)的输出采样点数
+    int64_t GetCompensatedSamples() {
+        return compensated_samples_;
+    }
+private:
+    void updateCompensation(int64_t pts);
+
+    SwrContext *swr_ctx_ = NULL;
+    uint8_t **out_buf_ = NULL;
+    int out_buf_samples_ = 0;       // out_buf_能放下的采样点数
+
+    int src_sample_fmt_ = AV_SAMPLE_FMT_S16;
+    int src_sample_rate_ = 48000;
+    int src_channels_ = 2;
+    int dst_sample_fmt_ = AV_SAMPLE_FMT_FLTP;
+    int dst_sample_rate_ = 48000;
+    int dst_channels_ = 2;
+
+    // 漂移补偿
+    bool compensation_ = false;
+    int64_t compensation_interval_ = 1000;
+    int64_t compensation_threshold_ = 0;    // 单位: 输出采样点
+    int max_compensation_ppm_ = 1000;
+    int64_t start_pts_ = -1;            // 第一块输入的采集时间
+    int64_t out_samples_ = 0;           // 已经输出的采样点数
+    int64_t next_compensation_pts_ = 0;
+    int64_t compensated_samples_ = 0;
+};
+
+#endif // AUDIORESAMPLER_H
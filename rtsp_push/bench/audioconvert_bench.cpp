@@ -0,0 +1,133 @@
+﻿#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+#include "audioconvert.h"
+#include "simdlevel.h"
+
+// 2通道s16交错 -> fltp(PushWork::PcmCallback的格式), 对比原来的s16le_convert_to_fltp和AudioConvertToFltp的各个指令集实现
+// 先用所有16位取值逐位比较输出和原来的实现, 有不同就返回1; 再对1024/2048/4096个采样点的帧重复转换, 取中位数
+// 用法: audioconvert_bench [rounds]
+
+// PushWork里原来的实现, 原样保留用来对比
+// 只支持2通道 s16交错模式 -> float planar格式
+static void s16le_convert_to_fltp(short *s16le, float *fltp, int nb_samples) {
+    float *fltp_l = fltp;   // -1~1
+    float *fltp_r = fltp + nb_samples;
+    for(int i = 0; i < nb_samples; i++) {
+        fltp_l[i] = s16le[i*2]/32768.0;     // 0 2 4
+        fltp_r[i] = s16le[i*2+1]/32768.0;   // 1 3 5
+    }
+}
+
+static int64_t nowNs()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static const SimdLevel kLevels[] = {SIMD_NONE, SIMD_SSE2, SIMD_AVX2};
+static const int kLevelCount = sizeof(kLevels) / sizeof(kLevels[0]);
+
+// 左声道是全部65536个取值, 右声道倒序, 再从奇数偏移开始转一次, 覆盖SIMD主循环和标量尾巴
+static bool checkBitExact()
+{
+    const int nb_samples = 65536;
+    std::vector<int16_t> pcm(nb_samples * 2);
+    for(int i = 0; i < nb_samples; i++) {
+        pcm[i * 2] = (int16_t)(i - 32768);
+        pcm[i * 2 + 1] = (int16_t)(32767 - i);
+    }
+    bool ok = true;
+    const int offsets[] = {0, 1, 7};
+    for(size_t o = 0; o < sizeof(offsets) / sizeof(offsets[0]); o++) {
+        int count = nb_samples - offsets[o] - 3;    // 长度也不是向量宽度的整数倍
+        int16_t *src = pcm.data() + offsets[o] * 2;
+        std::vector<float> ref(count * 2);
+        s16le_convert_to_fltp((short *)src, ref.data(), count);
+        for(int l = 0; l < kLevelCount; l++) {
+            if(kLevels[l] > CpuSimdLevel()) {
+                continue;
+            }
+            AudioConvertSetSimdLevel(kLevels[l]);
+            std::vector<float> out(count * 2, -2.0f);
+            float *planes[2] = {out.data(), out.data() + count};
+            AudioConvertToFltp((const uint8_t *)src, AV_SAMPLE_FMT_S16, 2, count, planes);
+            if(memcmp(out.data(), ref.data(), out.size() * sizeof(float)) != 0) {
+                printf("bit-exact check failed: %s, offset %d, %d samples\n",
+                       SimdLevelName(kLevels[l]), offsets[o], count);
+                ok = false;
+            }
+        }
+    }
+    AudioConvertSetSimdLevel(CpuSimdLevel());
+    return ok;
+}
+
+static double medianNs(std::vector<int64_t> &ns)
+{
+    std::sort(ns.begin(), ns.end());
+    return (double)ns[ns.size() / 2];
+}
+
+// 一次计时转换batch帧, 单帧只有几百纳秒到几微秒, 单独计时的话时钟本身的开销占比太大
+static void runCase(int nb_samples, int rounds)
+{
+    const int batch = 100;
+    std::vector<int16_t> pcm(nb_samples * 2);
+    uint32_t seed = 12345;
+    for(size_t i = 0; i < pcm.size(); i++) {
+        seed = seed * 1103515245 + 12345;
+        pcm[i] = (int16_t)(seed >> 16);
+    }
+    std::vector<float> fltp(nb_samples * 2);
+    float *planes[2] = {fltp.data(), fltp.data() + nb_samples};
+    std::vector<int64_t> ns(rounds);
+
+    for(int r = 0; r < rounds; r++) {
+        int64_t begin = nowNs();
+        for(int b = 0; b < batch; b++) {
+            s16le_convert_to_fltp((short *)pcm.data(), fltp.data(), nb_samples);
+        }
+        ns[r] = (nowNs() - begin) / batch;
+    }
+    double old_ns = medianNs(ns);
+    printf("%4d samples  old    %8.0f ns/frame\n", nb_samples, old_ns);
+
+    for(int l = 0; l < kLevelCount; l++) {
+        if(kLevels[l] > CpuSimdLevel()) {
+            continue;
+        }
+        AudioConvertSetSimdLevel(kLevels[l]);
+        for(int r = 0; r < rounds; r++) {
+            int64_t begin = nowNs();
+            for(int b = 0; b < batch; b++) {
+                AudioConvertToFltp((const uint8_t *)pcm.data(), AV_SAMPLE_FMT_S16, 2, nb_samples, planes);
+            }
+            ns[r] = (nowNs() - begin) / batch;
+        }
+        double level_ns = medianNs(ns);
+        printf("%4d samples  %-6s %8.0f ns/frame  x%.1f vs old\n",
+               nb_samples, SimdLevelName(kLevels[l]), level_ns, old_ns / level_ns);
+    }
+    AudioConvertSetSimdLevel(CpuSimdLevel());
+}
+
+int main(int argc, char *argv[])
+{
+    int rounds = argc > 1 ? atoi(argv[1]) : 200;
+    printf("cpu simd: %s, s16 stereo, median of %d rounds x 100 frames\n",
+           SimdLevelName(CpuSimdLevel()), rounds);
+    if(!checkBitExact()) {
+        return 1;
+    }
+    printf("bit-exact vs s16le_convert_to_fltp: ok\n");
+    const int sizes[] = {1024, 2048, 4096};
+    for(size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        runCase(sizes[s], rounds);
+    }
+    return 0;
+}
@@ -0,0 +1,20 @@
+TEMPLATE = app
+CONFIG += console c++11
+CONFIG -= app_bundle
+CONFIG -= qt
+
+# 2通道s16 -> fltp, 原来的s16le_convert_to_fltp和AudioConvertToFltp各指令集对比压测, 带逐位比较, 结果见README.md
+INCLUDEPATH += $$PWD/..
+
+SOURCES += audioconvert_bench.cpp \
+    ../audioconvert.cpp
+
+HEADERS += \
+    ../audioconvert.h \
+    ../simdlevel.h
+
+#ffmpeg
+INCLUDEPATH += "/usr/local/include"
+
+LIBS += -L"/usr/local/lib"  \
+-lavutil
@@ -0,0 +1,155 @@
+﻿#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <vector>
+#include <thread>
+#include <chrono>
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+#include "commonlooper.h"
+#include "executor.h"
+#include "deadlinetimer.h"
+#include "histogram.h"
+#include "timesutil.h"
+#include "dlog.h"
+
+// N路模拟的推流在共享Executor上协作运行, 和每个组件一个线程(原来的方式)对比
+// 每一路是一个和AudioCapturer一样按1024采样点@48kHz(21.33ms)周期工作的组件, 每个周期忙等work_us模拟读取+重采样+编码
+// 统计: 每个周期实际开始处理时比deadline晚多少(lateness), 超过一个周期算丢帧; 进程CPU时间和上下文切换次数
+// 用法: executor_bench [seconds] [work_us] [pool_threads]
+
+static LatencyHistogram g_lateness;     // 所有组件共用, Record是原子操作
+static std::atomic<int64_t> g_late_frames{0};
+
+class SimPipeline: public CommonLooper
+{
+public:
+    SimPipeline(double period_us, int work_us)
+        : period_us_(period_us), work_us_(work_us)
+    {
+        thread_name_ = "sim_pipeline";
+    }
+    virtual ~SimPipeline()
+    {
+        Stop();
+    }
+    virtual bool Cooperative() {
+        return true;
+    }
+    // 独立线程: 和AudioCapturer::Loop一样睡到deadline
+    virtual void Loop()
+    {
+        timer_.Start(period_us_);
+        while(!request_abort_) {
+            record(timer_.WaitNext());
+            work();
+        }
+    }
+    // 协作模式: 和AudioCapturer::Step一样把下一个deadline交给Executor::PostAt
+    virtual int64_t Step()
+    {
+        if(0 == deadline_) {
+            timer_.Start(period_us_);
+            deadline_ = timer_.NextDeadline();
+        }
+        record(timer_.Reached(deadline_));
+        work();
+        deadline_ = timer_.NextDeadline();
+        return deadline_;
+    }
+private:
+    void record(int64_t lateness)
+    {
+        g_lateness.Record(lateness);
+        if(lateness > period_us_) {
+            g_late_frames++;
+        }
+    }
+    void work()
+    {
+        int64_t end = TimesUtil::GetTimeMicrosecond() + work_us_;
+        while(TimesUtil::GetTimeMicrosecond() < end) {
+        }
+    }
+
+    double period_us_;
+    int work_us_;
+    DeadlineTimer timer_;
+    int64_t deadline_ = 0;
+};
+
+typedef struct usage
+{
+    int64_t cpu_us;         // 用户态+内核态
+    int64_t switches;       // 主动+被动上下文切换
+}Usage;
+
+static Usage getUsage()
+{
+    Usage usage = {0, 0};
+#ifndef _WIN32
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    usage.cpu_us = (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000LL + ru.ru_utime.tv_usec + ru.ru_stime.tv_usec;
+    usage.switches = ru.ru_nvcsw + ru.ru_nivcsw;
+#endif
+    return usage;
+}
+
+// pool_threads为0时每一路一个线程
+static void runCase(int pipelines, int pool_threads, int seconds, int work_us)
+{
+    const double period_us = 1024 * 1000000.0 / 48000;
+    Executor *executor = pool_threads > 0 ? new Executor(pool_threads) : NULL;
+    std::vector<SimPipeline *> loopers;
+    for(int i = 0; i < pipelines; i++) {
+        SimPipeline *looper = new SimPipeline(period_us, work_us);
+        looper->Start(executor);        // executor为NULL时退回独立线程
+        loopers.push_back(looper);
+    }
+    // 只统计全部启动之后的稳定阶段, 不算创建线程和逐个Stop的时间
+    std::this_thread::sleep_for(std::chrono::milliseconds(500));
+    HistogramStats lateness;
+    g_lateness.GetStats(&lateness, true);
+    g_late_frames = 0;
+    Usage begin = getUsage();
+    int64_t begin_us = TimesUtil::GetTimeMicrosecond();
+    std::this_thread::sleep_for(std::chrono::seconds(seconds));
+    int64_t elapsed_us = TimesUtil::GetTimeMicrosecond() - begin_us;
+    Usage end = getUsage();
+    g_lateness.GetStats(&lateness, true);
+    int64_t late_frames = g_late_frames;
+    for(size_t i = 0; i < loopers.size(); i++) {
+        delete loopers[i];
+    }
+    if(executor) {
+        executor->Shutdown();
+        delete executor;
+    }
+    char mode[32];
+    if(pool_threads > 0) {
+        snprintf(mode, sizeof(mode), "pool(%d)", pool_threads);
+    } else {
+        snprintf(mode, sizeof(mode), "threads(%d)", pipelines);
+    }
+    printf("%4d pipelines %-13s cpu:%5.1f%% switches/s:%7.0f frames/s:%6.0f | lateness us p50:%5lld p99:%6lld max:%7lld | late frames:%lld\n",
+           pipelines, mode, (end.cpu_us - begin.cpu_us) * 100.0 / elapsed_us,
+           (end.switches - begin.switches) * 1000000.0 / elapsed_us, lateness.count * 1000000.0 / elapsed_us,
+           (long long)lateness.p50, (long long)lateness.p99, (long long)lateness.max, (long long)late_frames);
+}
+
+int main(int argc, char *argv[])
+{
+    int seconds = argc > 1 ? atoi(argv[1]) : 3;
+    int work_us = argc > 2 ? atoi(argv[2]) : 100;
+    int pool_threads = argc > 3 ? atoi(argv[3]) : 2;
+    init_logger("log", S_WARN);     // Start/Stop的LogInfo不输出
+    printf("period 21.33ms, work %dus per period, %ds per case\n", work_us, seconds);
+    const int pipelines[] = {1, 4, 16, 64, 128};
+    for(size_t i = 0; i < sizeof(pipelines) / sizeof(pipelines[0]); i++) {
+        runCase(pipelines[i], 0, seconds, work_us);
+        runCase(pipelines[i], pool_threads, seconds, work_us);
+    }
+    return 0;
+}
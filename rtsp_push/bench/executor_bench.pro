@@ -0,0 +1,20 @@
+TEMPLATE = app
+CONFIG += console c++11
+CONFIG -= app_bundle
+CONFIG -= qt
+
+# N路推流在共享Executor上运行和每个组件一个线程的对比压测, 结果见README.md
+INCLUDEPATH += $$PWD/..
+
+SOURCES += executor_bench.cpp \
+    ../commonlooper.cpp \
+    ../executor.cpp \
+    ../dlog.cpp
+
+HEADERS += \
+    ../commonlooper.h \
+    ../executor.h \
+    ../deadlinetimer.h \
+    ../histogram.h
+
+LIBS += -pthread
@@ -0,0 +1,202 @@
+﻿#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+#include "h264encoder.h"
+#include "packetpool.h"
+#include "dlog.h"
+
+// H264Encoder在不同线程数、线程类型、preset下的吞吐和时延
+// 帧一送完就送下一帧(不按帧率等待), 统计:
+//   encode: 每帧EncodeFrame(送入+取出能输出的packet)的耗时
+//   latency: 从送入一帧到拿到这一帧的packet
+//   delay: 拿到packet时已经多送入了几帧, 帧级多线程和lookahead会让它大于0; 实时推流时每一帧是一个帧间隔
+// 用法: h264encoder_bench [frames] [width] [height]
+
+static const int kFps = 25;
+
+static int64_t nowUs()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+typedef struct encode_result
+{
+    double fps;
+    int64_t encode_p50;
+    int64_t encode_p99;
+    int64_t latency_p50;
+    int64_t latency_p99;
+    int64_t delay_max;
+    double kbps;
+}EncodeResult;
+
+static int64_t percentile(std::vector<int64_t> values, int p)
+{
+    if(values.empty()) {
+        return 0;
+    }
+    std::sort(values.begin(), values.end());
+    return values[std::min(values.size() - 1, values.size() * p / 100)];
+}
+
+// 平滑的渐变加少量噪声, 每帧平移一个像素, 模拟摄像头缓慢移动的画面
+static void fillFrame(AVFrame *frame, int index)
+{
+    uint32_t seed = 12345 + index;
+    for(int y = 0; y < frame->height; y++) {
+        uint8_t *row = frame->data[0] + (int64_t)y * frame->linesize[0];
+        int sy = y + index;
+        for(int x = 0; x < frame->width; x++) {
+            int sx = x + index;
+            seed = seed * 1103515245 + 12345;
+            row[x] = (uint8_t)(((sx * 3 + sy * 2) / 4 + (((sx / 16 + sy / 16) & 1) * 40) + ((seed >> 16) & 7)) & 0xff);
+        }
+    }
+    for(int i = 1; i < 3; i++) {
+        for(int y = 0; y < frame->height / 2; y++) {
+            memset(frame->data[i] + (int64_t)y * frame->linesize[i], 128, frame->width / 2);
+        }
+    }
+}
+
+static bool runCase(int count, int width, int height, const char *preset, const char *tune,
+                    int threads, const char *thread_type, EncodeResult *result)
+{
+    Properties properties;
+    properties.SetProperty("width", width);
+    properties.SetProperty("height", height);
+    properties.SetProperty("fps", kFps);
+    properties.SetProperty("bitrate", 2 * 1024 * 1024);
+    properties.SetProperty("gop", kFps);
+    properties.SetProperty("threads", threads);
+    properties.SetProperty("thread_type", thread_type);
+    properties.SetProperty("preset", preset);
+    properties.SetProperty("tune", tune);
+    H264Encoder encoder;
+    if(encoder.Init(properties) != RET_OK) {
+        printf("H264Encoder Init failed\n");
+        return false;
+    }
+    AVFrame *frame = av_frame_alloc();
+    frame->width = width;
+    frame->height = height;
+    frame->format = AV_PIX_FMT_YUV420P;
+    av_frame_get_buffer(frame, 32);
+
+    std::vector<int64_t> sent_time(count, 0);
+    std::vector<int64_t> encode_us;
+    std::vector<int64_t> latency_us;
+    int64_t delay_max = 0;
+    int64_t size = 0;
+    int64_t index = 0;
+    int64_t encode_end = 0;
+    PacketSink sink = [&](AVPacket *packet) {
+        int64_t pts = packet->pts;
+        if(pts >= 0 && pts < count) {
+            delay_max = std::max(delay_max, index - pts);
+            if(encode_end > 0) {
+                latency_us.push_back(encode_end - sent_time[pts]);
+            }
+        }
+        size += packet->size;
+        PacketPool::GetInstance()->Free(&packet);
+    };
+    // 生成画面不算在编码时间里, 先准备好64帧循环使用
+    std::vector<AVFrame *> sources;
+    for(int i = 0; i < std::min(count, 64); i++) {
+        AVFrame *source = av_frame_alloc();
+        source->width = width;
+        source->height = height;
+        source->format = AV_PIX_FMT_YUV420P;
+        av_frame_get_buffer(source, 32);
+        fillFrame(source, i);
+        sources.push_back(source);
+    }
+    int64_t begin = nowUs();
+    std::vector<AVPacket *> packets;
+    for(index = 0; index < count; index++) {
+        av_frame_make_writable(frame);      // 编码器可能还持有上一帧的引用
+        av_frame_copy(frame, sources[index % sources.size()]);
+        int64_t t0 = nowUs();
+        sent_time[index] = t0;
+        packets.clear();
+        RET_CODE ret = encoder.EncodeFrame(frame, index, &packets);
+        encode_end = nowUs();
+        encode_us.push_back(encode_end - t0);
+        for(size_t i = 0; i < packets.size(); i++) {
+            sink(packets[i]);
+        }
+        if(ret != RET_OK) {
+            printf("EncodeFrame failed:%d\n", ret);
+            break;
+        }
+    }
+    encode_end = 0;     // flush出来的帧不算latency, delay按多等了一帧算
+    index = count;
+    encoder.Flush(sink);
+    int64_t elapsed = nowUs() - begin;
+    for(size_t i = 0; i < sources.size(); i++) {
+        av_frame_free(&sources[i]);
+    }
+    av_frame_free(&frame);
+
+    result->fps = count * 1000000.0 / elapsed;
+    result->encode_p50 = percentile(encode_us, 50);
+    result->encode_p99 = percentile(encode_us, 99);
+    result->latency_p50 = percentile(latency_us, 50);
+    result->latency_p99 = percentile(latency_us, 99);
+    result->delay_max = delay_max;
+    result->kbps = size * 8.0 / ((double)count / kFps) / 1000;
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    int count = argc > 1 ? atoi(argv[1]) : 250;
+    int width = argc > 2 ? atoi(argv[2]) : 1280;
+    int height = argc > 3 ? atoi(argv[3]) : 720;
+    init_logger("log", S_WARN);     // frame线程的延迟告警会输出到日志
+    printf("%dx%d, %d frames, libavcodec %d.%d.%d\n", width, height, count,
+           LIBAVCODEC_VERSION_MAJOR, LIBAVCODEC_VERSION_MINOR, LIBAVCODEC_VERSION_MICRO);
+    typedef struct bench_case
+    {
+        const char *preset;
+        const char *tune;
+        int threads;
+        const char *thread_type;
+    }BenchCase;
+    std::vector<BenchCase> cases;
+    const char *presets[] = {"ultrafast", "superfast", "veryfast"};
+    const BenchCase threadings[] = {
+        {NULL, NULL, 1, "slice"}, {NULL, NULL, 2, "slice"}, {NULL, NULL, 4, "slice"},
+        {NULL, NULL, 2, "frame"}, {NULL, NULL, 4, "frame"}
+    };
+    for(size_t p = 0; p < sizeof(presets) / sizeof(presets[0]); p++) {
+        for(size_t t = 0; t < sizeof(threadings) / sizeof(threadings[0]); t++) {
+            BenchCase c = threadings[t];
+            c.preset = presets[p];
+            c.tune = "zerolatency";
+            cases.push_back(c);
+        }
+    }
+    BenchCase lookahead = {"veryfast", "", 1, "slice"};    // 不加zerolatency: lookahead带来的延迟
+    cases.push_back(lookahead);
+    for(size_t i = 0; i < cases.size(); i++) {
+        const BenchCase &c = cases[i];
+        EncodeResult r;
+        if(!runCase(count, width, height, c.preset, c.tune, c.threads, c.thread_type, &r)) {
+            return 1;
+        }
+        printf("%-9s %-11s threads:%d(%-5s) %6.1f fps | encode us p50:%6lld p99:%6lld | "
+               "latency us p50:%7lld p99:%7lld | delay frames max:%2lld | %5.0f kbps\n",
+               c.preset, c.tune[0] ? c.tune : "-", c.threads, c.thread_type, r.fps,
+               (long long)r.encode_p50, (long long)r.encode_p99,
+               (long long)r.latency_p50, (long long)r.latency_p99, (long long)r.delay_max, r.kbps);
+    }
+    return 0;
+}
@@ -0,0 +1,24 @@
+TEMPLATE = app
+CONFIG += console c++11
+CONFIG -= app_bundle
+CONFIG -= qt
+
+# H264Encoder在不同线程数、线程类型、preset下的吞吐和时延, 结果见README.md
+INCLUDEPATH += $$PWD/..
+
+SOURCES += h264encoder_bench.cpp \
+    ../h264encoder.cpp \
+    ../dlog.cpp
+
+HEADERS += \
+    ../h264encoder.h \
+    ../packetpool.h
+
+#ffmpeg
+INCLUDEPATH += "/usr/local/include"
+
+LIBS += -pthread
+
+LIBS += -L"/usr/local/lib"  \
+-lavcodec \
+-lavutil
@@ -0,0 +1,152 @@
+﻿#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include "messagequeue.h"
+#include "mutexmessagequeue.h"
+#include "dlog.h"
+
+// 控制消息风暴: 一个生产者每毫秒放10条消息(10k msg/s), 9条MSG_RTSP_QUEUE_DURATION(notify_msg4, 32字节obj)
+// 加1条MSG_RTSP_BACKPRESSURE(notify_msg3), 和RtspPusher持续积压时发的一样; 一个消费者msg_queue_get取出处理.
+// 对比MessageQueue(环形缓冲区, 同类型合并)和原来的实现(mutexmessagequeue.h, 每条消息一个链表节点)
+// 消费者处理一条消息的耗时用sleep模拟: 0(只取出), 200us(写一行日志到文件和终端的量级)
+// arg1是消息序号, 消费者据此统计看到的状态落后多久
+// 用法: messagequeue_bench [seconds] [slow_us]
+
+static const int kMsgPerMs = 10;
+
+static int64_t nowNs()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static int64_t percentile(std::vector<int64_t> &values, int p)
+{
+    if(values.empty()) {
+        return 0;
+    }
+    std::sort(values.begin(), values.end());
+    return values[std::min(values.size() - 1, values.size() * p / 100)];
+}
+
+typedef struct bench_result
+{
+    int64_t puts;
+    int64_t gets;               // 消费者取出(处理)的次数
+    int64_t put_p50;            // ns
+    int64_t put_p99;
+    int64_t stale_p50;          // 取出时这条消息已经放进去多久了, us
+    int64_t stale_p99;
+    int64_t max_backlog;        // 最多有几条消息放进去了还没被消费者看到(被合并的也算)
+    int64_t drain_ms;           // 生产者停下之后, 消费者还要多久才看到最后一条
+}BenchResult;
+
+template <typename Queue>
+static void runCase(int seconds, int handle_us, BenchResult *result)
+{
+    Queue queue;
+    const int64_t total = (int64_t)seconds * 1000 * kMsgPerMs;
+    std::vector<int64_t> put_time(total, 0);
+    std::vector<int64_t> put_ns;
+    put_ns.reserve(total);
+    std::atomic<int64_t> put_count(0);
+    std::atomic<int64_t> last_seen(-1);
+
+    std::vector<int64_t> stale_us;
+    int64_t gets = 0;
+    int64_t max_backlog = 0;
+    std::thread consumer([&] {
+        int64_t consumed = 0;       // 合并的消息按count计
+        AVMessage msg;
+        for(;;) {
+            int ret = queue.msg_queue_get(&msg, 100);
+            if(ret < 0) {           // abort
+                break;
+            }
+            if(ret == 0) {          // 超时没有消息
+                continue;
+            }
+            int64_t now = nowNs();
+            int64_t seq = msg.arg1;
+            stale_us.push_back((now - put_time[seq]) / 1000);
+            consumed += msg.count > 0 ? msg.count : 1;
+            max_backlog = std::max(max_backlog, put_count.load() - consumed);
+            if(msg.obj && msg.free_l) {
+                msg.free_l(msg.obj);
+            }
+            gets++;
+            if(seq > last_seen.load()) {
+                last_seen.store(seq);
+            }
+            if(handle_us > 0) {
+                std::this_thread::sleep_for(std::chrono::microseconds(handle_us));
+            }
+        }
+    });
+
+    int32_t payload[8] = {0};
+    int64_t seq = 0;
+    std::chrono::steady_clock::time_point tick = std::chrono::steady_clock::now();
+    while(seq < total) {
+        tick += std::chrono::milliseconds(1);
+        for(int i = 0; i < kMsgPerMs; i++, seq++) {
+            payload[0] = (int32_t)seq;
+            int64_t begin = nowNs();
+            put_time[seq] = begin;
+            if(i == kMsgPerMs - 1) {
+                queue.notify_msg3(MSG_RTSP_BACKPRESSURE, (int)seq, 1);
+            } else {
+                queue.notify_msg4(MSG_RTSP_QUEUE_DURATION, (int)seq, 0, payload, sizeof(payload));
+            }
+            put_ns.push_back(nowNs() - begin);
+            put_count.store(seq + 1);
+        }
+        std::this_thread::sleep_until(tick);
+    }
+    int64_t stop = nowNs();
+    while(last_seen.load() < total - 1 && nowNs() - stop < 60000000000LL) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    result->drain_ms = (nowNs() - stop) / 1000000;
+    queue.msg_queue_abort();
+    consumer.join();
+
+    result->puts = total;
+    result->gets = gets;
+    result->put_p50 = percentile(put_ns, 50);
+    result->put_p99 = percentile(put_ns, 99);
+    result->stale_p50 = percentile(stale_us, 50);
+    result->stale_p99 = percentile(stale_us, 99);
+    result->max_backlog = max_backlog;
+}
+
+static void printResult(const char *name, int handle_us, const BenchResult &r)
+{
+    printf("%-6s handle:%4dus | puts:%lld gets:%lld | put ns p50:%4lld p99:%5lld | "
+           "stale us p50:%8lld p99:%8lld | backlog max:%6lld | drain:%5lld ms\n",
+           name, handle_us, (long long)r.puts, (long long)r.gets, (long long)r.put_p50, (long long)r.put_p99,
+           (long long)r.stale_p50, (long long)r.stale_p99, (long long)r.max_backlog, (long long)r.drain_ms);
+}
+
+int main(int argc, char *argv[])
+{
+    int seconds = argc > 1 ? atoi(argv[1]) : 2;
+    int slow_us = argc > 2 ? atoi(argv[2]) : 200;
+    init_logger("log", S_WARN);     // 原来的实现put时有LogInfo, 按日志级别过滤掉, 只剩级别判断的开销
+    printf("%d msg/s for %d s\n", kMsgPerMs * 1000, seconds);
+    const int handles[] = {0, slow_us};
+    for(size_t h = 0; h < sizeof(handles) / sizeof(handles[0]); h++) {
+        BenchResult r;
+        runCase<MessageQueue>(seconds, handles[h], &r);
+        printResult("ring", handles[h], r);
+        runCase<MutexMessageQueue>(seconds, handles[h], &r);
+        printResult("list", handles[h], r);
+    }
+    return 0;
+}
@@ -0,0 +1,22 @@
+TEMPLATE = app
+CONFIG += console c++11
+CONFIG -= app_bundle
+CONFIG -= qt
+
+# 10k msg/s控制消息风暴, MessageQueue和原来的链表实现(mutexmessagequeue.h)对比压测, 结果见README.md
+INCLUDEPATH += $$PWD/..
+
+SOURCES += messagequeue_bench.cpp \
+    ../dlog.cpp
+
+HEADERS += \
+    ../messagequeue.h \
+    mutexmessagequeue.h
+
+#ffmpeg
+INCLUDEPATH += "/usr/local/include"
+
+LIBS += -pthread
+
+LIBS += -L"/usr/local/lib"  \
+-lavutil
@@ -0,0 +1,113 @@
+﻿#ifndef MUTEXPACKETQUEUE_H
+#define MUTEXPACKETQUEUE_H
+#include <mutex>
+#include <condition_variable>
+#include <queue>
+#include <stdlib.h>
+#include "mediabase.h"
+#include "packetqueue.h"
+extern "C"
+{
+#include "libavcodec/avcodec.h"
+}
+
+typedef struct mutex_queue_item
+{
+    AVPacket *pkt;
+    MediaType media_type;
+}MutexQueueItem;
+
+// 改成无锁环形队列之前的PacketQueue: 一把锁+条件变量保护std::queue, 每个包malloc一个节点,
+// 统计也在锁里更新. 只保留压测用到的接口, 作为packetqueue_bench的对照组
+class MutexPacketQueue
+{
+public:
+    int Push(AVPacket *pkt, MediaType media_type)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if(abort_request_) {
+            return -1;
+        }
+        MutexQueueItem *item = (MutexQueueItem *)malloc(sizeof(MutexQueueItem));
+        if(!item) {
+            return -1;
+        }
+        item->pkt = pkt;
+        item->media_type = media_type;
+        if(E_AUDIO_TYPE == media_type) {
+            audio_nb_packets_++;
+            audio_size_ += pkt->size;
+            audio_back_pts_ = pkt->pts;
+        } else {
+            video_nb_packets_++;
+            video_size_ += pkt->size;
+            video_back_pts_ = pkt->pts;
+        }
+        queue_.push(item);
+        cond_.notify_one();
+        return 0;
+    }
+    // 返回值: -1 abort;  0  没有消息； 1有消息
+    int PopWithTimeout(AVPacket **pkt, MediaType &media_type, int timeout)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if(queue_.empty()) {
+            cond_.wait_for(lock, std::chrono::milliseconds(timeout), [this] {
+                return !queue_.empty() || abort_request_;
+            });
+        }
+        if(abort_request_) {
+            return -1;
+        }
+        if(queue_.empty()) {
+            return 0;
+        }
+        MutexQueueItem *item = queue_.front();
+        *pkt = item->pkt;
+        media_type = item->media_type;
+        if(E_AUDIO_TYPE == media_type) {
+            audio_nb_packets_--;
+            audio_size_ -= item->pkt->size;
+            audio_front_pts_ = item->pkt->pts;
+        } else {
+            video_nb_packets_--;
+            video_size_ -= item->pkt->size;
+            video_front_pts_ = item->pkt->pts;
+        }
+        queue_.pop();
+        free(item);
+        return 1;
+    }
+    // 和原来一样在锁里算统计, 只填压测用到的字段
+    void GetStats(PacketQueueStats *stats)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stats->audio_nb_packets = audio_nb_packets_;
+        stats->video_nb_packets = video_nb_packets_;
+        stats->audio_size = audio_size_;
+        stats->video_size = video_size_;
+        stats->audio_duration = audio_back_pts_ - audio_front_pts_;
+        stats->video_duration = video_back_pts_ - video_front_pts_;
+    }
+    void Abort()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        abort_request_ = true;
+        cond_.notify_all();
+    }
+private:
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    std::queue<MutexQueueItem *> queue_;
+    bool abort_request_ = false;
+    int audio_nb_packets_ = 0;
+    int video_nb_packets_ = 0;
+    int audio_size_ = 0;
+    int video_size_ = 0;
+    int64_t audio_front_pts_ = 0;
+    int64_t audio_back_pts_ = 0;
+    int64_t video_front_pts_ = 0;
+    int64_t video_back_pts_ = 0;
+};
+
+#endif // MUTEXPACKETQUEUE_H
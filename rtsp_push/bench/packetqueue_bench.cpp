@@ -0,0 +1,245 @@
+﻿#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <thread>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+#include "packetqueue.h"
+#include "histogram.h"
+#include "mutexpacketqueue.h"
+
+// 对比无锁环形队列PacketQueue和原来的锁+std::queue(MutexPacketQueue)
+// 一个音频生产者线程、一个视频生产者线程、一个消费者线程(和推流时一样)
+//   flood: 生产者不停地推, 测吞吐和单次Push的耗时(锁竞争体现在Push的长尾上)
+//   paced: 生产者每推一个包sleep interval_us, 消费者阻塞等待, 测入队到出队的时延(唤醒开销)
+//   stats: 和flood一样, 另外一个线程不停地GetStats(模拟监控), 测读统计的耗时和对生产者的影响
+//   drain: 单线程, 队列里先放好音视频各512个包, 比较逐个出队和PopBatch的每包开销(只算消费者)
+//          每次出队前和RtspPusher::Loop一样取一次统计快照、检查一次积压时长
+// spsc-b是同一个PacketQueue, 消费者用PopBatch一次最多取64个(和RtspPusher一样), 其它是一次Pop一个
+// 用法: packetqueue_bench [packets_per_producer] [runs]
+
+static int64_t nowNs()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+typedef struct bench_result
+{
+    double mpps;                // 吞吐, 百万包/秒
+    HistogramStats push_ns;     // 单次Push耗时
+    HistogramStats latency_ns;  // 入队到出队
+    HistogramStats stats_ns;    // 单次GetStats耗时
+}BenchResult;
+
+// 包提前分配好, 每轮复用, 不把av_packet_alloc算进去
+static std::vector<AVPacket *> allocPackets(int count, int size)
+{
+    std::vector<AVPacket *> pkts(count);
+    for(int i = 0; i < count; i++) {
+        pkts[i] = av_packet_alloc();
+        av_new_packet(pkts[i], size);
+        pkts[i]->pts = i;
+        pkts[i]->dts = i;
+    }
+    return pkts;
+}
+
+// PacketQueue构造需要帧时长, 包一层给模板用
+class SpscPacketQueue: public PacketQueue
+{
+public:
+    SpscPacketQueue() : PacketQueue(23.2, 40) {}
+};
+
+// 消费者用PopBatch
+class SpscBatchPacketQueue: public SpscPacketQueue
+{
+};
+
+static const int kBatchSize = 64;
+
+// 消费者每次取包, 返回取到的个数
+template <typename Queue>
+static int popPackets(Queue &queue, AVPacket **pkts, MediaType *media_types)
+{
+    return queue.PopWithTimeout(&pkts[0], media_types[0], 10) == 1 ? 1 : 0;
+}
+
+static int popPackets(SpscBatchPacketQueue &queue, AVPacket **pkts, MediaType *media_types)
+{
+    int count = queue.PopBatch(pkts, media_types, kBatchSize, 10);
+    return count > 0 ? count : 0;
+}
+
+// interval_us为0时不停地推; stats_reader为true时另起一个线程不停地读统计
+template <typename Queue>
+static BenchResult runOnce(Queue &queue, std::vector<AVPacket *> &audio, std::vector<AVPacket *> &video,
+                           int interval_us, bool stats_reader)
+{
+    LatencyHistogram push_ns;
+    LatencyHistogram latency_ns;
+    LatencyHistogram stats_ns;
+    std::atomic<bool> done{false};
+    auto produce = [&queue, &push_ns, interval_us](std::vector<AVPacket *> &pkts, MediaType media_type) {
+        for(size_t i = 0; i < pkts.size(); ) {
+            if(interval_us > 0) {       // 用sleep而不是忙等, 单核机器上也不会饿死消费者
+                std::this_thread::sleep_for(std::chrono::microseconds(interval_us));
+            }
+            pkts[i]->pos = nowNs();         // 出队时用来算时延
+            int64_t begin = nowNs();
+            int ret = queue.Push(pkts[i], media_type);
+            int64_t end = nowNs();
+            if(ret < 0) {                   // 环满了, 等消费者
+                std::this_thread::yield();
+                continue;
+            }
+            push_ns.Record(end - begin);
+            i++;
+        }
+    };
+    size_t total = audio.size() + video.size();
+    int64_t begin = nowNs();
+    std::thread audio_thread(produce, std::ref(audio), E_AUDIO_TYPE);
+    std::thread video_thread(produce, std::ref(video), E_VIDEO_TYPE);
+    std::thread reader_thread;
+    if(stats_reader) {
+        reader_thread = std::thread([&queue, &stats_ns, &done]() {
+            PacketQueueStats stats;
+            while(!done) {
+                int64_t begin = nowNs();
+                queue.GetStats(&stats);
+                stats_ns.Record(nowNs() - begin);
+            }
+        });
+    }
+    AVPacket *pkts[kBatchSize];
+    MediaType media_types[kBatchSize];
+    for(size_t received = 0; received < total; ) {
+        int count = popPackets(queue, pkts, media_types);
+        int64_t now = nowNs();
+        for(int i = 0; i < count; i++) {
+            latency_ns.Record(now - pkts[i]->pos);
+        }
+        received += count;
+    }
+    int64_t elapsed = nowNs() - begin;
+    audio_thread.join();
+    video_thread.join();
+    done = true;
+    if(reader_thread.joinable()) {
+        reader_thread.join();
+    }
+    BenchResult result;
+    result.mpps = total * 1000.0 / elapsed;
+    push_ns.GetStats(&result.push_ns);
+    latency_ns.GetStats(&result.latency_ns);
+    stats_ns.GetStats(&result.stats_ns);
+    return result;
+}
+
+// 多轮取吞吐的中位数那一轮
+template <typename Queue>
+static void runCase(const char *name, const char *mode, int runs, std::vector<AVPacket *> &audio,
+                    std::vector<AVPacket *> &video, int interval_us, bool stats_reader = false)
+{
+    std::vector<BenchResult> results;
+    for(int i = 0; i < runs; i++) {
+        Queue *queue = new Queue();
+        results.push_back(runOnce(*queue, audio, video, interval_us, stats_reader));
+        delete queue;
+    }
+    std::sort(results.begin(), results.end(), [](const BenchResult &a, const BenchResult &b) {
+        return a.mpps < b.mpps;
+    });
+    const BenchResult &r = results[results.size() / 2];
+    printf("%-8s %-6s %8.2f Mpkt/s | push ns p50:%5lld p99:%6lld max:%8lld | latency ns p50:%7lld p99:%8lld max:%9lld\n",
+           name, mode, r.mpps,
+           (long long)r.push_ns.p50, (long long)r.push_ns.p99, (long long)r.push_ns.max,
+           (long long)r.latency_ns.p50, (long long)r.latency_ns.p99, (long long)r.latency_ns.max);
+    if(stats_reader) {
+        printf("%-8s %-6s GetStats calls:%lld ns p50:%5lld p99:%6lld max:%8lld\n", name, mode,
+               (long long)r.stats_ns.count, (long long)r.stats_ns.p50, (long long)r.stats_ns.p99,
+               (long long)r.stats_ns.max);
+    }
+}
+
+// window > 0时逐个出队用PopInterleaved, 和PopBatch的交织规则一样
+static void runDrain(const char *name, std::vector<AVPacket *> &audio, std::vector<AVPacket *> &video,
+                     int batch, int window, int rounds)
+{
+    const int half = 512;
+    SpscPacketQueue queue;
+    AVPacket *pkts[kBatchSize];
+    MediaType media_types[kBatchSize];
+    PacketQueueStats stats;
+    int64_t elapsed = 0;
+    int64_t total = 0;
+    for(int round = 0; round < rounds; round++) {
+        for(int i = 0; i < half; i++) {     // 两路时间戳相同, 交织时交替出队, 最后一个包也不用等另一路
+            audio[i]->pts = audio[i]->dts = round * 100000 + i * 40;
+            video[i]->pts = video[i]->dts = round * 100000 + i * 40;
+            queue.Push(audio[i], E_AUDIO_TYPE);
+            queue.Push(video[i], E_VIDEO_TYPE);
+        }
+        int64_t begin = nowNs();
+        int count = 0;
+        do {
+            queue.GetStats(&stats);
+            if(queue.GetQueuedDuration(E_AUDIO_TYPE) > 1000000 || queue.GetQueuedDuration(E_VIDEO_TYPE) > 1000000) {
+                break;          // 不会发生, 只是和Loop一样每次都检查
+            }
+            if(batch > 1) {
+                count = queue.PopBatch(pkts, media_types, batch, 0, window);
+            } else if(window > 0) {
+                count = queue.PopInterleaved(&pkts[0], media_types[0], 0, window);
+            } else {
+                count = queue.PopWithTimeout(&pkts[0], media_types[0], 0);
+            }
+            total += count > 0 ? count : 0;
+        } while(count > 0);
+        elapsed += nowNs() - begin;
+    }
+    printf("%-8s drain  batch:%2d window:%2d %6.1f ns/pkt (%lld pkts)\n", name, batch, window,
+           (double)elapsed / total, (long long)total);
+}
+
+int main(int argc, char *argv[])
+{
+    int count = argc > 1 ? atoi(argv[1]) : 200000;
+    int runs = argc > 2 ? atoi(argv[2]) : 5;
+    init_logger("log", (slog_level)(S_ERROR + 1));     // 环满时PacketQueue会打日志, 压测时不输出
+    // 队列只搬运指针, 负载大小不影响结果, 用小包省内存
+    std::vector<AVPacket *> audio = allocPackets(count, 64);
+    std::vector<AVPacket *> video = allocPackets(count, 64);
+    printf("flood: %d packets per producer, median of %d runs\n", count, runs);
+    runCase<SpscPacketQueue>("spsc", "flood", runs, audio, video, 0);
+    runCase<SpscBatchPacketQueue>("spsc-b", "flood", runs, audio, video, 0);
+    runCase<MutexPacketQueue>("mutex", "flood", runs, audio, video, 0);
+
+    printf("stats: flood with one thread calling GetStats in a loop, median of %d runs\n", runs);
+    runCase<SpscPacketQueue>("spsc", "stats", runs, audio, video, 0, true);
+    runCase<MutexPacketQueue>("mutex", "stats", runs, audio, video, 0, true);
+
+    // 每路每个包之后sleep 100us, 消费者大部分时间在等
+    int paced_count = std::min(count, 5000);
+    std::vector<AVPacket *> paced_audio(audio.begin(), audio.begin() + paced_count);
+    std::vector<AVPacket *> paced_video(video.begin(), video.begin() + paced_count);
+    printf("paced: %d packets per producer, sleep 100us between packets, median of %d runs\n", paced_count, runs);
+    runCase<SpscPacketQueue>("spsc", "paced", runs, paced_audio, paced_video, 100);
+    runCase<SpscBatchPacketQueue>("spsc-b", "paced", runs, paced_audio, paced_video, 100);
+    runCase<MutexPacketQueue>("mutex", "paced", runs, paced_audio, paced_video, 100);
+
+    printf("drain: %d packets per media in the queue, %d rounds\n", 512, 200);
+    runDrain("spsc", audio, video, 1, 0, 200);
+    runDrain("spsc-b", audio, video, kBatchSize, 0, 200);
+    runDrain("spsc", audio, video, 1, 50, 200);
+    runDrain("spsc-b", audio, video, kBatchSize, 50, 200);
+
+    for(int i = 0; i < count; i++) {
+        av_packet_free(&audio[i]);
+        av_packet_free(&video[i]);
+    }
+    return 0;
+}
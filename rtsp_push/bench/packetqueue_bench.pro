@@ -0,0 +1,24 @@
+TEMPLATE = app
+CONFIG += console c++11
+CONFIG -= app_bundle
+CONFIG -= qt
+
+# PacketQueue(无锁环形队列)和原来的锁+std::queue对比压测, 结果见README.md
+INCLUDEPATH += $$PWD/..
+
+SOURCES += packetqueue_bench.cpp \
+    ../dlog.cpp
+
+HEADERS += \
+    mutexpacketqueue.h \
+    ../packetqueue.h \
+    ../histogram.h
+
+#ffmpeg
+INCLUDEPATH += "/usr/local/include"
+
+LIBS += -pthread
+
+LIBS += -L"/usr/local/lib"  \
+-lavcodec \
+-lavutil
@@ -0,0 +1,184 @@
+﻿#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+#include "videoconvert.h"
+#include "simdlevel.h"
+extern "C" {
+#include <libavutil/mem.h>
+#include <libswscale/swscale.h>
+}
+
+// 同尺寸的YUYV422/UYVY422/NV12 -> I420, 对比sws_scale(SWS_BILINEAR, VideoCapturer原来的做法)和VideoConvertToI420的各个指令集实现
+// 每种情况先转一帧比较输出和sws的差别, 再单线程重复转换同一帧, 取每帧耗时的中位数
+// 用法: videoconvert_bench [frames]
+
+static int64_t nowNs()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// 每行按32字节对齐, 和av_frame_get_buffer一样
+typedef struct image
+{
+    uint8_t *data[3];
+    int linesize[3];
+}Image;
+
+static int align32(int value)
+{
+    return (value + 31) & ~31;
+}
+
+static void allocImage(Image *image, AVPixelFormat fmt, int width, int height)
+{
+    memset(image, 0, sizeof(Image));
+    int chroma_height = (height + 1) / 2;
+    if(fmt == AV_PIX_FMT_YUYV422 || fmt == AV_PIX_FMT_UYVY422) {
+        image->linesize[0] = align32(width * 2);
+        image->data[0] = (uint8_t *)av_malloc((size_t)image->linesize[0] * height);
+    } else if(fmt == AV_PIX_FMT_NV12) {
+        image->linesize[0] = align32(width);
+        image->linesize[1] = align32((width + 1) / 2 * 2);
+        image->data[0] = (uint8_t *)av_malloc((size_t)image->linesize[0] * height);
+        image->data[1] = (uint8_t *)av_malloc((size_t)image->linesize[1] * chroma_height);
+    } else {
+        image->linesize[0] = align32(width);
+        image->linesize[1] = image->linesize[2] = align32((width + 1) / 2);
+        image->data[0] = (uint8_t *)av_malloc((size_t)image->linesize[0] * height);
+        image->data[1] = (uint8_t *)av_malloc((size_t)image->linesize[1] * chroma_height);
+        image->data[2] = (uint8_t *)av_malloc((size_t)image->linesize[2] * chroma_height);
+    }
+}
+
+static void freeImage(Image *image)
+{
+    for(int i = 0; i < 3; i++) {
+        av_free(image->data[i]);
+    }
+}
+
+// 随机内容, 相邻行相关性低, 色度平均的舍入各种情况都会出现
+static void fillRandom(Image *image, int height)
+{
+    uint32_t seed = 12345;
+    for(int i = 0; i < 3; i++) {
+        if(!image->data[i]) {
+            continue;
+        }
+        int rows = i == 0 ? height : (height + 1) / 2;
+        for(int64_t j = 0; j < (int64_t)image->linesize[i] * rows; j++) {
+            seed = seed * 1103515245 + 12345;
+            image->data[i][j] = (uint8_t)(seed >> 16);
+        }
+    }
+}
+
+// 返回最大的逐像素差, diff_count返回不相同的像素数
+static int compareI420(const Image &a, const Image &b, int width, int height, int64_t *diff_count)
+{
+    int max_diff = 0;
+    *diff_count = 0;
+    for(int i = 0; i < 3; i++) {
+        int w = i == 0 ? width : (width + 1) / 2;
+        int h = i == 0 ? height : (height + 1) / 2;
+        for(int y = 0; y < h; y++) {
+            const uint8_t *pa = a.data[i] + (int64_t)y * a.linesize[i];
+            const uint8_t *pb = b.data[i] + (int64_t)y * b.linesize[i];
+            for(int x = 0; x < w; x++) {
+                int diff = abs(pa[x] - pb[x]);
+                if(diff) {
+                    (*diff_count)++;
+                    max_diff = std::max(max_diff, diff);
+                }
+            }
+        }
+    }
+    return max_diff;
+}
+
+static double medianUs(std::vector<int64_t> &ns)
+{
+    std::sort(ns.begin(), ns.end());
+    return ns[ns.size() / 2] / 1000.0;
+}
+
+static const char *fmtName(AVPixelFormat fmt)
+{
+    switch(fmt) {
+    case AV_PIX_FMT_YUYV422:
+        return "yuyv422";
+    case AV_PIX_FMT_UYVY422:
+        return "uyvy422";
+    default:
+        return "nv12";
+    }
+}
+
+static void runCase(AVPixelFormat fmt, int width, int height, int frames)
+{
+    Image src, ref, dst;
+    allocImage(&src, fmt, width, height);
+    allocImage(&ref, AV_PIX_FMT_YUV420P, width, height);
+    allocImage(&dst, AV_PIX_FMT_YUV420P, width, height);
+    fillRandom(&src, height);
+
+    SwsContext *sws_ctx = sws_getContext(width, height, fmt, width, height, AV_PIX_FMT_YUV420P,
+                                         SWS_BILINEAR, NULL, NULL, NULL);
+    if(!sws_ctx) {
+        printf("sws_getContext failed\n");
+        exit(1);
+    }
+    std::vector<int64_t> ns(frames);
+    for(int i = 0; i < frames; i++) {
+        int64_t begin = nowNs();
+        sws_scale(sws_ctx, src.data, src.linesize, 0, height, ref.data, ref.linesize);
+        ns[i] = nowNs() - begin;
+    }
+    double sws_us = medianUs(ns);
+    printf("%-8s %4dx%-4d sws    %8.1f us/frame\n", fmtName(fmt), width, height, sws_us);
+
+    const SimdLevel levels[] = {SIMD_NONE, SIMD_SSE2, SIMD_AVX2};
+    for(size_t l = 0; l < sizeof(levels) / sizeof(levels[0]); l++) {
+        if(levels[l] > CpuSimdLevel()) {
+            continue;
+        }
+        VideoConvertSetSimdLevel(levels[l]);
+        memset(dst.data[0], 0, (size_t)dst.linesize[0] * height);
+        VideoConvertToI420(src.data, src.linesize, fmt, width, height, dst.data, dst.linesize, 0, height);
+        int64_t diff_count;
+        int max_diff = compareI420(dst, ref, width, height, &diff_count);
+        for(int i = 0; i < frames; i++) {
+            int64_t begin = nowNs();
+            VideoConvertToI420(src.data, src.linesize, fmt, width, height, dst.data, dst.linesize, 0, height);
+            ns[i] = nowNs() - begin;
+        }
+        double us = medianUs(ns);
+        printf("%-8s %4dx%-4d %-6s %8.1f us/frame  x%.1f vs sws | diff vs sws: max %d, %lld pixels\n",
+               fmtName(fmt), width, height, SimdLevelName(levels[l]), us, sws_us / us, max_diff,
+               (long long)diff_count);
+    }
+    VideoConvertSetSimdLevel(CpuSimdLevel());
+    sws_freeContext(sws_ctx);
+    freeImage(&src);
+    freeImage(&ref);
+    freeImage(&dst);
+}
+
+int main(int argc, char *argv[])
+{
+    int frames = argc > 1 ? atoi(argv[1]) : 200;
+    printf("cpu simd: %s, median of %d frames\n", SimdLevelName(CpuSimdLevel()), frames);
+    const AVPixelFormat fmts[] = {AV_PIX_FMT_YUYV422, AV_PIX_FMT_UYVY422, AV_PIX_FMT_NV12};
+    const int sizes[][2] = {{640, 480}, {1280, 720}, {1920, 1080}};
+    for(size_t f = 0; f < sizeof(fmts) / sizeof(fmts[0]); f++) {
+        for(size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+            runCase(fmts[f], sizes[s][0], sizes[s][1], frames);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,25 @@
+TEMPLATE = app
+CONFIG += console c++11
+CONFIG -= app_bundle
+CONFIG -= qt
+
+# 同尺寸YUYV422/UYVY422/NV12 -> I420, sws_scale和VideoConvertToI420对比压测, 结果见README.md
+INCLUDEPATH += $$PWD/..
+
+SOURCES += videoconvert_bench.cpp \
+    ../videoconvert.cpp \
+    ../executor.cpp \
+    ../dlog.cpp
+
+HEADERS += \
+    ../videoconvert.h \
+    ../simdlevel.h
+
+#ffmpeg
+INCLUDEPATH += "/usr/local/include"
+
+LIBS += -pthread
+
+LIBS += -L"/usr/local/lib"  \
+-lswscale \
+-lavutil
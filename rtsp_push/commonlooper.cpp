@@ -1,8 +1,22 @@
 ﻿#include "commonlooper.h"
 #include "dlog.h"
+#include "executor.h"
+#include <stdlib.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#endif
 void *CommonLooper::trampoline(void *p)
 {
     LogInfo("into");
+    ((CommonLooper*)p)->applyThreadProperties();
     ((CommonLooper*)p)->SetRunning(true);
     ((CommonLooper*)p)->Loop();
      ((CommonLooper*)p)->SetRunning(false);
@@ -33,8 +47,41 @@ RET_CODE CommonLooper::Start()
     return RET_OK;
 }
 
+RET_CODE CommonLooper::Start(Executor *executor)
+{
+    if(!executor || !Cooperative()) {
+        return Start();
+    }
+    LogInfo("%s: run on executor", thread_name_.c_str());
+    executor_ = executor;
+    SetRunning(true);
+    {
+        std::lock_guard<std::mutex> lock(step_mutex_);
+        step_abort_ = false;
+        step_active_ = true;
+    }
+    if(!executor_->Post(std::bind(&CommonLooper::runStep, this))) {
+        LogError("%s: executor shutdown", thread_name_.c_str());
+        std::lock_guard<std::mutex> lock(step_mutex_);
+        step_active_ = false;
+        SetRunning(false);
+        return RET_FAIL;
+    }
+    return RET_OK;
+}
+
 void CommonLooper::Stop()
 {
+    if(executor_) {
+        // 等排队中的Step被调度到, 最多等一个周期
+        std::unique_lock<std::mutex> lock(step_mutex_);
+        step_abort_ = true;
+        while(step_active_) {
+            step_cond_.wait(lock);
+        }
+        executor_ = NULL;
+        return;
+    }
     request_abort_ = true;
     if(worker_) {
         worker_->join();
@@ -53,5 +100,99 @@ void CommonLooper::SetRunning(bool running)
     running_ = running;
 }
 
+bool CommonLooper::stepAborted()
+{
+    std::lock_guard<std::mutex> lock(step_mutex_);
+    return step_abort_;
+}
+
+void CommonLooper::runStep()
+{
+    if(!stepAborted()) {
+        int64_t next = Step();
+        if(next >= 0 && !stepAborted()) {
+            bool posted;
+            if(next == 0) {
+                posted = executor_->Post(std::bind(&CommonLooper::runStep, this));
+            } else {
+                posted = executor_->PostAt(next, std::bind(&CommonLooper::runStep, this));
+            }
+            if(posted) {
+                return;
+            }
+            LogWarn("%s: executor shutdown", thread_name_.c_str());
+        }
+    }
+    SetRunning(false);
+    std::lock_guard<std::mutex> lock(step_mutex_);
+    step_active_ = false;
+    step_cond_.notify_all();
+}
+
+void CommonLooper::SetThreadProperties(const Properties &properties)
+{
+    thread_name_ = properties.GetProperty("name", thread_name_);
+    std::string affinity = properties.GetProperty("cpu_affinity", "0");
+    cpu_affinity_ = strtoull(affinity.c_str(), NULL, 0);    // 支持0x前缀的十六进制
+    sched_policy_ = properties.GetProperty("sched_policy", "other");
+    priority_ = properties.GetProperty("priority", 0);
+    has_nice_ = properties.HasProperty("nice");
+    nice_ = properties.GetProperty("nice", 0);
+}
+
+void CommonLooper::applyThreadProperties()
+{
+    bool realtime = sched_policy_ == "fifo" || sched_policy_ == "rr";
+#ifdef _WIN32
+    if(cpu_affinity_ && !SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)cpu_affinity_)) {
+        LogWarn("%s: SetThreadAffinityMask 0x%llx failed", thread_name_.c_str(), cpu_affinity_);
+    }
+    if(realtime && !SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_TIME_CRITICAL)) {
+        LogWarn("%s: SetThreadPriority failed", thread_name_.c_str());
+    }
+#elif defined(__linux__)
+    if(!thread_name_.empty()) {
+        pthread_setname_np(pthread_self(), thread_name_.substr(0, 15).c_str());    // 超过15个字符会失败
+    }
+    if(cpu_affinity_) {
+        cpu_set_t cpu_set;
+        CPU_ZERO(&cpu_set);
+        for(int i = 0; i < 64; i++) {
+            if(cpu_affinity_ & ((uint64_t)1 << i)) {
+                CPU_SET(i, &cpu_set);
+            }
+        }
+        int ret = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpu_set);
+        if(ret != 0) {
+            LogWarn("%s: set cpu affinity 0x%llx failed:%s", thread_name_.c_str(),
+                    (unsigned long long)cpu_affinity_, strerror(ret));
+        }
+    }
+    if(realtime) {
+        int policy = sched_policy_ == "fifo" ? SCHED_FIFO : SCHED_RR;
+        struct sched_param param;
+        memset(&param, 0, sizeof(param));
+        param.sched_priority = priority_;
+        if(param.sched_priority < sched_get_priority_min(policy)) {
+            param.sched_priority = sched_get_priority_min(policy);
+        } else if(param.sched_priority > sched_get_priority_max(policy)) {
+            param.sched_priority = sched_get_priority_max(policy);
+        }
+        int ret = pthread_setschedparam(pthread_self(), policy, &param);
+        if(ret != 0) {      // 一般是没有CAP_SYS_NICE或者RLIMIT_RTPRIO, 退回用nice
+            LogWarn("%s: set %s priority %d failed:%s", thread_name_.c_str(), sched_policy_.c_str(),
+                    param.sched_priority, strerror(ret));
+            realtime = false;
+        }
+    }
+    // linux下nice值是线程级别的, 用线程id设置只影响当前线程
+    if(!realtime && has_nice_ && setpriority(PRIO_PROCESS, (id_t)syscall(SYS_gettid), nice_) != 0) {
+        LogWarn("%s: set nice %d failed:%s", thread_name_.c_str(), nice_, strerror(errno));
+    }
+#endif
+    LogInfo("%s: cpu_affinity:0x%llx, sched_policy:%s, priority:%d, nice:%d", thread_name_.c_str(),
+            (unsigned long long)cpu_affinity_, realtime ? sched_policy_.c_str() : "other", priority_, nice_);
+}
+
 
 
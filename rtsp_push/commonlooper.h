@@ -2,8 +2,14 @@
 #define COMMONLOOPER_H
 
 #include <thread>
+#include <string>
+#include <mutex>
+#include <condition_variable>
+#include <stdint.h>
 #include "mediabase.h"
 
+class Executor;
+
 class CommonLooper
 {
 public:
@@ -14,10 +20,47 @@ public:
     virtual bool Running();
     virtual void SetRunning(bool running);
     virtual void Loop() = 0;
+    /**
+     * @brief Start 协作模式, 不开独立线程, 在共享的Executor上反复调用Step
+     *        executor为NULL或者子类不支持协作模式(Cooperative()返回false)时退回Start()
+     *        协作模式下SetThreadProperties不生效, 线程属性由Executor的线程决定
+     */
+    RET_CODE Start(Executor *executor);
+    // 子类的Step不会阻塞时返回true, 会阻塞在IO上的组件(网络、摄像头)还是用独立线程
+    virtual bool Cooperative() {
+        return false;
+    }
+    // 执行一次工作, 返回下一次调用的时间点(TimesUtil::GetTimeMicrosecond), 0表示马上调用, <0表示结束
+    virtual int64_t Step() {
+        return -1;
+    }
+    /**
+     * @brief SetThreadProperties 线程启动时生效, 需要在Start之前调用
+     * @param "name", 线程名, top -H和perf里显示, 最长15个字符, 缺省由子类指定
+     *        "cpu_affinity", CPU亲和性掩码, 例如"0xc"表示只在CPU2、3上运行, 缺省不绑定
+     *        "sched_policy", 调度策略"fifo"/"rr"/"other", 缺省"other"
+     *        "priority", fifo/rr的实时优先级, 1~99
+     *        "nice", nice值-20~19, other策略或者没有权限设置实时调度时使用
+     */
+    void SetThreadProperties(const Properties &properties);
 private:
     static void *trampoline(void *p);
+    void applyThreadProperties();   // 在新线程里调用
+    void runStep();                 // 协作模式下在Executor线程里执行
+    bool stepAborted();
+    uint64_t cpu_affinity_ = 0;
+    std::string sched_policy_ = "other";
+    int priority_ = 0;
+    bool has_nice_ = false;
+    int nice_ = 0;
 protected:
+    std::string thread_name_;           // 线程名
     std::thread *worker_ = NULL;   // 线程
+    Executor *executor_ = NULL;     // 协作模式下运行的线程池
+    std::mutex step_mutex_;
+    std::condition_variable step_cond_;
+    bool step_abort_ = false;       // 协作模式下请求退出, 和request_abort_分开, 由step_mutex_保护
+    bool step_active_ = false;      // 协作模式下还有Step在排队或者执行
     bool request_abort_ = false;         // 请求退出线程的标志
     bool running_ = true;               // 线程是否在运行
 };
@@ -0,0 +1,95 @@
+﻿#ifndef DEADLINETIMER_H
+#define DEADLINETIMER_H
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <stdint.h>
+#ifndef _WIN32
+#include <time.h>
+#include <errno.h>
+#endif
+#include "timesutil.h"
+#include "histogram.h"
+
+typedef struct deadline_timer_stats
+{
+    int64_t ticks;          // 到期的周期数
+    int64_t wakeups;        // 真正睡眠后被唤醒的次数, 其余周期是落后时直接返回的
+    HistogramStats lateness;    // 醒来时比deadline晚了多少us
+}DeadlineTimerStats;
+
+// 按绝对时间点周期唤醒的定时器, 给CommonLooper子类的Loop用
+// 第n个deadline = 起始时间 + n*周期, 不会因为每次处理的耗时累积误差
+// linux下用clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME), 和TimesUtil::GetTimeMicrosecond同一个时钟
+// 同一时刻只能有一个线程调用WaitNext/NextDeadline/Reached, GetStats可以在任意线程调用
+class DeadlineTimer
+{
+public:
+    // period_us: 周期, 可以是小数(比如1024个采样点@48kHz是21333.33us); 第一个deadline就是当前时间
+    void Start(double period_us)
+    {
+        period_us_ = period_us;
+        start_us_ = TimesUtil::GetTimeMicrosecond();
+        ticks_ = 0;
+    }
+    // 睡到下一个deadline; 已经过了就直接返回, 落后时连续返回直到追上进度
+    // 返回值: 醒来时比deadline晚了多少us
+    int64_t WaitNext()
+    {
+        int64_t deadline = NextDeadline();
+        if(TimesUtil::GetTimeMicrosecond() < deadline) {
+            sleepUntil(deadline);
+            stat_wakeups_.fetch_add(1, std::memory_order_relaxed);
+        }
+        return Reached(deadline);
+    }
+    // 协作模式下不睡眠: 取下一个deadline交给Executor::PostAt, 被调度执行时再调用Reached
+    int64_t NextDeadline()
+    {
+        int64_t deadline = start_us_ + (int64_t)(ticks_ * period_us_ + 0.5);
+        ticks_++;
+        stat_ticks_.fetch_add(1, std::memory_order_relaxed);
+        return deadline;
+    }
+    // 记录到达deadline时的延迟, 返回值同WaitNext
+    int64_t Reached(int64_t deadline)
+    {
+        int64_t lateness = TimesUtil::GetTimeMicrosecond() - deadline;
+        lateness_.Record(lateness);
+        return lateness;
+    }
+    // reset为true时读取后清零
+    void GetStats(DeadlineTimerStats *stats, bool reset = false)
+    {
+        if(reset) {
+            stats->ticks = stat_ticks_.exchange(0, std::memory_order_relaxed);
+            stats->wakeups = stat_wakeups_.exchange(0, std::memory_order_relaxed);
+        } else {
+            stats->ticks = stat_ticks_.load(std::memory_order_relaxed);
+            stats->wakeups = stat_wakeups_.load(std::memory_order_relaxed);
+        }
+        lateness_.GetStats(&stats->lateness, reset);
+    }
+private:
+    static void sleepUntil(int64_t deadline_us)
+    {
+#ifdef _WIN32
+        std::this_thread::sleep_until(std::chrono::steady_clock::time_point(std::chrono::microseconds(deadline_us)));
+#else
+        struct timespec ts;
+        ts.tv_sec = deadline_us / 1000000;
+        ts.tv_nsec = (deadline_us % 1000000) * 1000;
+        while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {
+        }
+#endif
+    }
+
+    double period_us_ = 0;
+    int64_t start_us_ = 0;
+    int64_t ticks_ = 0;
+    std::atomic<int64_t> stat_ticks_{0};
+    std::atomic<int64_t> stat_wakeups_{0};
+    LatencyHistogram lateness_;
+};
+
+#endif // DEADLINETIMER_H
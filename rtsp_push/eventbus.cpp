@@ -0,0 +1,85 @@
+﻿#include "eventbus.h"
+#include "dlog.h"
+
+EventBus::EventBus(): CommonLooper()
+{
+    thread_name_ = "event_bus";
+
+}
+
+EventBus::~EventBus()
+{
+    Stop();     // 基类析构里调用的是CommonLooper::Stop, 不会唤醒分发线程
+}
+
+void EventBus::Stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+        cond_.notify_all();
+    }
+    CommonLooper::Stop();
+}
+
+void EventBus::Loop()
+{
+    LogInfo("into loop");
+    while(true) {
+        std::function<void(int)> task;
+        int count = 0;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            cond_.wait(lock, [this] {
+                return !order_.empty() || stop_;
+            });
+            if(order_.empty()) {
+                break;      // 退出前把已经发布的事件分发完
+            }
+            Pending &pending = pending_[order_.front()];
+            order_.pop_front();
+            task.swap(pending.task);
+            count = pending.count;
+            pending.count = 0;      // 分发期间再发布的同类型事件重新排队
+        }
+        task(count);
+    }
+    LogInfo("leave loop");
+}
+
+void EventBus::Unsubscribe(int id)
+{
+    std::lock_guard<std::mutex> lock(handler_mutex_);
+    std::map<int, std::vector<Handler>>::iterator it;
+    for(it = handlers_.begin(); it != handlers_.end(); it++) {
+        std::vector<Handler> &handlers = it->second;
+        for(size_t i = 0; i < handlers.size(); i++) {
+            if(handlers[i].id == id) {
+                handlers.erase(handlers.begin() + i);
+                return;
+            }
+        }
+    }
+}
+
+void EventBus::SetMessageQueue(MessageQueue *msg_queue)
+{
+    msg_queue_ = msg_queue;
+}
+
+void EventBus::dispatch(int type, const void *event, int count)
+{
+    std::vector<Handler> handlers;
+    {
+        // 拷贝一份再调用, 处理函数里可以Subscribe/Unsubscribe
+        std::lock_guard<std::mutex> lock(handler_mutex_);
+        std::map<int, std::vector<Handler>>::iterator it = handlers_.find(type);
+        if(it == handlers_.end()) {
+            return;
+        }
+        handlers = it->second;
+    }
+    for(size_t i = 0; i < handlers.size(); i++) {
+        handlers[i].func(event, count);
+    }
+}
@@ -0,0 +1,114 @@
+﻿#ifndef EVENTBUS_H
+#define EVENTBUS_H
+
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <vector>
+#include <atomic>
+#include <functional>
+#include "commonlooper.h"
+
+class MessageQueue;
+
+// 事件总线: 各模块Publish强类型的事件, 订阅者的处理函数在总线自己的分发线程里依次调用
+// Publish只是入队并唤醒分发线程, 不会阻塞发布者
+// 按事件类型合并: 同一类型还没分发时再次发布, 只保留最新的事件并累加次数, 发布得再频繁也只占一个位置;
+// 不同类型按各自第一次待分发的先后顺序分发
+// 设置了MessageQueue时, 每次分发还会通过PostEventMessage(见events.h)转成AVMessage放进去, 兼容原来轮询的代码
+class EventBus: public CommonLooper
+{
+public:
+    EventBus();
+    virtual ~EventBus();
+    virtual void Stop();
+    virtual void Loop();
+
+    // 注册事件E的处理函数, 返回值用于Unsubscribe
+    template <typename E>
+    int Subscribe(std::function<void(const E &)> handler)
+    {
+        return SubscribeWithCount<E>([handler](const E &event, int count) {
+            (void)count;
+            handler(event);
+        });
+    }
+    // 同Subscribe, count为这次分发合并了多少次Publish(至少为1), event是其中最新的一个
+    template <typename E>
+    int SubscribeWithCount(std::function<void(const E &, int)> handler)
+    {
+        Handler h;
+        h.id = ++handler_id_;
+        h.func = [handler](const void *event, int count) {
+            handler(*(const E *)event, count);
+        };
+        std::lock_guard<std::mutex> lock(handler_mutex_);
+        handlers_[eventType<E>()].push_back(h);
+        return h.id;
+    }
+    void Unsubscribe(int id);
+
+    // 任意线程调用, event被拷贝一份到分发线程; 同类型的事件还没分发时替换掉它
+    template <typename E>
+    void Publish(const E &event)
+    {
+        int type = eventType<E>();
+        std::function<void(int)> task = [this, type, event](int count) {
+            dispatch(type, &event, count);
+            MessageQueue *msg_queue = msg_queue_;
+            if(msg_queue) {
+                PostEventMessage(msg_queue, event);
+            }
+        };
+        std::function<void(int)> replaced;      // 被替换的旧事件在锁外析构
+        std::lock_guard<std::mutex> lock(mutex_);
+        Pending &pending = pending_[type];
+        if(0 == pending.count) {
+            order_.push_back(type);
+            cond_.notify_one();
+        }
+        replaced.swap(pending.task);
+        pending.task.swap(task);
+        pending.count++;
+    }
+    void SetMessageQueue(MessageQueue *msg_queue);
+private:
+    typedef struct handler
+    {
+        int id;
+        std::function<void(const void *, int)> func;
+    }Handler;
+    // 某个类型待分发的事件
+    typedef struct pending
+    {
+        std::function<void(int)> task;  // 最新的一个事件, 参数为合并的次数
+        int count = 0;                  // 合并的Publish次数, 0表示没有待分发的事件
+    }Pending;
+    // 每个事件类型分配一个编号
+    template <typename E>
+    static int eventType()
+    {
+        static const int type = nextEventType();
+        return type;
+    }
+    static int nextEventType()
+    {
+        static std::atomic<int> next_type{0};
+        return next_type++;
+    }
+    void dispatch(int type, const void *event, int count);
+
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    std::map<int, Pending> pending_;    // 每个类型最多一个待分发的事件
+    std::deque<int> order_;             // 有待分发事件的类型, 按先后顺序
+    bool stop_ = false;     // 受mutex_保护, 不用基类的request_abort_
+
+    std::mutex handler_mutex_;
+    std::map<int, std::vector<Handler>> handlers_;
+    std::atomic<int> handler_id_{0};
+    std::atomic<MessageQueue *> msg_queue_{NULL};
+};
+
+#endif // EVENTBUS_H
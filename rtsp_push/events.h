@@ -0,0 +1,74 @@
+﻿#ifndef EVENTS_H
+#define EVENTS_H
+
+#include "mediabase.h"
+#include "packetqueue.h"
+#include "messagequeue.h"
+
+// EventBus上传递的事件, 以及转换成原来的AVMessage的方式
+
+// RtspPusher发送失败
+typedef struct rtsp_error_event
+{
+    int error;          // av_write_frame的返回值
+}RtspErrorEvent;
+
+// RtspPusher队列积压超过max_queue_duration, 并且按优先级丢了包(drop.reasons不为E_DROP_NONE)
+typedef struct queue_duration_event
+{
+    int64_t audio_duration;     // 丢包前的积压时长ms, 按 包数*帧时长 估算
+    int64_t video_duration;
+    PacketDropResult drop;
+}QueueDurationEvent;
+
+// RtspPusher队列背压状态变化
+typedef struct backpressure_event
+{
+    MediaType media_type;       // 状态变化的流
+    bool audio_backpressure;    // 变化后各个流的状态
+    bool video_backpressure;
+}BackpressureEvent;
+
+// 采集出错, 只在从正常变成出错时发布一次
+typedef struct capture_error_event
+{
+    MediaType media_type;
+    int error;
+}CaptureErrorEvent;
+
+// 编码器返回RET_FAIL, 编码器已经不可用
+typedef struct encode_error_event
+{
+    MediaType media_type;
+    int error;          // RET_CODE
+}EncodeErrorEvent;
+
+inline void PostEventMessage(MessageQueue *msg_queue, const RtspErrorEvent &event)
+{
+    msg_queue->notify_msg2(MSG_RTSP_ERROR, event.error);
+}
+
+inline void PostEventMessage(MessageQueue *msg_queue, const QueueDurationEvent &event)
+{
+    msg_queue->notify_msg4(MSG_RTSP_QUEUE_DURATION, (int)event.audio_duration, (int)event.video_duration,
+                           (void *)&event.drop, sizeof(PacketDropResult));
+}
+
+inline void PostEventMessage(MessageQueue *msg_queue, const BackpressureEvent &event)
+{
+    int state = (event.audio_backpressure ? 1 << E_AUDIO_TYPE : 0)
+            | (event.video_backpressure ? 1 << E_VIDEO_TYPE : 0);
+    msg_queue->notify_msg3(MSG_RTSP_BACKPRESSURE, event.media_type, state);
+}
+
+inline void PostEventMessage(MessageQueue *msg_queue, const CaptureErrorEvent &event)
+{
+    msg_queue->notify_msg3(MSG_CAPTURE_ERROR, event.media_type, event.error);
+}
+
+inline void PostEventMessage(MessageQueue *msg_queue, const EncodeErrorEvent &event)
+{
+    msg_queue->notify_msg3(MSG_ENCODE_ERROR, event.media_type, event.error);
+}
+
+#endif // EVENTS_H
@@ -0,0 +1,201 @@
+﻿#include "executor.h"
+#include "dlog.h"
+#include "timesutil.h"
+
+// 当前线程是哪个Executor的第几个工作线程, 不是工作线程时为NULL
+static thread_local Executor *s_current_executor = NULL;
+static thread_local int s_current_index = -1;
+
+Executor::Executor(int threads)
+{
+    if(threads <= 0) {
+        threads = (int)std::thread::hardware_concurrency();
+        if(threads <= 0) {
+            threads = 2;
+        }
+    }
+    for(int i = 0; i < threads; i++) {
+        Worker *worker = new Worker();
+        worker->thread = NULL;
+        workers_.push_back(worker);
+    }
+    // 队列都建好之后再启动线程, 线程启动后会去偷其他队列
+    for(int i = 0; i < threads; i++) {
+        workers_[i]->thread = new std::thread(&Executor::workerLoop, this, i);
+    }
+    LogInfo("executor threads:%d", threads);
+}
+
+Executor::~Executor()
+{
+    Shutdown();
+    for(size_t i = 0; i < workers_.size(); i++) {
+        delete workers_[i];
+    }
+    workers_.clear();
+}
+
+bool Executor::Post(const std::function<void()> &task)
+{
+    int index;
+    if(s_current_executor == this) {
+        index = s_current_index;        // 工作线程里Post的任务放在自己的队列
+    } else {
+        index = (int)(next_worker_.fetch_add(1, std::memory_order_relaxed) % workers_.size());
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    if(stop_) {
+        return false;
+    }
+    push(index, task);
+    wakeupOne();
+    return true;
+}
+
+bool Executor::PostAt(int64_t deadline_us, const std::function<void()> &task)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if(stop_) {
+        return false;
+    }
+    bool earliest = timers_.empty() || deadline_us < timers_.top().deadline;
+    TimerTask timer;
+    timer.deadline = deadline_us;
+    timer.seq = timer_seq_++;
+    timer.task = task;
+    timers_.push(timer);
+    if(timer_waiting_) {
+        if(earliest) {
+            timer_cond_.notify_one();   // 等待的deadline变早了
+        }
+    } else if(idle_ > 0 && (s_current_executor != this
+                            || deadline_us - TimesUtil::GetTimeMicrosecond() < kTimerHandoverUs)) {
+        // 让一个空闲线程来负责等待; 工作线程里PostAt且deadline不近时, 本线程执行完任务回来自己等
+        cond_.notify_one();
+    }
+    return true;
+}
+
+void Executor::Shutdown()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if(stop_) {
+            return;
+        }
+        stop_ = true;
+        cond_.notify_all();
+        timer_cond_.notify_all();
+    }
+    for(size_t i = 0; i < workers_.size(); i++) {
+        if(workers_[i]->thread) {
+            workers_[i]->thread->join();
+            delete workers_[i]->thread;
+            workers_[i]->thread = NULL;
+        }
+    }
+}
+
+void Executor::GetStats(ExecutorStats *stats)
+{
+    stats->threads = (int)workers_.size();
+    stats->executed = executed_.load(std::memory_order_relaxed);
+    stats->stolen = stolen_.load(std::memory_order_relaxed);
+    stats->timers = timer_count_.load(std::memory_order_relaxed);
+}
+
+void Executor::push(int index, const std::function<void()> &task)
+{
+    Worker *worker = workers_[index];
+    std::lock_guard<std::mutex> lock(worker->mutex);
+    worker->tasks.push_back(task);
+    pending_.fetch_add(1);
+}
+
+bool Executor::popTask(int index, std::function<void()> *task)
+{
+    if(pending_.load() <= 0) {
+        return false;
+    }
+    {
+        Worker *worker = workers_[index];
+        std::lock_guard<std::mutex> lock(worker->mutex);
+        if(!worker->tasks.empty()) {
+            *task = worker->tasks.back();
+            worker->tasks.pop_back();
+            pending_.fetch_sub(1);
+            return true;
+        }
+    }
+    for(size_t i = 1; i < workers_.size(); i++) {
+        Worker *victim = workers_[(index + i) % workers_.size()];
+        std::lock_guard<std::mutex> lock(victim->mutex);
+        if(!victim->tasks.empty()) {
+            *task = victim->tasks.front();
+            victim->tasks.pop_front();
+            pending_.fetch_sub(1);
+            stolen_.fetch_add(1, std::memory_order_relaxed);
+            return true;
+        }
+    }
+    return false;
+}
+
+void Executor::wakeupOne()
+{
+    if(idle_ > 0) {
+        cond_.notify_one();
+    } else if(timer_waiting_) {
+        timer_cond_.notify_one();   // 只剩等定时任务的线程空闲
+    }
+}
+
+void Executor::workerLoop(int index)
+{
+    s_current_executor = this;
+    s_current_index = index;
+    std::function<void()> task;
+    while(true) {
+        if(popTask(index, &task)) {
+            task();
+            task = nullptr;         // 尽早释放task捕获的资源
+            executed_.fetch_add(1, std::memory_order_relaxed);
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(mutex_);
+        // 到期的定时任务放到自己的队列
+        int64_t now = TimesUtil::GetTimeMicrosecond();
+        while(!timers_.empty() && timers_.top().deadline <= now) {
+            push(index, timers_.top().task);
+            timers_.pop();
+            timer_count_.fetch_add(1, std::memory_order_relaxed);
+        }
+        if(pending_.load() > 0) {
+            if(pending_.load() > 1) {
+                wakeupOne();        // 一次到期了多个, 叫别的线程一起处理
+            }
+            continue;
+        }
+        if(stop_ && timers_.empty()) {
+            cond_.notify_all();     // 最后的定时任务可能是本线程执行的, 其他空闲线程还在等
+            break;
+        }
+        if(!timer_waiting_ && !timers_.empty()) {
+            // 负责等待最早的deadline
+            timer_waiting_ = true;
+            int64_t wait_us = timers_.top().deadline - now;
+            timer_cond_.wait_for(lock, std::chrono::microseconds(wait_us));
+            timer_waiting_ = false;
+            // 本线程可能要去执行任务, 下一个deadline很近时交给别的空闲线程继续等;
+            // 比较远时任务一般已经执行完了, 本线程回来继续等, 省掉一次线程切换
+            if(!timers_.empty() && idle_ > 0
+                    && timers_.top().deadline - TimesUtil::GetTimeMicrosecond() < kTimerHandoverUs) {
+                cond_.notify_one();
+            }
+        } else {
+            idle_++;
+            cond_.wait(lock);
+            idle_--;
+        }
+    }
+}
@@ -0,0 +1,85 @@
+﻿#ifndef EXECUTOR_H
+#define EXECUTOR_H
+
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <vector>
+#include <queue>
+#include <thread>
+#include <atomic>
+#include <functional>
+#include <stdint.h>
+
+typedef struct executor_stats
+{
+    int threads;
+    int64_t executed;       // 执行过的任务数
+    int64_t stolen;         // 从其他线程队列偷来执行的任务数
+    int64_t timers;         // 到期转成任务的定时任务数
+}ExecutorStats;
+
+// 固定线程数的work-stealing线程池, 多路推流共用, 避免每个组件一个线程
+// 每个工作线程有自己的任务队列: 工作线程里Post的任务放到自己队列的尾部, 从尾部取(LIFO, cache友好);
+// 自己的队列空了就从其他线程队列的头部偷; 外部线程Post的任务轮流放到各个队列
+// PostAt的定时任务放在一个最小堆里, 由一个空闲线程负责等待最早的deadline, 其余空闲线程不会被定时任务唤醒
+// 任务不能长时间阻塞(比如网络IO), 这类组件还是用CommonLooper的独立线程
+class Executor
+{
+public:
+    explicit Executor(int threads = 0);     // 0: 使用CPU核数
+    ~Executor();
+    // 尽快执行task, Shutdown之后返回false, task不会被执行
+    bool Post(const std::function<void()> &task);
+    // 到deadline_us(TimesUtil::GetTimeMicrosecond的时间)之后执行task, Shutdown之后返回false
+    bool PostAt(int64_t deadline_us, const std::function<void()> &task);
+    // 不再接受新任务, 等已经提交的任务(包括没到期的定时任务)执行完后退出工作线程
+    void Shutdown();
+    int GetThreads() const {
+        return (int)workers_.size();
+    }
+    void GetStats(ExecutorStats *stats);
+private:
+    typedef struct worker
+    {
+        std::mutex mutex;
+        std::deque<std::function<void()>> tasks;
+        std::thread *thread;
+    }Worker;
+    typedef struct timer_task
+    {
+        int64_t deadline;
+        uint64_t seq;       // 相同deadline按PostAt的顺序执行
+        std::function<void()> task;
+        bool operator<(const timer_task &other) const {     // priority_queue是大顶堆, 反过来比较
+            return deadline != other.deadline ? deadline > other.deadline : seq > other.seq;
+        }
+    }TimerTask;
+
+    static const int64_t kTimerHandoverUs = 1000;
+
+    void workerLoop(int index);
+    void push(int index, const std::function<void()> &task);
+    bool popTask(int index, std::function<void()> *task);
+    void wakeupOne();       // 调用时需要持有mutex_
+
+    std::vector<Worker *> workers_;
+    std::atomic<unsigned> next_worker_{0};
+    std::atomic<int> pending_{0};       // 所有队列里的任务数
+
+    // 空闲线程等待
+    std::mutex mutex_;
+    std::condition_variable cond_;          // 普通空闲线程在这里等
+    std::condition_variable timer_cond_;    // 负责定时任务的线程在这里等
+    int idle_ = 0;                  // 在cond_上等待的线程数
+    bool timer_waiting_ = false;    // 已经有线程在等最早的deadline
+    std::priority_queue<TimerTask> timers_;
+    uint64_t timer_seq_ = 0;
+    bool stop_ = false;
+
+    std::atomic<int64_t> executed_{0};
+    std::atomic<int64_t> stolen_{0};
+    std::atomic<int64_t> timer_count_{0};
+};
+
+#endif // EXECUTOR_H
@@ -0,0 +1,140 @@
+﻿#ifndef FRAMEPOOL_H
+#define FRAMEPOOL_H
+#include <atomic>
+#include <memory>
+#include <stdint.h>
+extern "C" {
+#include <libavutil/buffer.h>
+#include <libavutil/frame.h>
+#include <libavutil/imgutils.h>
+}
+
+typedef struct frame_pool_stats
+{
+    int64_t allocated;      // 池子分配过的图像缓冲区数量(池子的大小)
+    int64_t in_flight;      // 已经交出去还没有归还的帧数
+    int64_t gets;           // Get成功的次数
+    int64_t exhausted;      // 在途的帧达到上限, Get返回NULL的次数
+}FramePoolStats;
+
+// 固定格式、尺寸的AVFrame池, 图像缓冲区来自AVBufferPool, 带引用计数
+// 采集从池子取帧, 填好后交给下游; 下游要异步处理时用av_frame_clone/av_frame_ref增加引用(不拷贝图像数据),
+// 所有引用释放后缓冲区自动回到池子, 采集可以马上取下一帧, 不会覆盖还在编码的帧
+// 可以在任意线程释放帧, GetStats可以在任意线程调用
+class FramePool
+{
+public:
+    // max_frames: 在途帧数的上限, 下游处理不过来时Get返回NULL, 0为不限制
+    FramePool(int width, int height, int format, int max_frames = 0)
+        : width_(width), height_(height), format_(format), max_frames_(max_frames)
+    {
+        state_ = std::make_shared<State>();
+        // 行对齐32字节, 后面多留一些给SIMD越界读
+        buffer_size_ = av_image_get_buffer_size((AVPixelFormat)format, width, height, kAlign);
+        if(buffer_size_ > 0) {
+            state_->pool = av_buffer_pool_init2(buffer_size_ + kPadding, state_.get(), allocBuffer, NULL);
+        }
+    }
+    // 还没归还的缓冲区在最后一个引用释放时才真正释放
+    ~FramePool()
+    {
+        av_buffer_pool_uninit(&state_->pool);
+    }
+    // 取一帧, 调用者用av_frame_free释放自己的引用; 失败或在途帧达到上限返回NULL
+    AVFrame *Get()
+    {
+        if(!state_->pool) {
+            return NULL;
+        }
+        if(max_frames_ > 0 && state_->in_flight.load(std::memory_order_relaxed) >= max_frames_) {
+            state_->exhausted.fetch_add(1, std::memory_order_relaxed);
+            return NULL;
+        }
+        AVBufferRef *pool_buf = av_buffer_pool_get(state_->pool);
+        if(!pool_buf) {
+            return NULL;
+        }
+        // 包一层, 最后一个引用释放时先记账再把缓冲区还给池子
+        Release *release = new Release;
+        release->pool_buf = pool_buf;
+        release->state = state_;
+        AVBufferRef *buf = av_buffer_create(pool_buf->data, pool_buf->size, releaseBuffer, release, 0);
+        if(!buf) {
+            delete release;
+            av_buffer_unref(&pool_buf);
+            return NULL;
+        }
+        AVFrame *frame = av_frame_alloc();
+        if(!frame) {
+            av_buffer_unref(&buf);
+            return NULL;
+        }
+        frame->format = format_;
+        frame->width = width_;
+        frame->height = height_;
+        frame->buf[0] = buf;
+        av_image_fill_arrays(frame->data, frame->linesize, buf->data,
+                             (AVPixelFormat)format_, width_, height_, kAlign);
+        state_->in_flight.fetch_add(1, std::memory_order_relaxed);
+        state_->gets.fetch_add(1, std::memory_order_relaxed);
+        return frame;
+    }
+    void GetStats(FramePoolStats *stats)
+    {
+        stats->allocated = state_->allocated.load(std::memory_order_relaxed);
+        stats->in_flight = state_->in_flight.load(std::memory_order_relaxed);
+        stats->gets = state_->gets.load(std::memory_order_relaxed);
+        stats->exhausted = state_->exhausted.load(std::memory_order_relaxed);
+    }
+    int GetMaxFrames() const {
+        return max_frames_;
+    }
+private:
+    // FramePool析构之后在途的帧还可能释放, 计数放在共享的状态里
+    typedef struct state
+    {
+        AVBufferPool *pool = NULL;
+        std::atomic<int64_t> allocated{0};
+        std::atomic<int64_t> in_flight{0};
+        std::atomic<int64_t> gets{0};
+        std::atomic<int64_t> exhausted{0};
+    }State;
+    typedef struct release
+    {
+        AVBufferRef *pool_buf;
+        std::shared_ptr<State> state;
+    }Release;
+
+    static const int kAlign = 32;
+    static const int kPadding = 64;
+
+    static AVBufferRef *allocBuffer(void *opaque, int size)
+    {
+        State *state = (State *)opaque;
+        AVBufferRef *buf = av_buffer_alloc(size);
+        if(buf) {
+            state->allocated.fetch_add(1, std::memory_order_relaxed);
+        }
+        return buf;
+    }
+    static void releaseBuffer(void *opaque, uint8_t *data)
+    {
+        (void)data;
+        Release *release = (Release *)opaque;
+        release->state->in_flight.fetch_sub(1, std::memory_order_relaxed);
+        av_buffer_unref(&release->pool_buf);
+        delete release;
+    }
+
+    FramePool(const FramePool &) = delete;
+    FramePool &operator=(const FramePool &) = delete;
+
+    int width_ = 0;
+    int height_ = 0;
+    int format_ = AV_PIX_FMT_NONE;
+    int max_frames_ = 0;
+    int buffer_size_ = 0;
+    std::shared_ptr<State> state_;
+};
+
+#endif // FRAMEPOOL_H
@@ -0,0 +1,188 @@
+﻿#ifndef FRAMEQUEUE_H
+#define FRAMEQUEUE_H
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <chrono>
+#include <string>
+#include <stdint.h>
+extern "C" {
+#include <libavutil/frame.h>
+}
+
+// 队列满时怎么处理新来的帧
+typedef enum FrameQueuePolicy
+{
+    FRAME_QUEUE_DROP_OLDEST = 0,    // 丢掉最早的一帧, 编码的总是最新的画面, 延迟最小
+    FRAME_QUEUE_DROP_NEWEST,        // 丢掉新来的帧, 已经排队的帧都会编码
+    FRAME_QUEUE_BLOCK               // 阻塞生产者直到有空位, 不丢帧, 采集可能被拖慢
+}FrameQueuePolicy;
+
+typedef struct frame_queue_stats
+{
+    int64_t pushed;     // 进入队列的帧数
+    int64_t popped;     // 取出的帧数
+    int64_t dropped;    // 按策略丢掉的帧数
+    int64_t blocked;    // FRAME_QUEUE_BLOCK时生产者等待的次数
+    int depth;          // 当前队列里的帧数
+    int max_depth;      // 上一次reset以来的最大深度
+}FrameQueueStats;
+
+// "drop_oldest"/"drop_newest"/"block", 其他值按drop_oldest
+static inline FrameQueuePolicy FrameQueuePolicyFromName(const std::string &name)
+{
+    if(name == "drop_newest") {
+        return FRAME_QUEUE_DROP_NEWEST;
+    }
+    if(name == "block") {
+        return FRAME_QUEUE_BLOCK;
+    }
+    return FRAME_QUEUE_DROP_OLDEST;
+}
+
+static inline const char *FrameQueuePolicyName(FrameQueuePolicy policy)
+{
+    switch(policy) {
+    case FRAME_QUEUE_DROP_NEWEST:
+        return "drop_newest";
+    case FRAME_QUEUE_BLOCK:
+        return "block";
+    default:
+        return "drop_oldest";
+    }
+}
+
+// 采集和编码之间的有界帧队列, 队列持有帧的引用, 丢帧时释放
+// 容量很小(几帧), 用锁加条件变量就够了; 丢帧时的av_frame_free在锁外执行
+class FrameQueue
+{
+public:
+    FrameQueue(int capacity, FrameQueuePolicy policy)
+        : capacity_(capacity > 0 ? capacity : 1), policy_(policy)
+    {
+    }
+    ~FrameQueue()
+    {
+        Flush();
+    }
+    // 取得frame的所有权; 返回false表示frame按策略被丢掉或者已经Abort, frame已经释放
+    // DROP_OLDEST时新帧总是进入队列, 返回true
+    bool Push(AVFrame *frame)
+    {
+        AVFrame *dropped = NULL;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            if(!abort_ && (int)frames_.size() >= capacity_) {
+                switch(policy_) {
+                case FRAME_QUEUE_DROP_NEWEST:
+                    dropped = frame;
+                    frame = NULL;
+                    break;
+                case FRAME_QUEUE_BLOCK:
+                    blocked_++;
+                    not_full_.wait(lock, [this]() {
+                        return abort_ || (int)frames_.size() < capacity_;
+                    });
+                    break;
+                default:
+                    dropped = frames_.front();
+                    frames_.pop_front();
+                    break;
+                }
+                if(dropped) {
+                    dropped_++;
+                }
+            }
+            if(abort_ && frame) {
+                dropped = frame;
+                frame = NULL;
+            }
+            if(frame) {
+                frames_.push_back(frame);
+                pushed_++;
+                if((int)frames_.size() > max_depth_) {
+                    max_depth_ = (int)frames_.size();
+                }
+                not_empty_.notify_one();
+            }
+        }
+        av_frame_free(&dropped);
+        return frame != NULL;
+    }
+    // 返回值: 1取到帧, 调用者负责av_frame_free; 0超时; -1已经Abort
+    // timeout_ms: <0一直等
+    int Pop(AVFrame **frame, int timeout_ms)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        auto ready = [this]() { return abort_ || !frames_.empty(); };
+        if(timeout_ms < 0) {
+            not_empty_.wait(lock, ready);
+        } else if(!not_empty_.wait_for(lock, std::chrono::milliseconds(timeout_ms), ready)) {
+            return 0;
+        }
+        if(abort_) {
+            return -1;
+        }
+        *frame = frames_.front();
+        frames_.pop_front();
+        popped_++;
+        not_full_.notify_one();
+        return 1;
+    }
+    // 唤醒所有等待的线程, 之后Push直接丢帧, Pop返回-1
+    void Abort()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        abort_ = true;
+        not_empty_.notify_all();
+        not_full_.notify_all();
+    }
+    void Flush()
+    {
+        std::deque<AVFrame *> frames;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            frames.swap(frames_);
+            not_full_.notify_all();
+        }
+        for(size_t i = 0; i < frames.size(); i++) {
+            av_frame_free(&frames[i]);
+        }
+    }
+    // reset为true时计数和最大深度清零
+    void GetStats(FrameQueueStats *stats, bool reset = false)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stats->pushed = pushed_;
+        stats->popped = popped_;
+        stats->dropped = dropped_;
+        stats->blocked = blocked_;
+        stats->depth = (int)frames_.size();
+        stats->max_depth = max_depth_;
+        if(reset) {
+            pushed_ = popped_ = dropped_ = blocked_ = 0;
+            max_depth_ = (int)frames_.size();
+        }
+    }
+    FrameQueuePolicy GetPolicy() const {
+        return policy_;
+    }
+private:
+    FrameQueue(const FrameQueue &) = delete;
+    FrameQueue &operator=(const FrameQueue &) = delete;
+
+    std::mutex mutex_;
+    std::condition_variable not_empty_;
+    std::condition_variable not_full_;
+    std::deque<AVFrame *> frames_;
+    int capacity_;
+    FrameQueuePolicy policy_;
+    bool abort_ = false;
+    int64_t pushed_ = 0;
+    int64_t popped_ = 0;
+    int64_t dropped_ = 0;
+    int64_t blocked_ = 0;
+    int max_depth_ = 0;
+};
+
+#endif // FRAMEQUEUE_H
@@ -1,6 +1,7 @@
 ﻿#include "h264encoder.h"
 #include "dlog.h"
 #include <cstdio>
+#include <algorithm>
 
 H264Encoder::H264Encoder()
 {
@@ -12,6 +13,11 @@ H264Encoder::~H264Encoder()
     if(ctx_) {
         avcodec_free_context(&ctx_);
     }
+    av_dict_free(&dict_);
+    if(buffer_pool_) {
+        delete buffer_pool_;
+        buffer_pool_ = NULL;
+    }
     if(frame_) {
         av_frame_free(&frame_);
     }
@@ -41,6 +47,17 @@ int H264Encoder::Init(const Properties &properties)
     bitrate_ = properties.GetProperty("bitrate", 500*1024);
     gop_ = properties.GetProperty("gop", fps_);
     pix_fmt_ = properties.GetProperty("pix_fmt", AV_PIX_FMT_YUV420P);
+    threads_ = properties.GetProperty("threads", 1);
+    thread_type_ = properties.GetProperty("thread_type", "slice");
+    preset_ = properties.GetProperty("preset", "ultrafast");
+    tune_ = properties.GetProperty("tune", "zerolatency");
+    profile_ = properties.GetProperty("profile", "baseline");
+    rc_lookahead_ = properties.GetProperty("rc_lookahead", -1);
+    x264_params_ = properties.GetProperty("x264_params", "");
+    if(threads_ < 0 || (thread_type_ != "slice" && thread_type_ != "frame")) {
+        LogError("threads:%d, thread_type:%s", threads_, thread_type_.c_str());
+        return RET_ERR_NOT_SUPPORT;
+    }
 
     codec_name_ = properties.GetProperty("codec_name", "default");
     // 查找H264编码器 确定是否存在
@@ -82,10 +99,31 @@ int H264Encoder::Init(const Properties &properties)
 
     ctx_->max_b_frames = b_frames_;
 
-    // 设置编码参数
-    av_dict_set(&dict_, "preset", "ultrafast", 0);  // 最快速度
-    av_dict_set(&dict_, "tune", "zerolatency", 0);  // 最低延迟
-    av_dict_set(&dict_, "profile", "baseline", 0);  // 使用基准配置，兼容性更好
+    // 编码线程, libx264按thread_type决定sliced-threads, 覆盖tune的设置
+    ctx_->thread_count = threads_;
+    ctx_->thread_type = thread_type_ == "frame" ? FF_THREAD_FRAME : FF_THREAD_SLICE;
+
+    // 设置编码参数, 缺省为最快速度、最低延迟、基准配置(兼容性更好)
+    av_dict_set(&dict_, "preset", preset_.c_str(), 0);
+    if(!tune_.empty()) {
+        av_dict_set(&dict_, "tune", tune_.c_str(), 0);
+    }
+    if(!profile_.empty()) {
+        av_dict_set(&dict_, "profile", profile_.c_str(), 0);
+    }
+    std::string x264_params;
+    if(rc_lookahead_ >= 0) {
+        x264_params = "rc-lookahead=" + std::to_string(rc_lookahead_);
+    }
+    if(!x264_params_.empty()) {
+        x264_params += (x264_params.empty() ? "" : ":") + x264_params_;
+    }
+    if(!x264_params.empty()) {
+        av_dict_set(&dict_, "x264-params", x264_params.c_str(), 0);
+    }
+    LogInfo("H264: threads:%d(%s), preset:%s, tune:%s, profile:%s, x264-params:%s",
+            threads_, thread_type_.c_str(), preset_.c_str(), tune_.c_str(), profile_.c_str(),
+            x264_params.c_str());
 
     // 设置关键编码参数
     ctx_->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
@@ -95,6 +133,13 @@ int H264Encoder::Init(const Properties &properties)
     ctx_->qmin = 10;
     ctx_->qmax = 51;
 
+    // 负载缓冲区按平均帧大小的8倍估算, 给I帧留余量, 更大的包由池子单独分配
+    int buffer_size = std::max(bitrate_ / 8 / std::max(fps_, 1) * 8, 64 * 1024);
+    buffer_pool_ = new PacketBufferPool(buffer_size);
+    if(buffer_pool_->Attach(ctx_)) {
+        LogInfo("H264: packet buffer pool size:%d", buffer_size);
+    }
+
     // 初始化音视频编码器
     ret = avcodec_open2(ctx_, codec_, &dict_);//编码器会根据其配置生成SPS和PPS，并填充到AVCodecContext的extradata字段中
     if(ret < 0) {
@@ -103,6 +148,15 @@ int H264Encoder::Init(const Properties &properties)
         LogError("avcodec_open2 failed:%s", buf);
         return RET_FAIL;
     }
+    // 编码器没有用到的选项(比如不是libx264), 留在dict_里
+    AVDictionaryEntry *unused = NULL;
+    while((unused = av_dict_get(dict_, "", unused, AV_DICT_IGNORE_SUFFIX))) {
+        LogWarn("H264: %s ignore option %s=%s", codec_->name, unused->key, unused->value);
+    }
+    if(thread_type_ == "frame" && ctx_->thread_count != 1) {
+        LogWarn("H264: frame threads:%d(0 is auto), output is delayed by up to threads-1 frames",
+                ctx_->thread_count);
+    }
 
     // 从extradata读取sps pps
     if(ctx_->extradata) {
@@ -177,7 +231,8 @@ AVPacket *H264Encoder::Encode(uint8_t *yuv, int size, int64_t pts, int *pkt_fram
             return NULL;
         }
         frame_->pts = pts;
-        frame_->pict_type = AV_PICTURE_TYPE_NONE;
+        frame_->pict_type = force_key_frame_ ? AV_PICTURE_TYPE_I : AV_PICTURE_TYPE_NONE;
+        force_key_frame_ = false;
         ret1 = avcodec_send_frame(ctx_, frame_);
     } else {
         ret1 = avcodec_send_frame(ctx_, NULL);
@@ -200,11 +255,17 @@ AVPacket *H264Encoder::Encode(uint8_t *yuv, int size, int64_t pts, int *pkt_fram
             return NULL;
         }
     }
-    AVPacket *packet = av_packet_alloc();
+    AVPacket *packet = PacketPool::GetInstance()->Alloc();
+    if(!packet) {
+        LogError("H264: alloc packet failed");
+        *pkt_frame = 0;
+        *ret = RET_ERR_OUTOFMEMORY;
+        return NULL;
+    }
     ret1 = avcodec_receive_packet(ctx_, packet);
     if(ret1 < 0) {
         LogError("AAC: avcodec_receive_packet ret:%d", ret1);
-        av_packet_free(&packet);
+        PacketPool::GetInstance()->Free(&packet);
         *pkt_frame = 0;
         if(ret1 == AVERROR(EAGAIN)) {       // 需要继续发送frame我们才有packet读取
             *ret = RET_ERR_EAGAIN;
@@ -238,7 +299,8 @@ AVPacket *H264Encoder::Encode1(AVFrame *yuv_frame_, int size, int64_t pts, int *
 
     if(yuv_frame_) {
         yuv_frame_->pts = pts;
-        yuv_frame_->pict_type = AV_PICTURE_TYPE_NONE;
+        yuv_frame_->pict_type = force_key_frame_ ? AV_PICTURE_TYPE_I : AV_PICTURE_TYPE_NONE;
+        force_key_frame_ = false;
         ret1 = avcodec_send_frame(ctx_, yuv_frame_);
     } else {
         ret1 = avcodec_send_frame(ctx_, NULL);
@@ -262,11 +324,17 @@ AVPacket *H264Encoder::Encode1(AVFrame *yuv_frame_, int size, int64_t pts, int *
         }
     }
     
-    AVPacket *packet = av_packet_alloc();
+    AVPacket *packet = PacketPool::GetInstance()->Alloc();
+    if(!packet) {
+        LogError("H264: alloc packet failed");
+        *pkt_frame = 0;
+        *ret = RET_ERR_OUTOFMEMORY;
+        return NULL;
+    }
     ret1 = avcodec_receive_packet(ctx_, packet);
     if(ret1 < 0) {
         LogError("H264: avcodec_receive_packet ret:%d", ret1);
-        av_packet_free(&packet);
+        PacketPool::GetInstance()->Free(&packet);
         *pkt_frame = 0;
         if(ret1 == AVERROR(EAGAIN)) {       // 需要继续发送frame我们才有packet读取
             *ret = RET_ERR_EAGAIN;
@@ -293,3 +361,99 @@ AVPacket *H264Encoder::Encode1(AVFrame *yuv_frame_, int size, int64_t pts, int *
         return packet;
     }
 }
+
+RET_CODE H264Encoder::EncodeFrame(AVFrame *frame, int64_t pts, const PacketSink &sink)
+{
+    if(!ctx_) {
+        return RET_FAIL;
+    }
+    if(flushed_) {
+        return RET_ERR_EOF;
+    }
+    if(!frame) {
+        return Flush(sink);
+    }
+    frame->pts = pts;
+    frame->pict_type = force_key_frame_ ? AV_PICTURE_TYPE_I : AV_PICTURE_TYPE_NONE;
+    force_key_frame_ = false;
+    int ret = avcodec_send_frame(ctx_, frame);
+    if(ret == AVERROR(EAGAIN)) {
+        // 每次都取空了不会出现, 保险起见先取出再送一次
+        RET_CODE drain_ret = receivePackets(sink);
+        if(drain_ret != RET_OK) {
+            return drain_ret;
+        }
+        ret = avcodec_send_frame(ctx_, frame);
+    }
+    if(ret < 0) {
+        char buf[1024] = { 0 };
+        av_strerror(ret, buf, sizeof(buf) - 1);
+        LogError("H264: avcodec_send_frame failed:%s", buf);
+        return ret == AVERROR_EOF ? RET_ERR_EOF : RET_FAIL;
+    }
+    return receivePackets(sink);
+}
+
+RET_CODE H264Encoder::EncodeFrame(AVFrame *frame, int64_t pts, std::vector<AVPacket *> *packets)
+{
+    return EncodeFrame(frame, pts, [packets](AVPacket *packet) {
+        packets->push_back(packet);
+    });
+}
+
+RET_CODE H264Encoder::Flush(const PacketSink &sink)
+{
+    if(!ctx_) {
+        return RET_FAIL;
+    }
+    if(flushed_) {
+        return RET_ERR_EOF;
+    }
+    flushed_ = true;
+    int ret = avcodec_send_frame(ctx_, NULL);
+    if(ret < 0 && ret != AVERROR_EOF) {
+        char buf[1024] = { 0 };
+        av_strerror(ret, buf, sizeof(buf) - 1);
+        LogError("H264: flush failed:%s", buf);
+        return RET_FAIL;
+    }
+    int packets = 0;
+    RET_CODE drain_ret = receivePackets([&sink, &packets](AVPacket *packet) {
+        packets++;
+        sink(packet);
+    });
+    LogInfo("H264: flush %d packets", packets);
+    return drain_ret == RET_ERR_EOF ? RET_OK : drain_ret;
+}
+
+RET_CODE H264Encoder::receivePackets(const PacketSink &sink)
+{
+    while(true) {
+        AVPacket *packet = PacketPool::GetInstance()->Alloc();
+        if(!packet) {
+            LogError("H264: alloc packet failed");
+            return RET_ERR_OUTOFMEMORY;
+        }
+        int ret = avcodec_receive_packet(ctx_, packet);
+        if(ret < 0) {
+            PacketPool::GetInstance()->Free(&packet);
+            if(ret == AVERROR(EAGAIN)) {    // 需要继续送帧
+                return RET_OK;
+            }
+            if(ret == AVERROR_EOF) {        // flush之后已经全部取完
+                return RET_ERR_EOF;
+            }
+            char buf[1024] = { 0 };
+            av_strerror(ret, buf, sizeof(buf) - 1);
+            LogError("H264: avcodec_receive_packet failed:%s", buf);
+            return RET_FAIL;
+        }
+        if(save_h264_ && h264_fp_) {
+            uint8_t start_code[] = {0, 0, 0, 1};
+            fwrite(start_code, 1, 4, h264_fp_);
+            fwrite(packet->data, 1, packet->size, h264_fp_);
+            fflush(h264_fp_);
+        }
+        sink(packet);
+    }
+}
@@ -1,6 +1,7 @@
 ﻿#ifndef H264ENCODER_H
 #define H264ENCODER_H
 #include "mediabase.h"
+#include "packetpool.h"
 extern "C" {
 #include <libavcodec/avcodec.h>
 #include <libavutil/opt.h>
@@ -21,11 +22,30 @@ public:
      *          bitrate 比特率
      *          gop 多少帧有一个I帧
      *          pix_fmt 像素格式
+     *          threads 编码线程数, 缺省为1, 0为按CPU核数自动选择
+     *          thread_type "slice"(缺省)/"frame", slice把一帧分片并行, 不增加延迟;
+     *                  frame多帧并行吞吐更高, 但输出要晚threads-1帧左右
+     *          preset x264的preset, 缺省为"ultrafast"
+     *          tune x264的tune, 缺省为"zerolatency", 为空时不设置
+     *          profile 缺省为"baseline"
+     *          rc_lookahead 码率控制向前看的帧数, 缺省为-1(由preset/tune决定), 每多一帧输出晚一帧
+     *          x264_params 其他x264参数, "key=value:key=value"格式, 在上面的参数之后生效
      * @return
      */
     virtual int Init(const Properties &properties);
     virtual AVPacket *Encode(uint8_t *yuv, int size, int64_t pts, int *pkt_frame, RET_CODE *ret);
     virtual AVPacket *Encode1(AVFrame *yuv_frame_, int size, int64_t pts, int *pkt_frame, RET_CODE *ret);
+    /**
+     * @brief EncodeFrame 送入一帧, 把编码器当前能输出的packet全部取出, 按解码顺序交给sink
+     *        编码器有延迟(帧级多线程、lookahead、B帧)时一次可能输出0个或多个packet
+     * @param frame 为NULL时等同于Flush
+     * @return RET_OK; RET_ERR_EOF已经Flush过; RET_ERR_OUTOFMEMORY分配packet失败; RET_FAIL编码器出错
+     */
+    RET_CODE EncodeFrame(AVFrame *frame, int64_t pts, const PacketSink &sink);
+    // 同上, packet追加到packets后面, 调用者可以重复使用同一个vector(自己clear)
+    RET_CODE EncodeFrame(AVFrame *frame, int64_t pts, std::vector<AVPacket *> *packets);
+    // 结束时调用一次: 送入NULL, 取出编码器缓存的所有packet直到EOF; 之后EncodeFrame返回RET_ERR_EOF
+    RET_CODE Flush(const PacketSink &sink);
     inline uint8_t *get_sps_data() {
         return (uint8_t *)sps_.c_str();
     }
@@ -41,10 +61,17 @@ public:
     inline int GetFps() {
         return fps_;
     }
+    // 下一帧强制编码为I帧
+    inline void RequestKeyFrame() {
+        force_key_frame_ = true;
+    }
     AVCodecContext *GetCodecContext() {
         return ctx_;
     }
 private:
+    // 取出所有能输出的packet, 返回RET_OK(需要更多输入)/RET_ERR_EOF(已经取完)/RET_ERR_OUTOFMEMORY/RET_FAIL
+    RET_CODE receivePackets(const PacketSink &sink);
+
     int width_ = 0;
     int height_ = 0;
     int fps_ = 0;       // 帧率
@@ -53,7 +80,15 @@ private:
     int gop_ = 0;
     bool annexb_  = false;
     int threads_ = 1;
+    std::string thread_type_ = "slice";
+    std::string preset_ = "ultrafast";
+    std::string tune_ = "zerolatency";
+    std::string profile_ = "baseline";
+    int rc_lookahead_ = -1;
+    std::string x264_params_;
     int pix_fmt_ = 0;
+    bool force_key_frame_ = false;
+    bool flushed_ = false;
     //    std::string profile_;
     //    std::string level_id_;
 
@@ -63,6 +98,7 @@ private:
     AVCodec *codec_         = NULL;
     AVCodecContext  *ctx_   = NULL;
     AVDictionary *dict_ = NULL;
+    PacketBufferPool *buffer_pool_ = NULL;     // 输出packet的负载缓冲区
 
     AVFrame *frame_ = NULL;
     FILE *h264_fp_ = nullptr;
@@ -0,0 +1,118 @@
+﻿#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+#include <atomic>
+#include <stdint.h>
+
+typedef struct histogram_stats
+{
+    int64_t count;      // 样本数
+    int64_t p50;
+    int64_t p90;
+    int64_t p99;
+    int64_t max;
+}HistogramStats;
+
+// HDR风格的对数-线性直方图, 用于统计时延(单位由调用者决定, 这里用us)
+// 每个2的幂区间再线性分成16个桶, 相对误差不超过1/16, 取值范围[0, 2^40)
+// Record只做原子加, 不加锁; 可以在任意线程调用GetStats读取
+class LatencyHistogram
+{
+public:
+    LatencyHistogram()
+    {
+        for(int i = 0; i < kBuckets; i++) {
+            buckets_[i].store(0, std::memory_order_relaxed);
+        }
+    }
+    void Record(int64_t value)
+    {
+        if(value < 0) {
+            value = 0;
+        }
+        if(value >= kMaxValue) {
+            value = kMaxValue - 1;
+        }
+        buckets_[bucketIndex((uint64_t)value)].fetch_add(1, std::memory_order_relaxed);
+        int64_t max = max_.load(std::memory_order_relaxed);
+        while(value > max && !max_.compare_exchange_weak(max, value, std::memory_order_relaxed)) {
+        }
+    }
+    // reset为true时读取后清零, 下一次读到的是这之后的样本
+    // 和Record并发时每个样本要么算在这一次, 要么算在下一次
+    void GetStats(HistogramStats *stats, bool reset = false)
+    {
+        int64_t counts[kBuckets];
+        int64_t total = 0;
+        for(int i = 0; i < kBuckets; i++) {
+            counts[i] = reset ? buckets_[i].exchange(0, std::memory_order_relaxed)
+                              : buckets_[i].load(std::memory_order_relaxed);
+            total += counts[i];
+        }
+        stats->count = total;
+        stats->max = reset ? max_.exchange(0, std::memory_order_relaxed)
+                           : max_.load(std::memory_order_relaxed);
+        stats->p50 = percentile(counts, total, 50, stats->max);
+        stats->p90 = percentile(counts, total, 90, stats->max);
+        stats->p99 = percentile(counts, total, 99, stats->max);
+    }
+private:
+    enum {
+        kSubBits = 4,
+        kSubBuckets = 1 << kSubBits,
+        kMaxBits = 40,
+        kBuckets = (kMaxBits - kSubBits + 1) * kSubBuckets
+    };
+    static const int64_t kMaxValue = (int64_t)1 << kMaxBits;
+
+    static int highestBit(uint64_t value)
+    {
+        int bit = 0;
+        if(value >> 32) { value >>= 32; bit += 32; }
+        if(value >> 16) { value >>= 16; bit += 16; }
+        if(value >> 8)  { value >>= 8;  bit += 8; }
+        if(value >> 4)  { value >>= 4;  bit += 4; }
+        if(value >> 2)  { value >>= 2;  bit += 2; }
+        if(value >> 1)  { bit += 1; }
+        return bit;
+    }
+    // 小于16的值每个值一个桶, 之后每个2的幂区间16个桶
+    static int bucketIndex(uint64_t value)
+    {
+        if(value < kSubBuckets) {
+            return (int)value;
+        }
+        int shift = highestBit(value) - kSubBits;
+        return shift * kSubBuckets + (int)(value >> shift);
+    }
+    // 桶内的最大值
+    static int64_t bucketUpper(int index)
+    {
+        if(index < 2 * kSubBuckets) {
+            return index;
+        }
+        int shift = index / kSubBuckets - 1;
+        int64_t mantissa = index % kSubBuckets + kSubBuckets;
+        return ((mantissa + 1) << shift) - 1;
+    }
+    static int64_t percentile(const int64_t *counts, int64_t total, int percent, int64_t max)
+    {
+        if(total <= 0) {
+            return 0;
+        }
+        int64_t target = (total * percent + 99) / 100;    // 向上取整, 至少是第1个样本
+        int64_t sum = 0;
+        for(int i = 0; i < kBuckets; i++) {
+            sum += counts[i];
+            if(sum >= target) {
+                int64_t value = bucketUpper(i);
+                return value < max ? value : max;
+            }
+        }
+        return max;
+    }
+
+    std::atomic<int64_t> buckets_[kBuckets];
+    std::atomic<int64_t> max_{0};
+};
+
+#endif // HISTOGRAM_H
@@ -1,7 +1,8 @@
 ﻿#include <iostream>
 #include "dlog.h"
 #include "pushwork.h"
-#include "messagequeue.h"
+#include "eventbus.h"
+#include "events.h"
 using namespace std;
 
 extern "C" {
@@ -27,25 +28,57 @@ int main()
     cout << "Hello World!" << endl;
 
     init_logger("rtsp_push.log", S_INFO);
-    MessageQueue *msg_queue_ = new MessageQueue();
+    EventBus *event_bus_ = new EventBus();
     //    for(int i = 0; i < 5; i++)
     {
         //        LogInfo("test pushwork:%d", i);
 
-        if(!msg_queue_) {
-            LogError("new MessageQueue() failed");
+        if(!event_bus_) {
+            LogError("new EventBus() failed");
+            return -1;
+        }
+        // 处理函数在事件总线的分发线程里调用, 事件发布后马上执行
+        // 发送失败、丢包这类可能连续发生的事件, 总线会合并成一次分发, count是合并的次数
+        event_bus_->SubscribeWithCount<RtspErrorEvent>([](const RtspErrorEvent &event, int count) {
+            LogError("RtspErrorEvent error:%d, count:%d", event.error, count);
+        });
+        event_bus_->SubscribeWithCount<QueueDurationEvent>([](const QueueDurationEvent &event, int count) {
+            const PacketDropResult &drop = event.drop;
+            LogError("QueueDurationEvent count:%d, last a:%lld, v:%lld, dropped reasons:0x%x, disposable:%d, gop:%d(%d pkts), audio:%d, bytes:%d",
+                     count, event.audio_duration, event.video_duration, drop.reasons, drop.disposable_packets,
+                     drop.gops, drop.gop_packets, drop.audio_packets, drop.bytes);
+        });
+        event_bus_->Subscribe<BackpressureEvent>([](const BackpressureEvent &event) {
+            LogWarn("BackpressureEvent type:%d, audio:%d, video:%d", event.media_type,
+                    event.audio_backpressure, event.video_backpressure);
+        });
+        event_bus_->Subscribe<CaptureErrorEvent>([](const CaptureErrorEvent &event) {
+            LogError("CaptureErrorEvent type:%d, error:%d", event.media_type, event.error);
+        });
+        event_bus_->Subscribe<EncodeErrorEvent>([](const EncodeErrorEvent &event) {
+            LogError("EncodeErrorEvent type:%d, error:%d", event.media_type, event.error);
+        });
+        if(event_bus_->Start() != RET_OK) {
+            LogError("EventBus start failed");
             return -1;
         }
 
-        PushWork push_work(msg_queue_);
+        // 多路推流时共用一个线程池, 不阻塞的组件(音频文件采集)作为协作任务运行, 不再每路一个线程
+        // executor要比push_work后析构, push_work析构时会等线程池上的Step结束
+        Executor executor(2);
+        PushWork push_work(event_bus_, &executor);
         Properties properties;
         // 音频test模式
         properties.SetProperty("audio_test", 1);    // 音频测试模式
         properties.SetProperty("input_pcm_name", "48000_2_s16le.pcm");
+        // 音频现在和视频一起推流; 需要检查采集和编码结果时再打开dump, 会在executor线程里写文件
+//        properties.SetProperty("save_pcm", 1);   // push_dump_s16le.pcm
+//        properties.SetProperty("save_aac", 1);   // push_dump.aac
         // 麦克风采样属性
         properties.SetProperty("mic_sample_fmt", AV_SAMPLE_FMT_S16);
         properties.SetProperty("mic_sample_rate", 48000);
         properties.SetProperty("mic_channels", 2);
+//        properties.SetProperty("audio_drift_compensation", 1);  // 真实声卡采集时打开, 音频跟随系统时钟
         // 音频编码属性
         properties.SetProperty("audio_sample_rate", 48000);
         properties.SetProperty("audio_bitrate", 64*1024);
@@ -60,11 +93,19 @@ int main()
         properties.SetProperty("desktop_height", 720);  //测试模式时和yuv文件的高度一致
         //    properties.SetProperty("desktop_pixel_format", AV_PIX_FMT_YUV420P);
         properties.SetProperty("desktop_fps", 25);//测试模式时和yuv文件的帧率一致
+        //    properties.SetProperty("desktop_convert_slices", 2);  // 1080p以上时和executor一起分片转换YUV420P
         // 视频编码属性
         properties.SetProperty("video_bitrate", 1280*720*3);  // 设置码率为2Mbps
         properties.SetProperty("gop", 30);  // 每秒一个I帧
         properties.SetProperty("b_frames", 0);  // 不使用B帧，降低延迟
         properties.SetProperty("codec_name", "libx264");  // 使用x264编码器
+        // 多核机器上用slice线程提高画质, 不增加延迟; frame线程吞吐更高但输出晚threads-1帧
+        //    properties.SetProperty("video_threads", 4);
+        //    properties.SetProperty("video_thread_type", "slice");
+        //    properties.SetProperty("video_preset", "veryfast");
+        //    properties.SetProperty("video_x264_params", "aq-mode=2");
+        //    properties.SetProperty("video_encode_queue_size", 3);   // 采集和编码之间排队的帧数, 0为在采集线程里编码
+        //    properties.SetProperty("video_encode_drop_policy", "drop_oldest");  // 编码跟不上时丢最早的帧, 或者"drop_newest"/"block"
 
         // 保存H264文件的配置
         properties.SetProperty("save_h264", 1);  // 启用H264文件保存
@@ -85,39 +126,24 @@ int main()
         properties.SetProperty("analyzeduration", 1000000);  // 增加分析时长
         properties.SetProperty("probesize", 5000000);       // 增加探测大小
         properties.SetProperty("rtsp_max_queue_duration", 1000);//最大帧队列
+        // 线程调度属性, 前缀audio_capture_thread/video_capture_thread/video_encode_thread/rtsp_pusher_thread
+        // 例如把视频采集绑到和x264编码线程隔离的CPU上, 并使用实时调度(没有权限时退回nice):
+//        properties.SetProperty("video_capture_thread.cpu_affinity", "0x2");
+//        properties.SetProperty("video_capture_thread.sched_policy", "fifo");
+//        properties.SetProperty("video_capture_thread.priority", 50);
+//        properties.SetProperty("video_capture_thread.nice", -10);
 
         if(push_work.Init(properties) != RET_OK) {
             LogError("PushWork init failed");
             return -1;
         }
 
-        int count = 0;
-        AVMessage msg;
-        int ret = 0;
-        while (true) {
-//            std::this_thread::sleep_for(std::chrono::milliseconds(1000));
-            ret = msg_queue_->msg_queue_get(&msg, 1000);
-            if(1 == ret) {
-                switch (msg.what) {
-                case MSG_RTSP_ERROR:
-                    LogError("MSG_RTSP_ERROR error:%d", msg.arg1);
-                    break;
-                case MSG_RTSP_QUEUE_DURATION:
-                    LogError("MSG_RTSP_QUEUE_DURATION a:%d, v:%d", msg.arg1, msg.arg2);
-                    break;
-                default:
-                    break;
-                }
-            }
-            LogInfo("count:%d, ret:%d", count, ret);
-            if(count++ > 100) {
-                printf("main break\n");
-                break;
-            }
-        }
-        msg_queue_->msg_queue_abort();
+        // 事件都在分发线程处理, 主线程只需要等待推流结束
+        std::this_thread::sleep_for(std::chrono::seconds(100));
+        printf("main break\n");
     }
-    delete msg_queue_;
+    event_bus_->Stop();     // push_work已经析构, 不会再有事件发布
+    delete event_bus_;
 
     LogInfo("main finish");
     return 0;
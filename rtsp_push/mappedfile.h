@@ -0,0 +1,120 @@
+﻿#ifndef MAPPEDFILE_H
+#define MAPPEDFILE_H
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <stdint.h>
+#ifdef _WIN32
+#include <winsock2.h>       // 要在windows.h之前, 否则和timesutil.h里的winsock2.h冲突
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+// 只读映射到内存的文件, 给测试模式的采集模块用
+// 同一个文件在进程内只映射一次, 用同一个测试文件的多个采集模块共享, 最后一个使用者释放时解除映射
+// 读取数据不需要系统调用和拷贝, 映射是只读的, 使用者不能修改数据
+class MappedFile
+{
+public:
+    // 失败返回空指针
+    static std::shared_ptr<MappedFile> Open(const std::string &file_name)
+    {
+        static std::mutex s_mutex;
+        static std::map<std::string, std::weak_ptr<MappedFile>> s_files;
+        std::lock_guard<std::mutex> lock(s_mutex);
+        std::shared_ptr<MappedFile> file = s_files[file_name].lock();
+        if(file) {
+            return file;
+        }
+        file.reset(new MappedFile());
+        if(!file->map(file_name)) {
+            s_files.erase(file_name);
+            return std::shared_ptr<MappedFile>();
+        }
+        s_files[file_name] = file;
+        return file;
+    }
+    ~MappedFile()
+    {
+#ifdef _WIN32
+        if(data_) {
+            UnmapViewOfFile(data_);
+        }
+        if(mapping_) {
+            CloseHandle(mapping_);
+        }
+#else
+        if(data_) {
+            munmap((void *)data_, (size_t)size_);
+        }
+#endif
+    }
+    const uint8_t *Data() const {
+        return data_;
+    }
+    int64_t Size() const {
+        return size_;
+    }
+private:
+    MappedFile() {}
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    bool map(const std::string &file_name)
+    {
+#ifdef _WIN32
+        HANDLE file = CreateFileA(file_name.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
+                                  OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+        if(file == INVALID_HANDLE_VALUE) {
+            return false;
+        }
+        LARGE_INTEGER size;
+        if(!GetFileSizeEx(file, &size) || size.QuadPart <= 0) {
+            CloseHandle(file);
+            return false;
+        }
+        mapping_ = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+        CloseHandle(file);      // 映射对象持有文件的引用
+        if(!mapping_) {
+            return false;
+        }
+        data_ = (const uint8_t *)MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0);
+        if(!data_) {
+            return false;
+        }
+        size_ = size.QuadPart;
+#else
+        int fd = open(file_name.c_str(), O_RDONLY);
+        if(fd < 0) {
+            return false;
+        }
+        struct stat st;
+        if(fstat(fd, &st) != 0 || st.st_size <= 0) {
+            close(fd);
+            return false;
+        }
+        void *data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);      // 映射建立后不再需要fd
+        if(data == MAP_FAILED) {
+            return false;
+        }
+        madvise(data, (size_t)st.st_size, MADV_WILLNEED);   // 提前读入, 采集时不再缺页等IO
+        data_ = (const uint8_t *)data;
+        size_ = st.st_size;
+#endif
+        return true;
+    }
+
+    const uint8_t *data_ = NULL;
+    int64_t size_ = 0;
+#ifdef _WIN32
+    HANDLE mapping_ = NULL;
+#endif
+};
+
+#endif // MAPPEDFILE_H
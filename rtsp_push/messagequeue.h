@@ -3,7 +3,8 @@
 
 #include <mutex>
 #include <condition_variable>
-#include <list>
+#include <vector>
+#include <string.h>
 #include "dlog.h"
 extern "C"
 {
@@ -12,6 +13,10 @@ extern "C"
 #define MSG_FLUSH                   1
 #define MSG_RTSP_ERROR              100
 #define MSG_RTSP_QUEUE_DURATION     101
+#define MSG_RTSP_BACKPRESSURE       102     // arg1: 状态变化的MediaType, arg2: 当前处于背压的流, 第(1 << MediaType)位
+#define MSG_CAPTURE_ERROR           103     // arg1: MediaType, arg2: 错误码
+#define MSG_ENCODE_ERROR            104     // arg1: MediaType, arg2: RET_CODE
+#define MSG_DATA_SIZE               128     // 消息自带的obj存储空间
 typedef struct AVMessage
 {
     int what;           // 消息类型
@@ -19,16 +24,24 @@ typedef struct AVMessage
     int arg2;
     void *obj;          //如果2个参数不够用，则传入结构体
     void (*free_l)(void *obj);
+    int count;          // 取出时合并了多少次同类型的消息, 至少为1
+    uint8_t data[MSG_DATA_SIZE];    // 不超过MSG_DATA_SIZE的obj直接拷贝到这里, obj指向data, 不需要释放
 }AVMessage;
 
 static void msg_obj_free_l(void *obj)
 {
     av_free(obj);
 }
+// 控制消息队列, 固定容量的环形缓冲区, 放消息时不分配内存
+// 队列中已经有同类型(what相同)的消息时合并: 用新消息覆盖旧消息的内容, 位置不变, count加1
+// 这样持续触发的通知(比如MSG_RTSP_QUEUE_DURATION)在队列里最多只占一个位置
 class MessageQueue
 {
 public:
-    MessageQueue() {}
+    explicit MessageQueue(int capacity = 64)
+        :ring_(capacity > 0 ? capacity : 64)
+    {
+    }
     ~MessageQueue()
     {
         msg_queue_flush();
@@ -39,9 +52,9 @@ public:
     }
 
     //存放消息到队列中
+    // 返回值: 0 成功(包括被合并); -1 abort或者队列已满
     int msg_queue_put(AVMessage *msg)
     {
-        LogInfo("msg_queue_put");
         std::lock_guard<std::mutex> lock(mutex_);
         int ret = msg_queue_put_private(msg);
         if(0 == ret) {
@@ -60,7 +73,6 @@ public:
             return -2;
         }
         std::unique_lock<std::mutex> lock(mutex_);
-        AVMessage *msg1;
         int ret;
         for(;;) {
             if(abort_request_) {
@@ -68,11 +80,10 @@ public:
                 break;
             }
             //队列不为空则释放队列中的第一个
-            if(!queue_.empty()) {
-                msg1= queue_.front();
-                *msg = *msg1;
-                queue_.pop_front();
-                av_free(msg1);      // 释放msg1
+            if(size_ > 0) {
+                copyMessage(msg, &ring_[head_]);
+                head_ = (head_ + 1) % ring_.size();
+                size_--;
                 ret = 1;
                 break;
             } else if(0 == timeout) {
@@ -80,15 +91,15 @@ public:
                 break;
             } else if(timeout < 0){
                 cond_.wait(lock, [this] {
-                    return !queue_.empty() | abort_request_;    // 队列不为空或者abort请求才退出wait
+                    return size_ > 0 || abort_request_;    // 队列不为空或者abort请求才退出wait
                 });
             } else if(timeout > 0) {
 //                LogInfo("wait_for into");
                 cond_.wait_for(lock, std::chrono::milliseconds(timeout), [this] {
 //                    LogInfo("wait_for leave");
-                    return !queue_.empty() | abort_request_;        // 直接写return true;是错误的
+                    return size_ > 0 || abort_request_;        // 直接写return true;是错误的
                 });
-                if(queue_.empty()) {
+                if(0 == size_) {
                     ret = 0;
                     break;
                 }
@@ -104,25 +115,22 @@ public:
     void msg_queue_remove(int what)
     {
         std::lock_guard<std::mutex> lock(mutex_);
-        while(!abort_request_ && !queue_.empty()) {
-            std::list<AVMessage *>::iterator it;
-            AVMessage *msg = NULL;
-            for(it = queue_.begin(); it != queue_.end(); it++) {
-                if((*it)->what == what) {
-                    msg = *it;
-                    break;
-                }
+        if(abort_request_) {
+            return;
+        }
+        size_t size = 0;
+        for(size_t i = 0; i < size_; i++) {     // 保留下来的消息往前移, 保持原来的顺序
+            AVMessage *msg = &ring_[(head_ + i) % ring_.size()];
+            if(msg->what == what) {
+                freeObj(msg);
+                continue;
             }
-            if(msg) {
-                if(msg->obj && msg->free_l) {
-                    msg->free_l(msg->obj);
-                }
-                av_free(msg);
-                queue_.remove(msg);
-            } else {
-                break;
+            if(size != i) {
+                copyMessage(&ring_[(head_ + size) % ring_.size()], msg);
             }
+            size++;
         }
+        size_ = size;
     }
 
 
@@ -160,10 +168,19 @@ public:
         msg.what = what;
         msg.arg1 = arg1;
         msg.arg2 = arg2;
-        msg.obj = av_malloc(obj_len);
-        msg.free_l = msg_obj_free_l;
+        if(obj_len <= MSG_DATA_SIZE) {
+            msg.obj = msg.data;
+        } else {
+            msg.obj = av_malloc(obj_len);       // 超过消息自带的空间才分配
+            if(!msg.obj) {
+                return;
+            }
+            msg.free_l = msg_obj_free_l;
+        }
         memcpy(msg.obj, obj, obj_len);
-        msg_queue_put(&msg);
+        if(msg_queue_put(&msg) != 0) {
+            freeObj(&msg);
+        }
     }
 
     void msg_queue_abort()
@@ -176,13 +193,10 @@ public:
     void msg_queue_flush()
     {
         std::lock_guard<std::mutex> lock(mutex_);
-        while (!queue_.empty()) {
-            AVMessage *msg = queue_.front();
-            if(msg->obj && msg->free_l) {
-                msg->free_l(msg->obj);
-            }
-            queue_.pop_front();
-            av_free(msg);
+        while (size_ > 0) {
+            freeObj(&ring_[head_]);
+            head_ = (head_ + 1) % ring_.size();
+            size_--;
         }
     }
 
@@ -198,17 +212,46 @@ private:
         if(abort_request_) {
             return -1;
         }
-        AVMessage *msg1 = (AVMessage *)av_malloc(sizeof(AVMessage));
-        if(!msg1) {
+        for(size_t i = 0; i < size_; i++) {
+            AVMessage *msg1 = &ring_[(head_ + i) % ring_.size()];
+            if(msg1->what == msg->what) {      // 合并, 以最新的为准
+                int count = msg1->count;
+                freeObj(msg1);
+                copyMessage(msg1, msg);
+                msg1->count = count + 1;
+                return 0;
+            }
+        }
+        if(size_ == ring_.size()) {
             return -1;
         }
-        *msg1 = *msg;
-        queue_.push_back(msg1);
+        AVMessage *msg1 = &ring_[(head_ + size_) % ring_.size()];
+        copyMessage(msg1, msg);
+        msg1->count = 1;
+        size_++;
         return 0;
     }
+    // obj指向消息自带的data时, 拷贝后要指向新消息的data
+    static void copyMessage(AVMessage *dst, const AVMessage *src)
+    {
+        *dst = *src;
+        if(src->obj == src->data) {
+            dst->obj = dst->data;
+        }
+    }
+    static void freeObj(AVMessage *msg)
+    {
+        if(msg->obj && msg->free_l) {
+            msg->free_l(msg->obj);
+        }
+        msg->obj = NULL;
+        msg->free_l = NULL;
+    }
     int abort_request_ = 0;
     std::mutex mutex_;
     std::condition_variable cond_;
-    std::list<AVMessage *> queue_;
+    std::vector<AVMessage> ring_;       // 构造时一次性分配
+    size_t head_ = 0;
+    size_t size_ = 0;
 };
 #endif // MESSAGEQUEUE_H
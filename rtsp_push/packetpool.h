@@ -0,0 +1,191 @@
+﻿#ifndef PACKETPOOL_H
+#define PACKETPOOL_H
+#include <mutex>
+#include <vector>
+#include <functional>
+#include <atomic>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+extern "C" {
+#include <libavcodec/avcodec.h>
+}
+
+typedef struct packet_pool_stats
+{
+    int64_t alloc_hits;         // 直接复用缓存里的AVPacket
+    int64_t alloc_misses;       // 缓存为空, 重新av_packet_alloc
+    int64_t buffer_hits;        // 负载从AVBufferPool里取
+    int64_t buffer_misses;      // 负载超过池子缓冲区大小, 单独分配
+    int64_t outstanding;        // 已经分配出去还没有归还的packet数量
+    int cached;                 // 缓存里空闲的packet数量
+}PacketPoolStats;
+
+// 编码器输出packet的回调, packet由PacketPool分配, 所有权交给回调, 不用时调用PacketPool::Free
+typedef std::function<void(AVPacket *)> PacketSink;
+
+// AVPacket回收池, 编码器和RtspPusher共用一个
+// 编码器用Alloc替代av_packet_alloc, 消费者用Free替代av_packet_free
+// Free只把负载unref掉, AVPacket结构体缓存起来给下一次Alloc复用, 避免每个包都走一次malloc/free
+class PacketPool
+{
+public:
+    static PacketPool *GetInstance() {
+        static PacketPool s_packet_pool;
+        return &s_packet_pool;
+    }
+    AVPacket *Alloc()
+    {
+        AVPacket *pkt = NULL;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if(!cached_.empty()) {
+                pkt = cached_.back();
+                cached_.pop_back();
+            }
+        }
+        if(pkt) {
+            alloc_hits_.fetch_add(1, std::memory_order_relaxed);
+        } else {
+            pkt = av_packet_alloc();
+            if(!pkt) {
+                return NULL;
+            }
+            alloc_misses_.fetch_add(1, std::memory_order_relaxed);
+        }
+        outstanding_.fetch_add(1, std::memory_order_relaxed);
+        return pkt;
+    }
+    void Free(AVPacket **pkt)
+    {
+        if(!pkt || !*pkt) {
+            return;
+        }
+        av_packet_unref(*pkt);     // 负载如果来自AVBufferPool, unref时自动回到对应的池子
+        outstanding_.fetch_sub(1, std::memory_order_relaxed);
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if(cached_.size() < kMaxCached) {
+                cached_.push_back(*pkt);
+                *pkt = NULL;
+                return;
+            }
+        }
+        av_packet_free(pkt);        // 缓存满了直接释放
+    }
+    // 记录编码器负载缓冲区的命中情况, 由PacketBufferPool调用
+    void CountBuffer(bool hit)
+    {
+        if(hit) {
+            buffer_hits_.fetch_add(1, std::memory_order_relaxed);
+        } else {
+            buffer_misses_.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+    void GetStats(PacketPoolStats *stats)
+    {
+        stats->alloc_hits = alloc_hits_.load(std::memory_order_relaxed);
+        stats->alloc_misses = alloc_misses_.load(std::memory_order_relaxed);
+        stats->buffer_hits = buffer_hits_.load(std::memory_order_relaxed);
+        stats->buffer_misses = buffer_misses_.load(std::memory_order_relaxed);
+        stats->outstanding = outstanding_.load(std::memory_order_relaxed);
+        std::lock_guard<std::mutex> lock(mutex_);
+        stats->cached = (int)cached_.size();
+    }
+private:
+    PacketPool()
+    {
+        cached_.reserve(kMaxCached);
+        for(size_t i = 0; i < kPreallocated; i++) {    // 预先分配, 推流开始后基本不用再分配
+            AVPacket *pkt = av_packet_alloc();
+            if(pkt) {
+                cached_.push_back(pkt);
+            }
+        }
+    }
+    ~PacketPool()
+    {
+        for(size_t i = 0; i < cached_.size(); i++) {
+            av_packet_free(&cached_[i]);
+        }
+    }
+    PacketPool(const PacketPool &) = delete;
+    PacketPool &operator=(const PacketPool &) = delete;
+
+    static const size_t kPreallocated = 64;
+    static const size_t kMaxCached = 1024;      // 和PacketQueue默认容量一致, 队列积压的包归还时也能缓存下来
+
+    std::mutex mutex_;
+    std::vector<AVPacket *> cached_;
+    std::atomic<int64_t> alloc_hits_{0};
+    std::atomic<int64_t> alloc_misses_{0};
+    std::atomic<int64_t> buffer_hits_{0};
+    std::atomic<int64_t> buffer_misses_{0};
+    std::atomic<int64_t> outstanding_{0};
+};
+
+// 编码器输出packet的负载缓冲区池, 每个编码器一个, 缓冲区大小由编码器根据码率估算
+// FFmpeg 4.4(libavcodec 58.134.100)开始支持get_encode_buffer回调, 支持AV_CODEC_CAP_DR1的编码器
+// 直接把码流写到池子的缓冲区里; 更早的版本由编码器内部分配负载, 只能复用AVPacket结构体
+class PacketBufferPool
+{
+public:
+    explicit PacketBufferPool(int buffer_size)
+    {
+        buffer_size_ = buffer_size + AV_INPUT_BUFFER_PADDING_SIZE;
+        pool_ = av_buffer_pool_init(buffer_size_, NULL);
+    }
+    // 还没归还的缓冲区在最后一个引用释放时才真正释放
+    ~PacketBufferPool()
+    {
+        av_buffer_pool_uninit(&pool_);
+    }
+    // 需要在avcodec_open2之前调用, 返回false说明编码器不支持, 还是用编码器默认的分配方式
+    bool Attach(AVCodecContext *ctx)
+    {
+#if LIBAVCODEC_VERSION_INT >= AV_VERSION_INT(58, 134, 100)
+        if(!pool_ || !ctx->codec || !(ctx->codec->capabilities & AV_CODEC_CAP_DR1)) {
+            return false;
+        }
+        ctx->opaque = this;
+        ctx->get_encode_buffer = getEncodeBuffer;
+        return true;
+#else
+        (void)ctx;
+        return false;
+#endif
+    }
+    int GetBufferSize() const {
+        return buffer_size_ - AV_INPUT_BUFFER_PADDING_SIZE;
+    }
+private:
+    static int getEncodeBuffer(AVCodecContext *ctx, AVPacket *pkt, int flags)
+    {
+        (void)flags;
+        PacketBufferPool *pool = (PacketBufferPool *)ctx->opaque;
+        return pool->getBuffer(pkt);
+    }
+    int getBuffer(AVPacket *pkt)
+    {
+        AVBufferRef *buf = NULL;
+        if(pkt->size + AV_INPUT_BUFFER_PADDING_SIZE <= buffer_size_) {
+            buf = av_buffer_pool_get(pool_);
+        }
+        PacketPool::GetInstance()->CountBuffer(buf != NULL);
+        if(!buf) {      // 超大的包(比如码率突变时的I帧)单独分配
+            buf = av_buffer_alloc(pkt->size + AV_INPUT_BUFFER_PADDING_SIZE);
+            if(!buf) {
+                return AVERROR(ENOMEM);
+            }
+        }
+        memset(buf->data + pkt->size, 0, AV_INPUT_BUFFER_PADDING_SIZE);
+        pkt->buf = buf;
+        pkt->data = buf->data;
+        return 0;
+    }
+
+    AVBufferPool *pool_ = NULL;
+    int buffer_size_ = 0;
+};
+
+#endif // PACKETPOOL_H
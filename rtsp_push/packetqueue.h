@@ -2,9 +2,14 @@
 #define PACKETQUEUE_H
 #include <mutex>
 #include <condition_variable>
-#include <queue>
+#include <atomic>
+#include <cmath>
 #include "mediabase.h"
+#include "spscqueue.h"
+#include "seqlock.h"
 #include "dlog.h"
+#include "timesutil.h"
+#include "packetpool.h"
 using namespace std;
 extern "C"
 {
@@ -19,20 +24,124 @@ typedef struct packet_queue_stats
     int video_size;         // 视频总大小 字节
     int64_t audio_duration; //音频持续时长
     int64_t video_duration; //视频持续时长
+    int64_t audio_front_pts;// 最近出队的音频pts, 还没有出队时为第一个入队的pts
+    int64_t audio_back_pts; // 最近入队的音频pts
+    int64_t video_front_pts;
+    int64_t video_back_pts;
+    // 丢包统计, 累计值
+    int drop_times;             // 触发丢包的次数
+    int drop_disposable_packets;// 丢弃的非参考视频帧
+    int drop_gops;              // 丢弃的GOP数量
+    int drop_gop_packets;       // 随GOP一起丢弃的视频包
+    int drop_audio_packets;     // 丢弃的音频包
+    int64_t drop_bytes;         // 丢弃的总字节数
+    int last_drop_reasons;      // 最近一次丢包的原因, DropReason按位或
+    // 内存预算统计
+    int audio_max_nb_packets;   // 音频包数高水位(历史最大值)
+    int audio_max_size;         // 音频字节数高水位
+    int64_t audio_over_budget_time; // 音频处于背压状态的累计时长ms
+    int audio_rejected_packets; // 超出预算被拒绝的音频包
+    int audio_backpressure;     // 音频当前是否处于背压
+    int video_max_nb_packets;
+    int video_max_size;
+    int64_t video_over_budget_time;
+    int video_rejected_packets;
+    int video_backpressure;
 }PacketQueueStats;
 
+// 丢包原因, 按优先级从高到低
+typedef enum drop_reason
+{
+    E_DROP_NONE         = 0,
+    E_DROP_DISPOSABLE   = 0x01,     // 非参考视频帧, 丢了不影响解码
+    E_DROP_GOP          = 0x02,     // 队首整个GOP
+    E_DROP_AUDIO        = 0x04      // 音频, 最后手段
+}DropReason;
+
+// 一次Drop(false, ...)的结果, 也作为MSG_RTSP_QUEUE_DURATION消息的obj
+typedef struct packet_drop_result
+{
+    int reasons;                // DropReason按位或
+    int disposable_packets;     // 丢弃的非参考视频帧数量
+    int gops;                   // 丢弃的GOP数量
+    int gop_packets;            // 随GOP丢弃的视频包数量
+    int audio_packets;          // 丢弃的音频包数量
+    int bytes;                  // 丢弃的总字节数
+    int64_t audio_duration;     // 丢包后剩余音频时长(按包数估算)
+    int64_t video_duration;     // 丢包后剩余视频时长(按包数估算)
+}PacketDropResult;
+
+// 队列一端(生产或消费)的累计计数, 只由该端的线程写
+typedef struct queue_counters
+{
+    int64_t packets;        // 累计包数
+    int64_t bytes;          // 累计字节数
+    int64_t pts;            // 最近一个包的pts
+    int64_t ts;             // 最近一个包的交织时间戳(packetTs, 优先dts), 和队头包的packetTs比较
+}QueueCounters;
+
+// 内存预算相关计数, 只由该媒体的生产者写
+typedef struct budget_counters
+{
+    int64_t max_nb_packets;     // 包数高水位
+    int64_t max_size;           // 字节数高水位
+    int64_t rejected_packets;   // 超出预算被拒绝的包数
+}BudgetCounters;
+
+// 单个媒体类型的统计, xxx_local是写线程自己的副本, 修改后Store到顺序锁里给其它线程读
+typedef struct media_counters
+{
+    QueueCounters push_local = {0, 0, 0, 0};    // 只有生产者读写
+    SeqLock<QueueCounters> pushed;
+    QueueCounters pop_local = {0, 0, 0, 0};     // 只有消费者读写
+    SeqLock<QueueCounters> popped;
+    std::atomic<int64_t> first_pts{0};      // 第一个入队的pts
+    // 内存预算, 0表示不限制
+    int max_packets = 0;
+    int max_bytes = 0;
+    BudgetCounters budget_local = {0, 0, 0};    // 只有生产者读写
+    SeqLock<BudgetCounters> budget;
+    // 背压状态: 生产者入队后进入, 生产者或消费者发现占用回落后清除(背压时生产者可能不再入队)
+    // 只有状态可能变化时才加锁, 下面两个时长由pressure_mutex保护
+    std::atomic<bool> backpressure{false};  // 达到高水位后置true, 回落到高水位一半以下才清除
+    std::mutex pressure_mutex;
+    int64_t over_budget_time = 0;           // 已结束的背压累计时长ms
+    int64_t over_budget_start = 0;          // 本次进入背压的时间ms, 0表示不在背压
+    bool need_key_frame = false;            // 视频包被拒绝后, 需要等到下一个I帧才能继续入队
+}MediaCounters;
+
+// 累计丢包计数, 只由消费线程写
+typedef struct drop_counters
+{
+    int64_t times;
+    int64_t disposable_packets;
+    int64_t gops;
+    int64_t gop_packets;
+    int64_t audio_packets;
+    int64_t bytes;
+    int64_t last_reasons;
+}DropCounters;
+
 typedef struct my_avpacket
 {
     AVPacket *pkt;
     MediaType media_type;
+    uint64_t seq;           // 入队序号, 出队时按序号合并音视频两个队列, 保持原来的FIFO顺序
+    int64_t enqueue_time;   // 入队时间 us(单调时钟), 用于交织出队的等待窗口和统计排队时延
 }MyAVPacket;
 
+// 音频、视频各用一个预分配的无锁环形队列
+// 约束: 音频包只能由一个线程Push, 视频包只能由一个线程Push; Pop/PopWithTimeout/Drop只能在同一个消费线程调用
+// 只有消费者真正进入等待时, 生产者才去加锁唤醒, 平时Push/Pop都不加锁
+// 统计分为入队、出队两份累计计数, 各自只有一个写线程, 用顺序锁发布快照, 读统计不会阻塞生产者
 class PacketQueue
 {
 public:
-    PacketQueue(double audio_frame_duration, double video_frame_duration)
+    PacketQueue(double audio_frame_duration, double video_frame_duration, int capacity = 1024)
         :audio_frame_duration_(audio_frame_duration),
-        video_frame_duration_(video_frame_duration)
+        video_frame_duration_(video_frame_duration),
+        audio_queue_(capacity),
+        video_queue_(capacity)
     {
         if(audio_frame_duration_ < 0) {
             audio_frame_duration_ = 0;
@@ -40,14 +149,31 @@ public:
         if(video_frame_duration < 0) {
             video_frame_duration = 0;
         }
-        memset(&stats_, 0, sizeof(PacketQueueStats));
     }
     ~PacketQueue()
     {
-
+        Drop(true, 0);      // 释放还没有发送的packet
+    }
+    // 设置内存预算, 需要在开始Push之前调用
+    // max_packets/max_bytes: 队列中最多缓存的包数/字节数, 超出时Push失败, 0表示不限制
+    void SetBudget(MediaType media_type, int max_packets, int max_bytes)
+    {
+        MediaCounters &counters = E_AUDIO_TYPE == media_type ? audio_counters_ : video_counters_;
+        counters.max_packets = max_packets;
+        counters.max_bytes = max_bytes;
+    }
+    // 音视频共用, 占用达到预算的high_water_percent%时进入背压状态
+    void SetHighWater(int high_water_percent)
+    {
+        high_water_percent_ = high_water_percent;
+    }
+    // 是否处于背压状态, 编码端可以据此跳帧或者降码率
+    bool IsBackpressured(MediaType media_type)
+    {
+        return (E_AUDIO_TYPE == media_type ? audio_counters_ : video_counters_).backpressure;
     }
     // 插入packet，需要指明音视频类型
-    // 返回0说明正常
+    // 返回0说明正常, 插入失败时pkt仍由调用者释放
     int Push(AVPacket *pkt, MediaType media_type)
     {
         if(!pkt) {
@@ -59,13 +185,12 @@ public:
             return -1;
         }
 
-        std::lock_guard<std::mutex> lock(mutex_);
         int ret = pushPrivate(pkt, media_type);
         if(ret < 0) {
             LogError("pushPrivate failed");
             return -1;
         } else {
-            cond_.notify_one();
+            wakeupConsumer();
             return 0;
         }
     }
@@ -76,34 +201,53 @@ public:
             LogWarn("abort request");
             return -1;
         }
-        MyAVPacket *mypkt = (MyAVPacket *)malloc(sizeof(MyAVPacket));
-        if(!mypkt) {
-            LogError("malloc MyAVPacket failed");
+        MyAVPacket mypkt;
+        mypkt.pkt = pkt;
+        mypkt.media_type = media_type;
+        mypkt.seq = push_seq_.fetch_add(1, std::memory_order_relaxed);
+        mypkt.enqueue_time = TimesUtil::GetTimeMicrosecond();
+        SpscQueue<MyAVPacket> &queue = E_AUDIO_TYPE == media_type ? audio_queue_ : video_queue_;
+        MediaCounters &counters = E_AUDIO_TYPE == media_type ? audio_counters_ : video_counters_;
+        if(queue.Full()) {
+            LogWarn("%s queue is full, capacity:%d", E_AUDIO_TYPE == media_type ? "audio" : "video",
+                    (int)queue.Capacity());
             return -1;
         }
-        mypkt->pkt = pkt;
-        mypkt->media_type = media_type;
-        if(E_AUDIO_TYPE == media_type) {
-            stats_.audio_nb_packets++;      // 包数量
-            stats_.audio_size += pkt->size;
-            // 持续时长怎么统计，不是用pkt->duration
-            audio_back_pts_ = pkt->pts;
-            if(audio_first_packet) {
-                audio_first_packet  = 0;
-                audio_front_pts_ = pkt->pts;
+        // 入队前的占用情况
+        QueueCounters popped = counters.popped.Load();
+        int64_t nb_packets = counters.push_local.packets - popped.packets;
+        int64_t size = counters.push_local.bytes - popped.bytes;
+        if(E_VIDEO_TYPE == media_type && counters.need_key_frame) {
+            if(!(pkt->flags & AV_PKT_FLAG_KEY)) {       // 前面丢过视频, 后面的P帧无法解码
+                rejectPacket(counters, nb_packets, size);
+                return -1;
             }
+            counters.need_key_frame = false;
         }
-        if(E_VIDEO_TYPE == media_type) {
-            stats_.video_nb_packets++;      // 包数量
-            stats_.video_size += pkt->size;
-            // 持续时长怎么统计，不是用pkt->duration
-            video_back_pts_ = pkt->pts;
-            if(video_first_packet) {
-                video_first_packet  = 0;
-                video_front_pts_ = pkt->pts;
+        if((counters.max_packets > 0 && nb_packets + 1 > counters.max_packets)
+                || (counters.max_bytes > 0 && size + pkt->size > counters.max_bytes)) {
+            LogWarn("%s queue over budget, packets:%lld/%d, bytes:%lld/%d",
+                    E_AUDIO_TYPE == media_type ? "audio" : "video",
+                    nb_packets, counters.max_packets, size, counters.max_bytes);
+            if(E_VIDEO_TYPE == media_type) {
+                counters.need_key_frame = true;
             }
+            rejectPacket(counters, nb_packets, size);
+            return -1;
+        }
+        // 先发布统计再入队, 保证任何时候读到的出队数不会超过入队数
+        if(0 == counters.push_local.packets) {
+            counters.first_pts = pkt->pts;
         }
-        queue_.push(mypkt);     // 一定要push
+        counters.push_local.packets++;      // 包数量
+        counters.push_local.bytes += pkt->size;
+        // 持续时长怎么统计，不是用pkt->duration
+        counters.push_local.pts = pkt->pts;
+        counters.push_local.ts = packetTs(pkt);
+        counters.pushed.Store(counters.push_local);
+        int64_t pkt_size = pkt->size;       // 入队后packet归消费者所有, 不能再访问
+        queue.Push(mypkt);      // 只有本线程入队, 前面检查过不满, 一定成功
+        updateBudget(counters, nb_packets + 1, size + pkt_size);
         return 0;
     }
 
@@ -115,42 +259,18 @@ public:
             LogError("pkt is null");
             return -1;
         }
-        std::unique_lock<std::mutex> lock(mutex_);
         if(abort_request_) {
             LogWarn("abort request");
             return -1;
         }
-        if(queue_.empty()) {        // 等待唤醒
-            // return如果返回false，继续wait, 如果返回true退出wait
-            cond_.wait(lock, [this] {
-                return !queue_.empty() | abort_request_;
-            });
+        if(frontQueue() == NULL) {      // 等待唤醒
+            waitConsumer(-1);
         }
         if(abort_request_) {
             LogWarn("abort request");
             return -1;
         }
-        // 真正干活
-        MyAVPacket *mypkt = queue_.front(); //读取队列首部元素，这里还没有真正出队列
-        *pkt        = mypkt->pkt;
-        media_type  = mypkt->media_type;
-
-        if(E_AUDIO_TYPE == media_type) {
-            stats_.audio_nb_packets--;      // 包数量
-            stats_.audio_size -= mypkt->pkt->size;
-            // 持续时长怎么统计，不是用pkt->duration
-            audio_front_pts_ = mypkt->pkt->pts;
-        }
-        if(E_VIDEO_TYPE == media_type) {
-            stats_.video_nb_packets--;      // 包数量
-            stats_.video_size -= mypkt->pkt->size;
-            // 持续时长怎么统计，不是用pkt->duration
-            video_front_pts_ = mypkt->pkt->pts;
-        }
-
-        queue_.pop();
-        free(mypkt);
-
+        popPrivate(pkt, media_type);
         return 1;
     }
     // 带超时时间
@@ -161,198 +281,564 @@ public:
             return Pop(pkt, media_type);
         }
 
-        std::unique_lock<std::mutex> lock(mutex_);
         if(abort_request_) {
             LogWarn("abort request");
             return -1;
         }
-        
-        if(queue_.empty()) {        // 等待唤醒
-            // return如果返回false，继续wait, 如果返回true退出wait
-            cond_.wait_for(lock, std::chrono::milliseconds(timeout), [this] {
-                return !queue_.empty() | abort_request_; //如果不处于中断情况，队列为空则返回false然后在这等待   谓词返回true时退出wait并且加锁
-            });
+
+        if(frontQueue() == NULL) {      // 等待唤醒
+            waitConsumer(timeout);
         }
-        
+
         if(abort_request_) {//中断
             LogWarn("abort request");
             return -1;
         }
-        
-        if(queue_.empty()) {//空队列
+
+        if(!popPrivate(pkt, media_type)) {//空队列
             return 0;
         }
-        
-        // 真正干活
-        MyAVPacket *mypkt = queue_.front(); //读取队列首部元素，这里还没有真正出队列
-        *pkt        = mypkt->pkt;
-        media_type  = mypkt->media_type;
-
-        if(E_AUDIO_TYPE == media_type) {
-            stats_.audio_nb_packets--;      // 包数量
-            stats_.audio_size -= mypkt->pkt->size;
-            // 持续时长怎么统计，不是用pkt->duration
-            audio_front_pts_ = mypkt->pkt->pts;
+        return 1;
+    }
+    // 按时间戳交织出队: 音视频两个队列都有包时总是先取时间戳小的;
+    // 只有一路有包时, 最多等待另一路window毫秒(从该包入队开始算), 超时后直接取出
+    // 另一路从来没有入过包, 或者另一路最后入队的时间戳已经不小于该包时, 不需要等待
+    // 返回值: -1 abort;  0  没有消息； 1有消息
+    int PopInterleaved(AVPacket **pkt, MediaType &media_type, int timeout, int window)
+    {
+        if(abort_request_) {
+            LogWarn("abort request");
+            return -1;
         }
-
-        if(E_VIDEO_TYPE == media_type) {
-            stats_.video_nb_packets--;      // 包数量
-            stats_.video_size -= mypkt->pkt->size;
-            // 持续时长怎么统计，不是用pkt->duration
-            video_front_pts_ = mypkt->pkt->pts;
+        if(frontQueue() == NULL) {      // 等待唤醒
+            waitConsumer(timeout);
+        }
+        while(true) {
+            if(abort_request_) {
+                LogWarn("abort request");
+                return -1;
+            }
+            SpscQueue<MyAVPacket> *queue = NULL;
+            SpscQueue<MyAVPacket> *other_queue = NULL;
+            int64_t wait_time = 0;
+            int ret = interleavedQueue(window, &queue, &other_queue, &wait_time);
+            if(0 == ret) {
+                return 0;
+            }
+            if(2 == ret) {
+                waitConsumer((int)wait_time, other_queue);
+                if(other_queue->Front() != NULL) {
+                    continue;       // 另一路来包了, 重新比较
+                }
+                // 另一路等待超时
+            }
+            popQueue(queue, pkt, media_type);
+            return 1;
         }
-
-        queue_.pop();
-        free(mypkt);
-        return 1;
+    }
+    // 批量出队: 最多等待max_wait毫秒拿到第一个包, 然后不再等待, 把已经就绪的包一次取完
+    // window > 0 时按PopInterleaved的规则交织, 遇到需要等待另一路的情况就结束本批
+    // pkts/media_types至少要有max_packets个元素; enqueue_times不为NULL时返回每个包的入队时间(us, 单调时钟)
+    // 返回值: -1 abort;  0  没有消息； >0 取到的包数
+    int PopBatch(AVPacket **pkts, MediaType *media_types, int max_packets, int max_wait, int window = 0,
+                 int64_t *enqueue_times = NULL)
+    {
+        if(!pkts || !media_types || max_packets <= 0) {
+            LogError("invalid params");
+            return -1;
+        }
+        int ret = window > 0 ? PopInterleaved(&pkts[0], media_types[0], max_wait, window)
+                             : PopWithTimeout(&pkts[0], media_types[0], max_wait);
+        if(ret != 1) {
+            return ret;
+        }
+        if(enqueue_times) {
+            enqueue_times[0] = pop_enqueue_time_;
+        }
+        int count = 1;
+        while(count < max_packets && !abort_request_) {
+            if(window > 0) {
+                SpscQueue<MyAVPacket> *queue = NULL;
+                SpscQueue<MyAVPacket> *other_queue = NULL;
+                int64_t wait_time = 0;
+                if(interleavedQueue(window, &queue, &other_queue, &wait_time) != 1) {
+                    break;
+                }
+                popQueue(queue, &pkts[count], media_types[count]);
+            } else if(!popPrivate(&pkts[count], media_types[count])) {
+                break;
+            }
+            if(enqueue_times) {
+                enqueue_times[count] = pop_enqueue_time_;
+            }
+            count++;
+        }
+        return count;
     }
     bool Empty()
     {
-        std::lock_guard<std::mutex> lock(mutex_);
-        return queue_.empty();
+        return audio_queue_.Empty() && video_queue_.Empty();
     }
     // 唤醒在等待的线程
     void Abort()
     {
-        std::lock_guard<std::mutex> lock(mutex_);
         abort_request_ = true;
+        std::lock_guard<std::mutex> lock(mutex_);
         cond_.notify_all();
     }
     // all为true:清空队列;
-    // all为false: drop数据，直到遇到I帧, 最大保留remain_max_duration时长;
-    int Drop(bool all, int64_t remain_max_duration)
+    // all为false: 按优先级丢包, 使音视频最大保留remain_max_duration时长:
+    //   1. 视频非参考帧(AV_PKT_FLAG_DISPOSABLE), 从最旧的开始丢
+    //   2. 队首的整个GOP, 只有后面还有I帧时才丢, 保证剩下的视频可以解码
+    //   3. 音频, 视频也超限并且还有可丢的时, 音频积压超过2倍remain_max_duration才丢; 否则超限就丢
+    // 这里的时长按 包数*帧时长 估算(GetQueuedDuration), 不受pts回绕影响, 丢掉中间的帧也能体现出来
+    // 调用者判断是否需要丢包时也要用GetQueuedDuration, 否则可能触发了却什么都不丢
+    // result不为NULL时返回本次丢包的结果
+    // 只能在消费线程调用
+    int Drop(bool all, int64_t remain_max_duration, PacketDropResult *result = NULL)
     {
-        std::lock_guard<std::mutex> lock(mutex_);
-        while (!queue_.empty()) {
-            MyAVPacket *mypkt = queue_.front();
-            //I帧
-            if(!all && mypkt->media_type == E_VIDEO_TYPE && (mypkt->pkt->flags &AV_PKT_FLAG_KEY)) {
-                int64_t duration = video_back_pts_ - video_front_pts_;  //以pts为准
-                // 也参考帧（包）持续 *帧(包)数
-                if(duration < 0     // pts回绕
-                        || duration > video_frame_duration_ * stats_.video_nb_packets * 2) {
-                    duration =  video_frame_duration_ * stats_.video_nb_packets;
-                }
-                LogInfo("video duration:%lld", duration);
-                if(duration <= remain_max_duration)
-                    break;          // 说明可以break 退出while
-            }
-            
-            //音频帧
-            if(E_AUDIO_TYPE == mypkt->media_type) {
-                stats_.audio_nb_packets--;      // 包数量
-                stats_.audio_size -= mypkt->pkt->size;
-                // 持续时长怎么统计，不是用pkt->duration
-                audio_front_pts_ = mypkt->pkt->pts;
+        PacketDropResult drop;
+        memset(&drop, 0, sizeof(PacketDropResult));
+        if(all) {
+            AVPacket *pkt = NULL;
+            MediaType media_type;
+            while(popPrivate(&pkt, media_type)) {
+                PacketPool::GetInstance()->Free(&pkt);
             }
-            
-            //P、B帧
-            if(E_VIDEO_TYPE == mypkt->media_type) {
-                stats_.video_nb_packets--;      // 包数量
-                stats_.video_size -= mypkt->pkt->size;
-                // 持续时长怎么统计，不是用pkt->duration
-                video_front_pts_ = mypkt->pkt->pts;
-                printf("drop P 帧\n");
+        } else {
+            dropDisposable(remain_max_duration, &drop);
+            dropGop(remain_max_duration, &drop);
+            dropAudio(remain_max_duration, &drop);
+            if(drop.reasons != E_DROP_NONE) {
+                drop_local_.times++;
+                drop_local_.disposable_packets += drop.disposable_packets;
+                drop_local_.gops += drop.gops;
+                drop_local_.gop_packets += drop.gop_packets;
+                drop_local_.audio_packets += drop.audio_packets;
+                drop_local_.bytes += drop.bytes;
+                drop_local_.last_reasons = drop.reasons;
+                drop_counters_.Store(drop_local_);
             }
-            
-            av_packet_free(&mypkt->pkt);        // 先释放AVPacket
-            queue_.pop();
-            free(mypkt);                        // 再释放MyAVPacket
         }
-
+        drop.audio_duration = queuedDuration(E_AUDIO_TYPE);
+        drop.video_duration = queuedDuration(E_VIDEO_TYPE);
+        if(result) {
+            *result = drop;
+        }
         return 0;
     }
+    // 按 包数*帧时长 估算的队列时长, 和Drop用的是同一个口径
+    int64_t GetQueuedDuration(MediaType media_type)
+    {
+        return queuedDuration(media_type);
+    }
     // 获取音频持续时间
     int64_t GetAudioDuration()
     {
-        std::lock_guard<std::mutex> lock(mutex_);
-        int64_t duration = audio_back_pts_ - audio_front_pts_;  //以pts为准
-        // 也参考帧（包）持续 *帧(包)数
-        if(duration < 0     // pts回绕
-                || duration > audio_frame_duration_ * stats_.audio_nb_packets * 2) {
-            duration =  audio_frame_duration_ * stats_.audio_nb_packets;
-        } else {
-            duration += audio_frame_duration_;
-        }
-        return duration;
+        MediaSnapshot audio = loadSnapshot(audio_counters_);
+        return getDuration(audio.back_pts, audio.front_pts, audio_frame_duration_, audio.nb_packets);
     }
     // 获取视频持续时间
     int64_t GetVideoDuration()
     {
-        std::lock_guard<std::mutex> lock(mutex_);
-        int64_t duration = video_back_pts_ - video_front_pts_;  //以pts为准
-        // 也参考帧（包）持续 *帧(包)数
-        if(duration < 0     // pts回绕
-                || duration > video_frame_duration_ * stats_.video_nb_packets * 2) {
-            duration =  video_frame_duration_ * stats_.video_nb_packets;
-        }else {
-            duration += video_frame_duration_;
-        }
-        return duration;
+        MediaSnapshot video = loadSnapshot(video_counters_);
+        return getDuration(video.back_pts, video.front_pts, video_frame_duration_, video.nb_packets);
     }
     // 获取音频包数量
     int GetAudioPackets()
     {
-        std::lock_guard<std::mutex> lock(mutex_);
-        return stats_.audio_nb_packets;
+        return loadSnapshot(audio_counters_).nb_packets;
     }
     // 获取视频包数量
     int GetVideoPackets()
     {
-        std::lock_guard<std::mutex> lock(mutex_);
-        return stats_.video_nb_packets;
+        return loadSnapshot(video_counters_).nb_packets;
     }
 
+    // 读取的是顺序锁快照, 不加锁, 不会阻塞生产者
     void GetStats(PacketQueueStats *stats)
     {
         if(!stats) {
             LogError("stats is null");
             return;
         }
-        std::lock_guard<std::mutex> lock(mutex_);
+        MediaSnapshot audio = loadSnapshot(audio_counters_);
+        MediaSnapshot video = loadSnapshot(video_counters_);
+        stats->audio_duration = getDuration(audio.back_pts, audio.front_pts, audio_frame_duration_, audio.nb_packets);
+        stats->video_duration = getDuration(video.back_pts, video.front_pts, video_frame_duration_, video.nb_packets);
+        stats->audio_nb_packets = audio.nb_packets;
+        stats->video_nb_packets = video.nb_packets;
+        stats->audio_size = audio.size;
+        stats->video_size = video.size;
+        stats->audio_front_pts = audio.front_pts;
+        stats->audio_back_pts = audio.back_pts;
+        stats->video_front_pts = video.front_pts;
+        stats->video_back_pts = video.back_pts;
+        DropCounters drop = drop_counters_.Load();
+        stats->drop_times = (int)drop.times;
+        stats->drop_disposable_packets = (int)drop.disposable_packets;
+        stats->drop_gops = (int)drop.gops;
+        stats->drop_gop_packets = (int)drop.gop_packets;
+        stats->drop_audio_packets = (int)drop.audio_packets;
+        stats->drop_bytes = drop.bytes;
+        stats->last_drop_reasons = (int)drop.last_reasons;
+        BudgetCounters audio_budget = audio_counters_.budget.Load();
+        stats->audio_max_nb_packets = (int)audio_budget.max_nb_packets;
+        stats->audio_max_size = (int)audio_budget.max_size;
+        stats->audio_rejected_packets = (int)audio_budget.rejected_packets;
+        loadPressure(audio_counters_, &stats->audio_backpressure, &stats->audio_over_budget_time);
+        BudgetCounters video_budget = video_counters_.budget.Load();
+        stats->video_max_nb_packets = (int)video_budget.max_nb_packets;
+        stats->video_max_size = (int)video_budget.max_size;
+        stats->video_rejected_packets = (int)video_budget.rejected_packets;
+        loadPressure(video_counters_, &stats->video_backpressure, &stats->video_over_budget_time);
+    }
+private:
+    // 音视频两个队列中序号最小的那个队首所在的队列, 都为空返回NULL
+    SpscQueue<MyAVPacket> *frontQueue()
+    {
+        MyAVPacket *audio = audio_queue_.Front();
+        MyAVPacket *video = video_queue_.Front();
+        if(audio && video) {
+            return audio->seq < video->seq ? &audio_queue_ : &video_queue_;
+        }
+        if(audio) {
+            return &audio_queue_;
+        }
+        if(video) {
+            return &video_queue_;
+        }
+        return NULL;
+    }
+    // 返回false说明队列为空
+    bool popPrivate(AVPacket **pkt, MediaType &media_type)
+    {
+        SpscQueue<MyAVPacket> *queue = frontQueue();
+        if(!queue) {
+            return false;
+        }
+        popQueue(queue, pkt, media_type);
+        return true;
+    }
+    // 从指定队列出队并更新统计, 调用前需确认队列不为空
+    void popQueue(SpscQueue<MyAVPacket> *queue, AVPacket **pkt, MediaType &media_type)
+    {
+        // 真正干活
+        MyAVPacket mypkt;
+        queue->Pop(&mypkt);
+        *pkt        = mypkt.pkt;
+        media_type  = mypkt.media_type;
+        pop_enqueue_time_ = mypkt.enqueue_time;
 
-        int64_t audio_duration = audio_back_pts_ - audio_front_pts_;  //以pts为准
-        // 也参考帧（包）持续 *帧(包)数
-        if(audio_duration < 0     // pts回绕
-                || audio_duration > audio_frame_duration_ * stats_.audio_nb_packets * 2) { //audio_duration > audio_frame_duration_ * stats_.audio_nb_packets * 2为经验值来的
-            audio_duration =  audio_frame_duration_ * stats_.audio_nb_packets;
-        }else {
-            audio_duration += audio_frame_duration_;
+        MediaCounters &counters = E_AUDIO_TYPE == media_type ? audio_counters_ : video_counters_;
+        counters.pop_local.packets++;      // 包数量
+        counters.pop_local.bytes += mypkt.pkt->size;
+        // 持续时长怎么统计，不是用pkt->duration
+        counters.pop_local.pts = mypkt.pkt->pts;
+        counters.pop_local.ts = packetTs(mypkt.pkt);
+        counters.popped.Store(counters.pop_local);
+        updatePressure(counters, false);
+    }
+    // 当前队列中的包数、字节数以及首尾pts
+    typedef struct media_snapshot
+    {
+        int nb_packets;
+        int size;
+        int64_t front_pts;
+        int64_t back_pts;
+    }MediaSnapshot;
+    MediaSnapshot loadSnapshot(const MediaCounters &counters)
+    {
+        // 先读出队再读入队, 保证包数不会为负; 读入队期间出队计数变了就重读,
+        // 否则读线程在两次Load之间被切走时, 入队数比出队数新太多, 包数会超过队列容量
+        QueueCounters popped;
+        QueueCounters pushed;
+        int64_t popped_packets;
+        do {
+            popped = counters.popped.Load();
+            pushed = counters.pushed.Load();
+            popped_packets = counters.popped.Load().packets;
+        } while(popped_packets != popped.packets);
+        MediaSnapshot snapshot;
+        snapshot.nb_packets = (int)(pushed.packets - popped.packets);
+        snapshot.size = (int)(pushed.bytes - popped.bytes);
+        snapshot.front_pts = popped.packets > 0 ? popped.pts : counters.first_pts.load();
+        snapshot.back_pts = pushed.pts;
+        return snapshot;
+    }
+    // 交织出队时选择下一个要出队的队列
+    // 返回值: 0 两路都为空; 1 *queue可以直接出队; 2 只有*queue有包, 需要等待*other_queue最多*wait_time毫秒
+    int interleavedQueue(int window, SpscQueue<MyAVPacket> **queue,
+                         SpscQueue<MyAVPacket> **other_queue, int64_t *wait_time)
+    {
+        MyAVPacket *audio = audio_queue_.Front();
+        MyAVPacket *video = video_queue_.Front();
+        if(!audio && !video) {
+            return 0;
+        }
+        if(audio && video) {        // 两路都有, 取时间戳小的
+            *queue = packetTs(video->pkt) < packetTs(audio->pkt) ? &video_queue_ : &audio_queue_;
+            return 1;
+        }
+        // 只有一路有包
+        MyAVPacket *head = audio ? audio : video;
+        *queue = audio ? &audio_queue_ : &video_queue_;
+        *other_queue = audio ? &video_queue_ : &audio_queue_;
+        QueueCounters other_pushed = (audio ? video_counters_ : audio_counters_).pushed.Load();
+        bool other_started = other_pushed.packets > 0;
+        int64_t other_back_ts = other_pushed.ts;     // 有B帧时pts比dts大, 要和队头一样用packetTs比较
+        *wait_time = (head->enqueue_time + window * 1000LL - TimesUtil::GetTimeMicrosecond() + 999) / 1000;
+        if(!other_started || other_back_ts >= packetTs(head->pkt) || *wait_time <= 0) {
+            return 1;
+        }
+        return 2;
+    }
+    // 交织用的时间戳, 优先用dts
+    static int64_t packetTs(const AVPacket *pkt)
+    {
+        return pkt->dts != AV_NOPTS_VALUE ? pkt->dts : pkt->pts;
+    }
+    int64_t getDuration(int64_t back_pts, int64_t front_pts, double frame_duration, int nb_packets)
+    {
+        int64_t duration = back_pts - front_pts;  //以pts为准
+        if(duration < 0) {
+            duration += 0xffffffff;     // AVPublishTime的pts按0xffffffff回绕
         }
-        int64_t video_duration = video_back_pts_ - video_front_pts_;  //以pts为准
         // 也参考帧（包）持续 *帧(包)数
-        if(video_duration < 0     // pts回绕
-                || video_duration > video_frame_duration_ * stats_.video_nb_packets * 2) {
-            video_duration =  video_frame_duration_ * stats_.video_nb_packets;
-        }else {
-            video_duration += video_frame_duration_;
-        }
-        stats->audio_duration = audio_duration;
-        stats->video_duration = video_duration;
-        stats->audio_nb_packets = stats_.audio_nb_packets;
-        stats->video_nb_packets = stats_.audio_nb_packets;
-        stats->audio_size = stats_.audio_size;
-        stats->video_size = stats_.video_size;
+        if(duration < 0
+                || duration > frame_duration * nb_packets * 2) { //duration > frame_duration * nb_packets * 2为经验值来的
+            duration =  frame_duration * nb_packets;
+        } else {
+            duration += frame_duration;
+        }
+        return duration;
+    }
+    // 生产者入队后更新高水位和背压状态
+    void updateBudget(MediaCounters &counters, int64_t nb_packets, int64_t size)
+    {
+        BudgetCounters &budget = counters.budget_local;
+        if(nb_packets > budget.max_nb_packets) {
+            budget.max_nb_packets = nb_packets;
+        }
+        if(size > budget.max_size) {
+            budget.max_size = size;
+        }
+        counters.budget.Store(budget);
+        updatePressure(counters, true);
+    }
+    // 当前占预算的百分比, 取包数和字节数中较高的那个; 没有预算返回-1
+    // producer为true时在生产者线程调用, 否则在消费者线程调用, 各自用自己的本地计数, 读到的总是最新的占用
+    int64_t budgetPercent(MediaCounters &counters, bool producer)
+    {
+        if(counters.max_packets <= 0 && counters.max_bytes <= 0) {
+            return -1;
+        }
+        QueueCounters pushed = producer ? counters.push_local : counters.pushed.Load();
+        QueueCounters popped = producer ? counters.popped.Load() : counters.pop_local;
+        int64_t nb_packets = pushed.packets - popped.packets;
+        int64_t size = pushed.bytes - popped.bytes;
+        int64_t percent = 0;
+        if(counters.max_packets > 0) {
+            percent = nb_packets * 100 / counters.max_packets;
+        }
+        if(counters.max_bytes > 0 && size * 100 / counters.max_bytes > percent) {
+            percent = size * 100 / counters.max_bytes;
+        }
+        return percent;
+    }
+    // 入队、出队、丢包之后调用: 达到高水位进入背压, 回落到高水位一半以下清除
+    // 消费者只清除; 加锁后重新计算占用, 生产者和消费者同时判断时不会用过时的占用把状态改回去
+    void updatePressure(MediaCounters &counters, bool producer)
+    {
+        bool pressure = counters.backpressure.load(std::memory_order_relaxed);
+        if(!pressure && !producer) {
+            return;
+        }
+        int64_t percent = budgetPercent(counters, producer);
+        if(pressure ? percent >= high_water_percent_ / 2 : percent < high_water_percent_) {
+            return;     // 大部分情况状态不变, 不加锁
+        }
+        std::lock_guard<std::mutex> lock(counters.pressure_mutex);
+        percent = budgetPercent(counters, producer);
+        int64_t now = TimesUtil::GetTimeMillisecond();
+        if(!counters.backpressure && percent >= high_water_percent_) {
+            counters.over_budget_start = now;
+            counters.backpressure = true;
+        } else if(counters.backpressure && percent < high_water_percent_ / 2) {
+            counters.over_budget_time += now - counters.over_budget_start;
+            counters.over_budget_start = 0;
+            counters.backpressure = false;
+        }
+    }
+    void loadPressure(MediaCounters &counters, int *backpressure, int64_t *over_budget_time)
+    {
+        std::lock_guard<std::mutex> lock(counters.pressure_mutex);
+        *backpressure = counters.backpressure;
+        *over_budget_time = counters.over_budget_time +
+                (counters.over_budget_start > 0 ? TimesUtil::GetTimeMillisecond() - counters.over_budget_start : 0);
+    }
+    void rejectPacket(MediaCounters &counters, int64_t nb_packets, int64_t size)
+    {
+        counters.budget_local.rejected_packets++;
+        updateBudget(counters, nb_packets, size);
+    }
+    // 按 包数*帧时长 估算的队列时长
+    int64_t queuedDuration(MediaType media_type)
+    {
+        if(E_AUDIO_TYPE == media_type) {
+            return (int64_t)(audio_frame_duration_ * loadSnapshot(audio_counters_).nb_packets);
+        }
+        return (int64_t)(video_frame_duration_ * loadSnapshot(video_counters_).nb_packets);
+    }
+    // 丢弃最旧的非参考视频帧, 直到视频时长不超过remain_max_duration
+    void dropDisposable(int64_t remain_max_duration, PacketDropResult *drop)
+    {
+        int64_t excess = queuedDuration(E_VIDEO_TYPE) - remain_max_duration;
+        if(excess <= 0) {
+            return;
+        }
+        // 需要丢弃的帧数, 帧时长未知时丢弃全部非参考帧
+        int need = video_frame_duration_ > 0 ? (int)ceil(excess / video_frame_duration_) :
+                                               loadSnapshot(video_counters_).nb_packets;
+        size_t last_index = 0;      // 最后一个要丢弃的非参考帧的位置
+        int found = 0;
+        MyAVPacket *mypkt = NULL;
+        for(size_t i = 0; found < need && (mypkt = video_queue_.Peek(i)) != NULL; i++) {
+            if(mypkt->pkt->flags & AV_PKT_FLAG_DISPOSABLE) {
+                last_index = i;
+                found++;
+            }
+        }
+        if(found == 0) {
+            return;
+        }
+        video_queue_.RemoveIf([this, last_index, drop](MyAVPacket &item, size_t index) {
+            if(index > last_index || !(item.pkt->flags & AV_PKT_FLAG_DISPOSABLE)) {
+                return false;
+            }
+            video_counters_.pop_local.packets++;
+            video_counters_.pop_local.bytes += item.pkt->size;
+            drop->disposable_packets++;
+            drop->bytes += item.pkt->size;
+            PacketPool::GetInstance()->Free(&item.pkt);
+            return true;
+        });
+        video_counters_.popped.Store(video_counters_.pop_local);
+        updatePressure(video_counters_, false);
+        drop->reasons |= E_DROP_DISPOSABLE;
+    }
+    // 视频队列中队首之后第一个I帧的位置, 没有返回0
+    size_t nextKeyFrameIndex()
+    {
+        MyAVPacket *mypkt = NULL;
+        for(size_t i = 1; (mypkt = video_queue_.Peek(i)) != NULL; i++) {
+            if(mypkt->pkt->flags & AV_PKT_FLAG_KEY) {
+                return i;
+            }
+        }
+        return 0;
+    }
+    // 丢弃队首的整个GOP, 直到视频时长不超过remain_max_duration或者后面没有I帧
+    void dropGop(int64_t remain_max_duration, PacketDropResult *drop)
+    {
+        while(queuedDuration(E_VIDEO_TYPE) > remain_max_duration) {
+            size_t key_index = nextKeyFrameIndex();
+            if(0 == key_index) {
+                break;      // 没有下一个I帧, 丢了后面的帧就无法解码
+            }
+            for(size_t i = 0; i < key_index; i++) {
+                AVPacket *pkt = NULL;
+                MediaType media_type;
+                popQueue(&video_queue_, &pkt, media_type);
+                drop->gop_packets++;
+                drop->bytes += pkt->size;
+                PacketPool::GetInstance()->Free(&pkt);
+            }
+            drop->gops++;
+            drop->reasons |= E_DROP_GOP;
+        }
+    }
+    // 丢弃最旧的音频, 使音频时长不超过remain_max_duration
+    // 视频也超限并且还有可丢的帧时, 先让视频丢, 音频积压不超过2倍remain_max_duration就先不丢;
+    // 视频没有超限时丢视频对音频积压没有帮助, 音频超限就直接丢
+    void dropAudio(int64_t remain_max_duration, PacketDropResult *drop)
+    {
+        while(queuedDuration(E_AUDIO_TYPE) > remain_max_duration) {
+            if(queuedDuration(E_AUDIO_TYPE) <= remain_max_duration * 2
+                    && queuedDuration(E_VIDEO_TYPE) > remain_max_duration && videoDroppable()) {
+                break;
+            }
+            AVPacket *pkt = NULL;
+            MediaType media_type;
+            popQueue(&audio_queue_, &pkt, media_type);
+            drop->audio_packets++;
+            drop->bytes += pkt->size;
+            PacketPool::GetInstance()->Free(&pkt);
+            drop->reasons |= E_DROP_AUDIO;
+        }
+    }
+    // 视频队列里是否还有可以丢弃的帧
+    bool videoDroppable()
+    {
+        MyAVPacket *mypkt = NULL;
+        for(size_t i = 0; (mypkt = video_queue_.Peek(i)) != NULL; i++) {
+            if(i > 0 && (mypkt->pkt->flags & AV_PKT_FLAG_KEY)) {
+                return true;
+            }
+            if(mypkt->pkt->flags & AV_PKT_FLAG_DISPOSABLE) {
+                return true;
+            }
+        }
+        return false;
+    }
+    // 消费者等待, timeout < 0 一直等待
+    // queue为NULL时任意一路有包即返回, 否则只等待指定的队列
+    void waitConsumer(int timeout, SpscQueue<MyAVPacket> *queue = NULL)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        consumer_waiting_.store(true, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);    // 与wakeupConsumer里的fence配对, 避免丢失唤醒
+        // return如果返回false，继续wait, 如果返回true退出wait
+        if(timeout < 0) {
+            cond_.wait(lock, [this, queue] {
+                return (queue ? queue->Front() != NULL : frontQueue() != NULL) || abort_request_;
+            });
+        } else {
+            cond_.wait_for(lock, std::chrono::milliseconds(timeout), [this, queue] {
+                return (queue ? queue->Front() != NULL : frontQueue() != NULL) || abort_request_;
+            });
+        }
+        consumer_waiting_.store(false, std::memory_order_relaxed);
+    }
+    // 生产者入队后调用, 只有消费者在等待时才加锁通知
+    void wakeupConsumer()
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if(consumer_waiting_.load(std::memory_order_relaxed)) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            cond_.notify_one();
+        }
     }
-private:
-    std::mutex mutex_;
-    std::condition_variable cond_;
-    std::queue<MyAVPacket *> queue_;
 
+    std::mutex mutex_;              // 只用于消费者等待/唤醒
+    std::condition_variable cond_;
+    std::atomic<bool> consumer_waiting_{false};
 
-    bool abort_request_ = false;
+    std::atomic<bool> abort_request_{false};
 
     // 统计相关
-    PacketQueueStats stats_;
+    int high_water_percent_ = 80;
+    MediaCounters audio_counters_;
+    MediaCounters video_counters_;
+    // 丢包统计, 只有消费线程写
+    DropCounters drop_local_ = {0, 0, 0, 0, 0, 0, 0};
+    SeqLock<DropCounters> drop_counters_;
+    int64_t pop_enqueue_time_ = 0;      // 最近一个出队包的入队时间, 只有消费线程读写
     double audio_frame_duration_ = 23.21995649; // 默认23.2ms 44.1khz  1024*1000ms/44100=23.21995649ms
     double video_frame_duration_ = 40;  // 40ms 视频帧率为25的  ， 1000ms/25=40ms
-    // pts记录
-    int64_t audio_front_pts_ = 0;
-    int64_t audio_back_pts_ = 0;
-    int     audio_first_packet = 1;
-    int64_t video_front_pts_ = 0;
-    int64_t video_back_pts_ = 0;
-    int     video_first_packet = 1;
 
+    std::atomic<uint64_t> push_seq_{0};
+    SpscQueue<MyAVPacket> audio_queue_;
+    SpscQueue<MyAVPacket> video_queue_;
 };
 #endif // PACKETQUEUE_H
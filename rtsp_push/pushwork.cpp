@@ -1,10 +1,13 @@
 ﻿#include <functional>
+#include <string.h>
 #include "pushwork.h"
 #include "dlog.h"
 #include "avpublishtime.h"
+#include "events.h"
 
-PushWork::PushWork(MessageQueue *msg_queue)
-    :msg_queue_(msg_queue)
+PushWork::PushWork(EventBus *event_bus, Executor *executor)
+    :event_bus_(event_bus),
+      executor_(executor)
 {
 
 }
@@ -12,12 +15,18 @@ PushWork::PushWork(MessageQueue *msg_queue)
 PushWork::~PushWork()
 {
     // 从源头开始释放资源
-    // 先释放音频、视频捕获
+    // 先释放音频捕获, 视频按 停采集线程 -> 停编码线程并清空帧队列 -> 关摄像头 的顺序
     if(audio_capturer_) {
         delete audio_capturer_;
     }
-    if(video_capturer_) {
-        delete video_capturer_;
+    stopVideo();
+    flushEncoders();
+    drainPusher();
+    if(audio_resampler_) {
+        delete audio_resampler_;
+    }
+    if(audio_fifo_) {
+        delete audio_fifo_;
     }
     if(audio_encoder_) {
         delete audio_encoder_;
@@ -34,6 +43,14 @@ PushWork::~PushWork()
     if(rtsp_pusher_) {
         delete rtsp_pusher_;
     }
+    if(pcm_s16le_fp_) {
+        fclose(pcm_s16le_fp_);
+        pcm_s16le_fp_ = NULL;
+    }
+    if(aac_fp_) {
+        fclose(aac_fp_);
+        aac_fp_ = NULL;
+    }
     if(h264_fp_) {
         fclose(h264_fp_);
         h264_fp_ = NULL;
@@ -47,11 +64,16 @@ RET_CODE PushWork::Init(const Properties &properties)
     // 音频test模式
     audio_test_ = properties.GetProperty("audio_test", 0);
     input_pcm_name_ = properties.GetProperty("input_pcm_name", "input_48k_2ch_s16.pcm");
+    // 调试用的dump, 默认关闭: 采集回调在共用的executor上执行, 每帧写文件会占住线程池
+    save_pcm_ = properties.GetProperty("save_pcm", 0);
+    save_aac_ = properties.GetProperty("save_aac", 0);
 
     // 麦克风采样属性
     mic_sample_rate_ = properties.GetProperty("mic_sample_rate", 48000);
     mic_sample_fmt_ = properties.GetProperty("mic_sample_fmt", AV_SAMPLE_FMT_S16);
     mic_channels_ = properties.GetProperty("mic_channels", 2);
+    mic_nb_samples_ = properties.GetProperty("mic_nb_samples", 1024);
+    audio_drift_compensation_ = properties.GetProperty("audio_drift_compensation", 0);
 
     // 音频编码参数
     audio_sample_rate_ = properties.GetProperty("audio_sample_rate", mic_sample_rate_);
@@ -70,6 +92,7 @@ RET_CODE PushWork::Init(const Properties &properties)
     desktop_height_ = properties.GetProperty("desktop_height", 720);
     desktop_format_ = properties.GetProperty("desktop_pixel_format", AV_PIX_FMT_YUV420P);
     desktop_fps_ = properties.GetProperty("desktop_fps", 25);
+    desktop_convert_slices_ = properties.GetProperty("desktop_convert_slices", 1);
 
     // 视频编码属性
     video_width_  = properties.GetProperty("video_width", desktop_width_);     // 宽
@@ -78,12 +101,26 @@ RET_CODE PushWork::Init(const Properties &properties)
     video_gop_ = properties.GetProperty("video_gop", video_fps_);
     video_bitrate_ = properties.GetProperty("video_bitrate", 1024*1024);   // 先默认1M fixedme
     video_b_frames_ = properties.GetProperty("video_b_frames", 0);   // b帧数量
+    video_threads_ = properties.GetProperty("video_threads", 1);
+    video_thread_type_ = properties.GetProperty("video_thread_type", "slice");
+    video_preset_ = properties.GetProperty("video_preset", "ultrafast");
+    video_tune_ = properties.GetProperty("video_tune", "zerolatency");
+    video_profile_ = properties.GetProperty("video_profile", "baseline");
+    video_rc_lookahead_ = properties.GetProperty("video_rc_lookahead", -1);
+    video_x264_params_ = properties.GetProperty("video_x264_params", "");
+    video_encode_queue_size_ = properties.GetProperty("video_encode_queue_size", 3);
+    video_encode_drop_policy_ = properties.GetProperty("video_encode_drop_policy", "drop_oldest");
 
     //推流设置
     rtsp_url_       = properties.GetProperty("rtsp_url", "");
     rtsp_transport_ = properties.GetProperty("rtsp_transport", "");
     rtsp_timeout_ = properties.GetProperty("rtsp_timeout", 5000);
     rtsp_max_queue_duration_ = properties.GetProperty("rtsp_max_queue_duration", 500);
+    rtsp_interleave_window_ = properties.GetProperty("rtsp_interleave_window", 50);
+    rtsp_audio_max_bytes_ = properties.GetProperty("rtsp_audio_max_bytes", 1024*1024);
+    rtsp_video_max_bytes_ = properties.GetProperty("rtsp_video_max_bytes", 16*1024*1024);
+    rtsp_high_water_percent_ = properties.GetProperty("rtsp_high_water_percent", 80);
+    rtsp_drain_timeout_ = properties.GetProperty("rtsp_drain_timeout", 1000);
 
     // 初始化publish time
     AVPublishTime::GetInstance()->Rest();   // 推流打时间戳的问题
@@ -136,6 +173,45 @@ RET_CODE PushWork::Init(const Properties &properties)
         return RET_FAIL;
     }
 
+    // 采样率、通道数和编码器不同或者需要漂移补偿时, 用swr一次转换成编码器的格式;
+    // 否则只需要交错格式 -> float planar, 用SIMD实现
+    if(mic_sample_rate_ != audio_encoder_->GetSampleRate() || mic_channels_ != audio_encoder_->GetChannels()
+            || audio_drift_compensation_) {
+        audio_resampler_ = new AudioResampler();
+        Properties resampler_properties;
+        resampler_properties.SetProperty("src_sample_fmt", mic_sample_fmt_);
+        resampler_properties.SetProperty("src_sample_rate", mic_sample_rate_);
+        resampler_properties.SetProperty("src_channels", mic_channels_);
+        resampler_properties.SetProperty("dst_sample_fmt", audio_encoder_->GetFormat());
+        resampler_properties.SetProperty("dst_sample_rate", audio_encoder_->GetSampleRate());
+        resampler_properties.SetProperty("dst_channels", audio_encoder_->GetChannels());
+        resampler_properties.SetProperty("compensation", audio_drift_compensation_);
+        if(audio_resampler_->Init(resampler_properties) != RET_OK) {
+            LogError("AudioResampler Init failed");
+            return RET_FAIL;
+        }
+    } else {
+        LogInfo("audio convert simd:%s", SimdLevelName(AudioConvertGetSimdLevel()));
+    }
+
+    // 采集(或者重采样之后)的数据先经过fifo, 每次取出编码器一帧的采样点数
+    audio_fifo_ = new AudioFifo();
+    Properties fifo_properties;
+    if(audio_resampler_) {
+        fifo_properties.SetProperty("sample_fmt", audio_encoder_->GetFormat());
+        fifo_properties.SetProperty("channels", audio_encoder_->GetChannels());
+        fifo_properties.SetProperty("sample_rate", audio_encoder_->GetSampleRate());
+    } else {
+        fifo_properties.SetProperty("sample_fmt", mic_sample_fmt_);
+        fifo_properties.SetProperty("channels", mic_channels_);
+        fifo_properties.SetProperty("sample_rate", mic_sample_rate_);
+    }
+    fifo_properties.SetProperty("frame_samples", audio_encoder_->GetFrameSamples());
+    if(audio_fifo_->Init(fifo_properties) != RET_OK) {
+        LogError("AudioFifo Init failed");
+        return RET_FAIL;
+    }
+
     // 初始化视频编码器
     video_encoder_ = new H264Encoder();
     Properties  vid_codec_properties;
@@ -145,6 +221,13 @@ RET_CODE PushWork::Init(const Properties &properties)
     vid_codec_properties.SetProperty("b_frames", video_b_frames_);
     vid_codec_properties.SetProperty("bitrate", video_bitrate_);    // 码率
     vid_codec_properties.SetProperty("gop", video_gop_);            // gop
+    vid_codec_properties.SetProperty("threads", video_threads_);
+    vid_codec_properties.SetProperty("thread_type", video_thread_type_);
+    vid_codec_properties.SetProperty("preset", video_preset_);
+    vid_codec_properties.SetProperty("tune", video_tune_);
+    vid_codec_properties.SetProperty("profile", video_profile_);
+    vid_codec_properties.SetProperty("rc_lookahead", video_rc_lookahead_);
+    vid_codec_properties.SetProperty("x264_params", video_x264_params_);
     if(video_encoder_->Init(vid_codec_properties) != RET_OK)
     {
         LogError("H264Encoder Init failed");
@@ -152,7 +235,7 @@ RET_CODE PushWork::Init(const Properties &properties)
     }
 
     // 在音视频编码器初始化完， 音视频捕获前
-    rtsp_pusher_ =new RtspPusher(msg_queue_);
+    rtsp_pusher_ =new RtspPusher(event_bus_);
     if(!rtsp_pusher_) {
         LogError("new RTSPPusher() failed");
         return RET_FAIL;
@@ -163,6 +246,11 @@ RET_CODE PushWork::Init(const Properties &properties)
     rtsp_properties.SetProperty("timeout", rtsp_timeout_);//超时时长
     rtsp_properties.SetProperty("rtsp_transport", rtsp_transport_);//UDP还是TCP
     rtsp_properties.SetProperty("max_queue_duration", rtsp_max_queue_duration_);//最大帧队列
+    rtsp_properties.SetProperty("interleave_window", rtsp_interleave_window_);//音视频交织等待窗口
+    rtsp_properties.SetProperty("audio_max_bytes", rtsp_audio_max_bytes_);//音频队列内存预算
+    rtsp_properties.SetProperty("video_max_bytes", rtsp_video_max_bytes_);//视频队列内存预算
+    rtsp_properties.SetProperty("high_water_percent", rtsp_high_water_percent_);//背压高水位
+    copyThreadProperties(properties, "rtsp_pusher_thread", rtsp_properties);//推流线程的调度属性
 
     int audio_frame_samples=audio_encoder_->GetFrameSamples();
     int audio_sample_rate=audio_encoder_->GetSampleRate();
@@ -209,10 +297,12 @@ RET_CODE PushWork::Init(const Properties &properties)
     Properties aud_cap_properties;
     aud_cap_properties.SetProperty("audio_test", 1);
     aud_cap_properties.SetProperty("input_pcm_name", input_pcm_name_);
+    aud_cap_properties.SetProperty("sample_rate", mic_sample_rate_);
     aud_cap_properties.SetProperty("channels", mic_channels_);
-    aud_cap_properties.SetProperty("nb_samples", 1024);     // 由编码器提供 // fix me
+    aud_cap_properties.SetProperty("nb_samples", mic_nb_samples_);  // 采集周期, 由audio_fifo_凑成编码器的帧长
     aud_cap_properties.SetProperty("format", mic_sample_fmt_);
-    aud_cap_properties.SetProperty("byte_per_sample", 2);   // fix me
+    aud_cap_properties.SetProperty("byte_per_sample", av_get_bytes_per_sample((AVSampleFormat)mic_sample_fmt_));
+    copyThreadProperties(properties, "audio_capture_thread", aud_cap_properties);
     if(audio_capturer_->Init(aud_cap_properties) != RET_OK) //初始化读取音频设备的参数  并且 打开读取音频文件
     {
         LogError("AudioCapturer Init failed");
@@ -220,13 +310,48 @@ RET_CODE PushWork::Init(const Properties &properties)
     }
 
     //音频线程的回调函数
+    audio_capturer_->SetEventBus(event_bus_);
     audio_capturer_->AddCallback(std::bind(&PushWork::PcmCallback, this, std::placeholders::_1,
                                            std::placeholders::_2));
 
-    // if(audio_capturer_->Start()!= RET_OK) {   //开启读取音频线程
-    //     LogError("AudioCapturer Start failed");
-    //     return RET_FAIL;
-    // }
+    // dump文件在这里打开, 回调里只写
+    if(save_pcm_) {
+        pcm_s16le_fp_ = fopen("push_dump_s16le.pcm", "wb");
+        if(!pcm_s16le_fp_) {
+            LogError("fopen push_dump_s16le.pcm failed");
+        }
+    }
+    if(save_aac_) {
+        aac_fp_ = fopen("push_dump.aac", "wb");//存储编码好的aac音频文件
+        if(!aac_fp_) {
+            LogError("fopen push_dump.aac failed");
+        }
+    }
+    // 启动后音频和视频一起编码推流
+    if(audio_capturer_->Start(executor_)!= RET_OK) {   //开启读取音频线程, executor_为NULL时用独立线程
+        LogError("AudioCapturer Start failed");
+        return RET_FAIL;
+    }
+
+    // 编码线程先于采集启动, 采集线程只把帧放进队列
+    if(video_encode_queue_size_ > 0) {
+        video_encode_looper_ = new VideoEncodeLooper();
+        Properties vid_enc_properties;
+        vid_enc_properties.SetProperty("queue_size", video_encode_queue_size_);
+        vid_enc_properties.SetProperty("drop_policy", video_encode_drop_policy_);
+        copyThreadProperties(properties, "video_encode_thread", vid_enc_properties);
+        if(video_encode_looper_->Init(vid_enc_properties) != RET_OK) {
+            LogError("VideoEncodeLooper Init failed");
+            return RET_FAIL;
+        }
+        video_encode_looper_->AddCallback(std::bind(&PushWork::encodeYuvFrame, this,
+                                                    std::placeholders::_1,
+                                                    std::placeholders::_2));
+        if(video_encode_looper_->Start() != RET_OK) {
+            LogError("VideoEncodeLooper Start failed");
+            return RET_FAIL;
+        }
+    }
 
     video_capturer_ = new VideoCapturer();
     Properties  vid_cap_properties;
@@ -234,6 +359,12 @@ RET_CODE PushWork::Init(const Properties &properties)
     vid_cap_properties.SetProperty("input_yuv_name", input_yuv_name_);
     vid_cap_properties.SetProperty("width", desktop_width_);
     vid_cap_properties.SetProperty("height", desktop_height_);
+    vid_cap_properties.SetProperty("convert_slices", desktop_convert_slices_);
+    // 采集直接输出编码器的输入格式, 设备能给出这个格式时不用转换
+    vid_cap_properties.SetProperty("pixel_format", video_encoder_->GetCodecContext()->pix_fmt);
+    copyThreadProperties(properties, "video_capture_thread", vid_cap_properties);
+    video_capturer_->SetEventBus(event_bus_);
+    video_capturer_->SetExecutor(executor_);    // Init里按有没有executor选择NV12的转换方式
     if(video_capturer_->Init(vid_cap_properties) != RET_OK)//初始化读取视频设备的参数  并且 打开读取视频文件
     {
         LogError("VideoCapturer Init failed");
@@ -260,36 +391,71 @@ RET_CODE PushWork::DeInit()
         delete audio_capturer_;
         audio_capturer_ = NULL;
     }
-    if(video_capturer_){
-        video_capturer_->Stop();
-        delete video_capturer_;
-        video_capturer_ = NULL;
-    }
+    stopVideo();
+    flushEncoders();
+    drainPusher();
+    return RET_OK;
 }
-// 只支持2通道 s16交错模式 -> float planar格式
-void s16le_convert_to_fltp(short *s16le, float *fltp, int nb_samples) {
-    float *fltp_l = fltp;   // -1~1
-    float *fltp_r = fltp + nb_samples;
-    for(int i = 0; i < nb_samples; i++) {
-        fltp_l[i] = s16le[i*2]/32768.0;     // 0 2 4
-        fltp_r[i] = s16le[i*2+1]/32768.0;   // 1 3 5
+
+void PushWork::stopVideo()
+{
+    // 直通的帧引用的是v4l2 mmap的缓冲区, 帧队列里的帧必须在关摄像头(munmap)之前释放
+    if(video_capturer_) {
+        video_capturer_->Stop();    // 只停采集线程, 不再往帧队列里放
+    }
+    if(video_encode_looper_) {
+        delete video_encode_looper_;    // 析构里停编码线程并释放队列里剩下的帧
+        video_encode_looper_ = NULL;
+    }
+    if(video_capturer_) {
+        delete video_capturer_;     // 关摄像头
+        video_capturer_ = NULL;
     }
 }
 void PushWork::PcmCallback(uint8_t *pcm, int32_t size)
 {
-    int ret = 0;
-    if(!pcm_s16le_fp_)
-    {
-        pcm_s16le_fp_ = fopen("push_dump_s16le.pcm", "wb");
-    }
-    if(pcm_s16le_fp_)
+    if(pcm_s16le_fp_)   // save_pcm打开时才有
     {
         // ffplay -ar 48000 -channels 2 -f s16le  -i push_dump_s16le.pcm
-        fwrite(pcm, 1, size, pcm_s16le_fp_);
-        fflush(pcm_s16le_fp_);//确保数据立即被写入文件，而不是等到缓冲区满了或者文件被关闭。
+        fwrite(pcm, 1, size, pcm_s16le_fp_);    // 不每帧fflush, 关闭文件时写完
+    }
+    // 采集的采样点数可以和编码器一帧的不同, 由audio_fifo_凑够一帧再编码
+    int nb_samples = size / (av_get_bytes_per_sample((AVSampleFormat)mic_sample_fmt_) * mic_channels_);
+    int64_t pts = AVPublishTime::GetInstance()->getCurrenTime();
+    uint8_t *data[AV_NUM_DATA_POINTERS] = { pcm };
+    uint8_t **samples = data;
+    if(audio_resampler_) {
+        nb_samples = audio_resampler_->Convert((const uint8_t **)data, nb_samples, pts, &samples, &pts);
+        if(nb_samples < 0) {
+            LogError("audio_resampler_ Convert failed");
+            return;
+        }
+    }
+    if(audio_fifo_->Push(samples, nb_samples, pts,
+                         std::bind(&PushWork::encodePcmFrame, this, std::placeholders::_1,
+                                   std::placeholders::_2)) != RET_OK) {
+        LogError("audio_fifo_ Push failed");
+    }
+}
+
+void PushWork::encodePcmFrame(uint8_t **data, int64_t pts)
+{
+    int ret = 0;
+    // fltp_buf_里每个通道一个平面
+    float *planes[AV_NUM_DATA_POINTERS];
+    for(int i = 0; i < audio_frame_->channels; i++) {
+        planes[i] = (float *)fltp_buf_ + i * audio_frame_->nb_samples;
+    }
+    if(audio_resampler_) {
+        // 重采样之后已经是编码器的格式
+        for(int i = 0; i < audio_frame_->channels; i++) {
+            memcpy(planes[i], data[i], audio_frame_->nb_samples * sizeof(float));
+        }
+    } else if(AudioConvertToFltp(data[0], (AVSampleFormat)mic_sample_fmt_, mic_channels_,
+                                 audio_frame_->nb_samples, planes) < 0) {    // 交错格式 -> float planar
+        LogError("AudioConvertToFltp failed, sample_fmt:%d", mic_sample_fmt_);
+        return;
     }
-    // 这里就约定好，音频捕获的时候，采样点数和编码器需要的点数是一样的
-    s16le_convert_to_fltp((short *)pcm, (float *)fltp_buf_, audio_frame_->nb_samples);
     ret = av_frame_make_writable(audio_frame_);
     if(ret < 0) {
         LogError("av_frame_make_writable failed");
@@ -308,43 +474,64 @@ void PushWork::PcmCallback(uint8_t *pcm, int32_t size)
         return;
     }
 
-    int64_t pts = (int64_t)AVPublishTime::GetInstance()->get_audio_pts();
-    int pkt_frame = 0;
-    RET_CODE encode_ret = RET_OK;
-    AVPacket *packet = audio_encoder_->Encode(audio_frame_, pts, 0, &pkt_frame, &encode_ret); //0为是否刷新
-    if(encode_ret == RET_OK && packet) {
-        if(!aac_fp_) {
-            aac_fp_ = fopen("push_dump.aac", "wb");//存储编码好的aac音频文件
-            if(!aac_fp_) {
-                LogError("fopen push_dump.aac failed");
-                return;
-            }
-        }
-        if(aac_fp_) {
-            uint8_t adts_header[7];
-            if(audio_encoder_->GetAdtsHeader(adts_header, packet->size) != RET_OK) {
-                LogError("GetAdtsHeader failed");
-                return;
-            }
+    // 编码器有priming延迟, 一帧输入可能输出0个或多个packet, 都交给onAudioPacket
+    RET_CODE encode_ret = audio_encoder_->EncodeFrame(audio_frame_, pts,
+                                                      std::bind(&PushWork::onAudioPacket, this,
+                                                                std::placeholders::_1));
+    if(RET_FAIL == encode_ret) {
+        publishEncodeError(E_AUDIO_TYPE, encode_ret);
+    }
+}
+
+void PushWork::onAudioPacket(AVPacket *packet)
+{
+    if(aac_fp_) {   // save_aac打开时才有
+        uint8_t adts_header[7];
+        if(audio_encoder_->GetAdtsHeader(adts_header, packet->size) == RET_OK) {
             fwrite(adts_header, 1, 7, aac_fp_);
             fwrite(packet->data, 1, packet->size, aac_fp_);
+        } else {
+            LogError("GetAdtsHeader failed");
         }
     }
-    //    LogInfo("PcmCallback pts:%ld", pts);
-    if(packet) {
-//        LogInfo("PcmCallback packet->pts:%ld", packet->pts);
-        rtsp_pusher_->Push(packet, E_AUDIO_TYPE);
-    }else {
-        LogInfo("packet is null");
+    if(rtsp_pusher_->Push(packet, E_AUDIO_TYPE) != RET_OK) {
+        PacketPool::GetInstance()->Free(&packet);    // 队列满或者已经abort, 入队失败需要自己释放
     }
 }
 
+// 把properties里的"path.xxx"以"thread.xxx"的形式拷贝给组件, 由组件交给CommonLooper::SetThreadProperties
+void PushWork::copyThreadProperties(const Properties &properties, const char *path, Properties &dst)
+{
+    Properties children = properties.GetChildren(path);
+    for(Properties::const_iterator it = children.begin(); it != children.end(); ++it) {
+        dst.SetProperty("thread." + it->first, it->second);
+    }
+}
+
+void PushWork::publishEncodeError(MediaType media_type, RET_CODE ret)
+{
+    if(!event_bus_) {
+        return;
+    }
+    EncodeErrorEvent event;
+    event.media_type = media_type;
+    event.error = ret;
+    event_bus_->Publish(event);
+}
+
 void PushWork::YuvCallback(uint8_t *yuv, int32_t size)
 {
+    if(rtsp_pusher_->IsBackpressured(E_VIDEO_TYPE)) {
+        video_skip_frames_++;       // 推流队列积压, 跳过这一帧的编码
+        return;
+    }
     int64_t pts = (int64_t)AVPublishTime::GetInstance()->get_video_pts();
     int pkt_frame = 0;
     RET_CODE encode_ret = RET_OK;
     AVPacket *packet = video_encoder_->Encode(yuv, size, pts, &pkt_frame, &encode_ret);
+    if(RET_FAIL == encode_ret) {
+        publishEncodeError(E_VIDEO_TYPE, encode_ret);
+    }
     if(packet) {
         // 保存H264文件
         if(!h264_fp_) {
@@ -367,40 +554,91 @@ void PushWork::YuvCallback(uint8_t *yuv, int32_t size)
         fwrite(packet->data, 1, packet->size, h264_fp_);
         fflush(h264_fp_);
 
-        rtsp_pusher_->Push(packet, E_VIDEO_TYPE);
+        if(rtsp_pusher_->Push(packet, E_VIDEO_TYPE) != RET_OK) {
+            PacketPool::GetInstance()->Free(&packet);
+            video_encoder_->RequestKeyFrame();  // 队列会一直拒绝P帧直到下一个I帧
+        }
     }
 }
 void PushWork::YuvCallback1(AVFrame *frame, int32_t size) {
+    (void)size;     // 帧的大小由frame自己描述, 参数只是为了和AddCallback1的签名一致
+    if(rtsp_pusher_->IsBackpressured(E_VIDEO_TYPE)) {
+        // 推流队列积压到高水位, 跳过这一帧的编码, 等网络恢复
+        if(video_skip_frames_++ % 25 == 0) {
+            LogWarn("video backpressure, skip frames:%lld", video_skip_frames_);
+        }
+        return;
+    }
+    if(!frame) {
+        return;
+    }
+    // pts按采集的时间打, 不受排队和编码耗时影响
     int64_t pts = (int64_t)AVPublishTime::GetInstance()->get_video_pts();
-    int pkt_frame = 0;
-    RET_CODE encode_ret = RET_OK;
-    
-    if(frame) {
-        AVPacket *packet = video_encoder_->Encode1(frame, size, pts, &pkt_frame, &encode_ret);
-      if(packet) {
-            // 写入编码后的数据
-            if(!h264_fp_) {
-                h264_fp_ = fopen("camera_output.h264", "wb");
-                if(!h264_fp_) {
-                    LogError("Failed to open h264 file");
-                    return;
-                }
-                 // 写入SPS和PPS
-                uint8_t start_code[] = {0, 0, 0, 1};
-                fwrite(start_code, 1, 4, h264_fp_);
-                fwrite(video_encoder_->get_sps_data(), 1, video_encoder_->get_sps_size(), h264_fp_);
-                fwrite(start_code, 1, 4, h264_fp_);
-                fwrite(video_encoder_->get_pps_data(), 1, video_encoder_->get_pps_size(), h264_fp_);
-            }else {
-                uint8_t start_code[] = {0, 0, 0, 1};
-                fwrite(start_code, 1, 4, h264_fp_);
-                fwrite(packet->data, 1, packet->size, h264_fp_);
-                fflush(h264_fp_);
-            }
+    if(video_encode_looper_) {
+        video_encode_looper_->Push(frame, pts);
+    } else {
+        encodeYuvFrame(frame, pts);
+    }
+}
 
-            rtsp_pusher_->Push(packet, E_VIDEO_TYPE);
-        }else {
-                LogError("video packet is null");
-            }   
+void PushWork::encodeYuvFrame(AVFrame *frame, int64_t pts)
+{
+    // 多线程编码和lookahead有延迟, 一帧输入可能输出0个或多个packet, 都交给onVideoPacket
+    RET_CODE encode_ret = video_encoder_->EncodeFrame(frame, pts,
+                                                      std::bind(&PushWork::onVideoPacket, this,
+                                                                std::placeholders::_1));
+    if(RET_FAIL == encode_ret) {
+        publishEncodeError(E_VIDEO_TYPE, encode_ret);
+    }
+}
+
+void PushWork::onVideoPacket(AVPacket *packet)
+{
+    // 写入编码后的数据
+    if(!h264_fp_) {
+        h264_fp_ = fopen("camera_output.h264", "wb");
+        if(!h264_fp_) {
+            LogError("Failed to open h264 file");
+        } else {
+            // 写入SPS和PPS
+            uint8_t start_code[] = {0, 0, 0, 1};
+            fwrite(start_code, 1, 4, h264_fp_);
+            fwrite(video_encoder_->get_sps_data(), 1, video_encoder_->get_sps_size(), h264_fp_);
+            fwrite(start_code, 1, 4, h264_fp_);
+            fwrite(video_encoder_->get_pps_data(), 1, video_encoder_->get_pps_size(), h264_fp_);
+        }
+    }
+    if(h264_fp_) {
+        uint8_t start_code[] = {0, 0, 0, 1};
+        fwrite(start_code, 1, 4, h264_fp_);
+        fwrite(packet->data, 1, packet->size, h264_fp_);
+        fflush(h264_fp_);
+    }
+
+    if(rtsp_pusher_->Push(packet, E_VIDEO_TYPE) != RET_OK) {
+        PacketPool::GetInstance()->Free(&packet);
+        video_encoder_->RequestKeyFrame();  // 队列会一直拒绝P帧直到下一个I帧
+    }
+}
+
+// 采集都停止之后调用, 取出编码器里还缓存着的帧, 推流和dump文件不会丢掉最后几帧
+void PushWork::flushEncoders()
+{
+    if(!rtsp_pusher_) {
+        return;
+    }
+    if(video_encoder_) {
+        video_encoder_->Flush(std::bind(&PushWork::onVideoPacket, this, std::placeholders::_1));
+    }
+    if(audio_encoder_) {
+        audio_encoder_->Flush(std::bind(&PushWork::onAudioPacket, this, std::placeholders::_1));
+    }
+}
+
+// flushEncoders之后调用, 已经没有线程往推流队列里放包了, 等推流线程把队列发完再写trailer
+void PushWork::drainPusher()
+{
+    if(rtsp_pusher_) {
+        rtsp_pusher_->Drain(rtsp_drain_timeout_);
     }
 }
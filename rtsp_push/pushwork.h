@@ -4,10 +4,15 @@
 #include <string>
 #include "audiocapturer.h"
 #include "videocapturer.h"
+#include "videoencodelooper.h"
 #include "aacencoder.h"
 #include "h264encoder.h"
 #include "rtsppusher.h"
-#include "messagequeue.h"
+#include "eventbus.h"
+#include "executor.h"
+#include "audiofifo.h"
+#include "audioconvert.h"
+#include "audioresampler.h"
 extern "C" {
 #include <libavcodec/avcodec.h>
 #include <libswresample/swresample.h>
@@ -18,27 +23,45 @@ extern "C" {
 class PushWork
 {
 public:
-    PushWork(MessageQueue *msg_queue);
+    // executor不为NULL时, 音频采集作为协作任务在共享线程池上运行, 多路推流共用线程
+    // executor由调用者创建, 生命周期要比PushWork长
+    PushWork(EventBus *event_bus, Executor *executor = NULL);
     ~PushWork();
     RET_CODE Init(const Properties &properties);
     RET_CODE DeInit();
 private:
     void PcmCallback(uint8_t *pcm, int32_t size);
+    void encodePcmFrame(uint8_t **data, int64_t pts);   // 编码一帧, pts由audio_fifo_按采样点数推算
+    void onAudioPacket(AVPacket *packet);   // 编码器输出的每个packet: dump并推流
     void YuvCallback(uint8_t* yuv, int32_t size);
     void YuvCallback1(AVFrame* frame, int32_t size);
+    void encodeYuvFrame(AVFrame *frame, int64_t pts);    // 编码一帧并推流, 在编码线程或采集线程调用
+    void onVideoPacket(AVPacket *packet);
+    void stopVideo();       // 停视频采集和编码线程, 最后关摄像头
+    void flushEncoders();
+    void drainPusher();
+    void publishEncodeError(MediaType media_type, RET_CODE ret);
+    static void copyThreadProperties(const Properties &properties, const char *path, Properties &dst);
 private:
     AudioCapturer *audio_capturer_ = NULL;
     // 音频test模式
     int audio_test_ = 0;
     std::string input_pcm_name_;
+    int save_pcm_ = 0;      // dump采集的pcm到push_dump_s16le.pcm
+    int save_aac_ = 0;      // dump编码后的aac到push_dump.aac
     uint8_t *fltp_buf_ = NULL;
     int fltp_buf_size_ = 0;
     // 麦克风采样属性
     int mic_sample_rate_ = 48000;
     int mic_sample_fmt_ = AV_SAMPLE_FMT_S16;
     int mic_channels_ = 2;
+    int mic_nb_samples_ = 1024;     // 采集每次回调的采样点数, 可以和编码器一帧的采样点数不同
+    AudioFifo *audio_fifo_ = NULL;  // 把采集的数据按编码器一帧的采样点数切分
+    // 采样率、通道数和编码器不同或者打开漂移补偿时才创建
+    AudioResampler *audio_resampler_ = NULL;
+    int audio_drift_compensation_ = 0;  // 按系统时钟补偿声卡时钟的漂移
 
-    AACEncoder *audio_encoder_;
+    AACEncoder *audio_encoder_ = NULL;
     // 音频编码参数
     int audio_sample_rate_ = AV_SAMPLE_FMT_S16;
     int audio_bitrate_ = 128*1024;
@@ -57,6 +80,7 @@ private:
     int desktop_height_ = 1080;
     int desktop_format_ = AV_PIX_FMT_YUV420P;
     int desktop_fps_ = 25;
+    int desktop_convert_slices_ = 1;    // 转换成YUV420P分几片并行, 需要executor_
 
     // 视频相关参数
     // 视频编码属性
@@ -66,10 +90,21 @@ private:
     int video_gop_;
     int video_bitrate_;
     int video_b_frames_;   // b帧数量
+    // x264线程和预设, 含义见H264Encoder::Init
+    int video_threads_ = 1;
+    std::string video_thread_type_ = "slice";
+    std::string video_preset_ = "ultrafast";
+    std::string video_tune_ = "zerolatency";
+    std::string video_profile_ = "baseline";
+    int video_rc_lookahead_ = -1;
+    std::string video_x264_params_;
+    int video_encode_queue_size_ = 3;   // 采集到编码的队列长度, 0为在采集线程里直接编码
+    std::string video_encode_drop_policy_ = "drop_oldest";
 
     // 视频相关
     VideoCapturer *video_capturer_ = NULL;
     H264Encoder *video_encoder_ = NULL;
+    VideoEncodeLooper *video_encode_looper_ = NULL;    // 独立的编码线程
 
     // dump 数据
     FILE *pcm_s16le_fp_ = NULL;
@@ -82,8 +117,15 @@ private:
     std::string rtsp_transport_ = "";
     int rtsp_timeout_ = 5000;
     int rtsp_max_queue_duration_ = 500;
+    int rtsp_interleave_window_ = 50;
+    int rtsp_audio_max_bytes_ = 1024*1024;
+    int rtsp_video_max_bytes_ = 16*1024*1024;
+    int rtsp_high_water_percent_ = 80;
+    int rtsp_drain_timeout_ = 1000;     // 停止时最多等推流队列发完的时间ms
+    int64_t video_skip_frames_ = 0;     // 背压时跳过编码的帧数
     RtspPusher *rtsp_pusher_ = NULL;
-    MessageQueue *msg_queue_ = NULL;
+    EventBus *event_bus_ = NULL;
+    Executor *executor_ = NULL;
 };
 
 #endif // PUSHWORK_H
@@ -26,7 +26,14 @@ SOURCES += main.cpp \
     avpublishtime.cpp \
     aacencoder.cpp \
     h264encoder.cpp \
-    rtsppusher.cpp
+    rtsppusher.cpp \
+    eventbus.cpp \
+    executor.cpp \
+    audiofifo.cpp \
+    audioconvert.cpp \
+    audioresampler.cpp \
+    videoconvert.cpp \
+    videoencodelooper.cpp
 
 HEADERS += \
     commonlooper.h \
@@ -40,8 +47,25 @@ HEADERS += \
     aacencoder.h \
     h264encoder.h \
     packetqueue.h \
+    spscqueue.h \
+    seqlock.h \
+    histogram.h \
+    deadlinetimer.h \
+    packetpool.h \
     rtsppusher.h \
-    messagequeue.h
+    messagequeue.h \
+    eventbus.h \
+    executor.h \
+    mappedfile.h \
+    audiofifo.h \
+    audioconvert.h \
+    audioresampler.h \
+    videoconvert.h \
+    simdlevel.h \
+    framepool.h \
+    events.h \
+    framequeue.h \
+    videoencodelooper.h
 
 #ffmpeg
 INCLUDEPATH += "/usr/local/include"
@@ -1,9 +1,11 @@
 ﻿#include "rtsppusher.h"
 #include "dlog.h"
 #include "timesutil.h"
-RtspPusher::RtspPusher( MessageQueue *msg_queue)
-    :msg_queue_(msg_queue)
+#include "events.h"
+RtspPusher::RtspPusher(EventBus *event_bus)
+    :event_bus_(event_bus)
 {
+    thread_name_ = "rtsp_pusher";
     LogInfo("RtspPusher create");
 }
 
@@ -34,9 +36,21 @@ RET_CODE RtspPusher::Init(const Properties &properties)
     rtsp_transport_ = properties.GetProperty("rtsp_transport", "");
     audio_frame_duration_ = properties.GetProperty("audio_frame_duration", 0);
     video_frame_duration_ = properties.GetProperty("video_frame_duration", 0);
+    SetThreadProperties(properties.GetChildren("thread"));
 
     timeout_ = properties.GetProperty("timeout", 5000);    // 默认为5秒   延迟
     max_queue_duration_ = properties.GetProperty("max_queue_duration", 500);   //视频队列最大长度
+    queue_capacity_ = properties.GetProperty("queue_capacity", 1024);   // 音频、视频队列各自的最大包数
+    interleave_window_ = properties.GetProperty("interleave_window", 50);   // 音视频交织等待窗口ms, 0则按到达顺序发送
+    batch_size_ = properties.GetProperty("batch_size", 64);     // 一次最多取出发送的包数
+    if(batch_size_ <= 0) {
+        batch_size_ = 1;
+    }
+    audio_max_packets_ = properties.GetProperty("audio_max_packets", 0);    // 音视频队列的内存预算, 0不限制
+    audio_max_bytes_ = properties.GetProperty("audio_max_bytes", 1024*1024);
+    video_max_packets_ = properties.GetProperty("video_max_packets", 0);
+    video_max_bytes_ = properties.GetProperty("video_max_bytes", 16*1024*1024);
+    high_water_percent_ = properties.GetProperty("high_water_percent", 80);    // 达到预算的80%进入背压
 
     if(url_ == "") {
         LogError("url is null");
@@ -78,11 +92,14 @@ RET_CODE RtspPusher::Init(const Properties &properties)
     fmt_ctx_->interrupt_callback.opaque = this;
 
     // 创建队列
-    queue_ = new PacketQueue(audio_frame_duration_, video_frame_duration_);
+    queue_ = new PacketQueue(audio_frame_duration_, video_frame_duration_, queue_capacity_);
     if(!queue_) {
         LogError("new PacketQueue failed");
         return RET_ERR_OUTOFMEMORY;
     }
+    queue_->SetBudget(E_AUDIO_TYPE, audio_max_packets_, audio_max_bytes_);
+    queue_->SetBudget(E_VIDEO_TYPE, video_max_packets_, video_max_bytes_);
+    queue_->SetHighWater(high_water_percent_);
     return RET_OK;
 }
 
@@ -102,6 +119,24 @@ void RtspPusher::DeInit()       // 这个函数重复调用没有问题
     }
 }
 
+RET_CODE RtspPusher::Drain(int timeout)
+{
+    drain_request_ = true;
+    int64_t begin = TimesUtil::GetTimeMillisecond();
+    while(Running()) {      // 没有启动过推流线程时直接返回
+        if(TimesUtil::GetTimeMillisecond() - begin > timeout) {
+            PacketQueueStats stats;
+            queue_->GetStats(&stats);
+            LogWarn("drain timeout:%dms, a:%d packets, v:%d packets left", timeout,
+                    stats.audio_nb_packets, stats.video_nb_packets);
+            return RET_FAIL;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    LogInfo("drain ok, cost:%lldms", TimesUtil::GetTimeMillisecond() - begin);
+    return RET_OK;
+}
+
 RET_CODE RtspPusher::Push(AVPacket *pkt, MediaType media_type)
 {
     LogInfo("VideoCapturer Loop leave");
@@ -116,7 +151,37 @@ RET_CODE RtspPusher::Push(AVPacket *pkt, MediaType media_type)
             pkt->size, pkt->pts, pkt->flags & AV_PKT_FLAG_KEY);
     }
 
-    return queue_->Push(pkt, media_type) == 0 ? RET_OK : RET_FAIL;
+    int ret = queue_->Push(pkt, media_type);
+    // 背压状态变化时通知出去
+    bool &backpressure = E_AUDIO_TYPE == media_type ? audio_backpressure_ : video_backpressure_;
+    if(queue_->IsBackpressured(media_type) != backpressure) {
+        backpressure = !backpressure;
+        LogWarn("%s backpressure:%d", E_AUDIO_TYPE == media_type ? "audio" : "video", backpressure);
+        // 带上所有流当前的状态, 转成AVMessage合并后也不会丢失另一路的状态
+        BackpressureEvent event;
+        event.media_type = media_type;
+        event.audio_backpressure = queue_->IsBackpressured(E_AUDIO_TYPE);
+        event.video_backpressure = queue_->IsBackpressured(E_VIDEO_TYPE);
+        event_bus_->Publish(event);
+    }
+    return ret == 0 ? RET_OK : RET_FAIL;
+}
+
+bool RtspPusher::IsBackpressured(MediaType media_type)
+{
+    if(!queue_) {
+        return false;
+    }
+    return queue_->IsBackpressured(media_type);
+}
+
+void RtspPusher::GetDwellStats(MediaType media_type, HistogramStats *stats, bool reset)
+{
+    if(E_AUDIO_TYPE == media_type) {
+        audio_dwell_.GetStats(stats, reset);
+    } else {
+        video_dwell_.GetStats(stats, reset);
+    }
 }
 
 RET_CODE RtspPusher::Connect()
@@ -147,25 +212,42 @@ void RtspPusher::Loop()
 {
     LogInfo("Loop into");
     int ret = 0;
-    AVPacket *pkt = NULL;
-    MediaType media_type;
+    std::vector<AVPacket *> pkts(batch_size_, NULL);
+    std::vector<MediaType> media_types(batch_size_, E_MEDIA_UNKNOWN);
+    std::vector<int64_t> enqueue_times(batch_size_, 0);
+    PacketQueueStats stats;
     LogInfo("sleep_for into");
-    std::this_thread::sleep_for(std::chrono::seconds(10));  //人为制造延迟,等待10秒，等待音频，视频流准备好
+    //人为制造延迟,等待10秒，等待音频，视频流准备好
+    // 分成10ms一段, Stop或者Drain时马上结束等待, 否则Drain一定会超时
+    for(int i = 0; i < 1000 && !request_abort_ && !drain_request_; i++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
     LogInfo("sleep_for leave");
     while (true) {
         if(request_abort_) {
             LogInfo("abort request");
             break;
         }
-        debugQueue(debug_interval_);//定期打印packet队列信息   每2秒打印一次
-        
+        queue_->GetStats(&stats);   // 每批只取一次快照, 打印和检测共用
+        debugQueue(debug_interval_, stats);//定期打印packet队列信息   每2秒打印一次
+
         checkPacketQueueDuration(); // 可以每隔一秒check一次
-        ret = queue_->PopWithTimeout(&pkt, media_type, 1000);
-        if(1 == ret) {  // 1代表 读取到消息
+        // 一次取出所有就绪的包(例如IDR帧和它前后的音频), 连续发送
+        // interleave_window_ > 0 时按时间戳交织, 保证发给muxer的时间戳单调
+        // Drain时不会再有新包, 不用长时间等待
+        bool drain = drain_request_;
+        int count = queue_->PopBatch(pkts.data(), media_types.data(), batch_size_, drain ? 10 : 1000,
+                                     interleave_window_, enqueue_times.data());
+        if(drain && count <= 0 && queue_->Empty()) {
+            LogInfo("queue drained");
+            break;
+        }
+        for(int i = 0; i < count; i++) {
+            AVPacket *pkt = pkts[i];
+            MediaType media_type = media_types[i];
             if(request_abort_) {
-                LogInfo("abort request");
-                av_packet_free(&pkt);
-                break;
+                PacketPool::GetInstance()->Free(&pkt);       // 剩下的包直接释放
+                continue;
             }
             switch (media_type) {
             case E_VIDEO_TYPE:
@@ -173,16 +255,19 @@ void RtspPusher::Loop()
                 if(ret < 0) {
                     LogError("send video Packet failed");
                 }
-                av_packet_free(&pkt);
+                video_dwell_.Record(TimesUtil::GetTimeMicrosecond() - enqueue_times[i]);
+                PacketPool::GetInstance()->Free(&pkt);
                 break;
             case E_AUDIO_TYPE:
                 ret = sendPacket(pkt, media_type);
                 if(ret < 0) {
                     LogError("send audio Packet failed");
                 }
-                av_packet_free(&pkt);
+                audio_dwell_.Record(TimesUtil::GetTimeMicrosecond() - enqueue_times[i]);
+                PacketPool::GetInstance()->Free(&pkt);
                 break;
             default:
+                PacketPool::GetInstance()->Free(&pkt);
                 break;
             }
         }
@@ -222,28 +307,61 @@ int64_t RtspPusher::GetBlockTime()
 }
 
 //定期打印packet
-void RtspPusher::debugQueue(int64_t interval)
+void RtspPusher::debugQueue(int64_t interval, const PacketQueueStats &stats)
 {
     int64_t cur_time = TimesUtil::GetTimeMillisecond();
     if(cur_time - pre_debug_time_ > interval) {  //pre_debug_time_初始化为0
         // 打印信息
-        PacketQueueStats stats;
-        queue_->GetStats(&stats);
-        LogInfo("duration:a-%lldms, v-%lldms", stats.audio_duration, stats.video_duration);
+        HistogramStats audio, video;
+        GetDwellStats(E_AUDIO_TYPE, &audio, true);
+        GetDwellStats(E_VIDEO_TYPE, &video, true);
+        LogInfo("dwell a: n:%lld p50:%.1fms p90:%.1fms p99:%.1fms max:%.1fms, queued:%lldms",
+                audio.count, audio.p50 / 1000.0, audio.p90 / 1000.0, audio.p99 / 1000.0, audio.max / 1000.0,
+                stats.audio_duration);
+        LogInfo("dwell v: n:%lld p50:%.1fms p90:%.1fms p99:%.1fms max:%.1fms, queued:%lldms",
+                video.count, video.p50 / 1000.0, video.p90 / 1000.0, video.p99 / 1000.0, video.max / 1000.0,
+                stats.video_duration);
+        PacketPoolStats pool;
+        PacketPool::GetInstance()->GetStats(&pool);
+        int64_t allocs = pool.alloc_hits + pool.alloc_misses;
+        int64_t buffers = pool.buffer_hits + pool.buffer_misses;
+        LogInfo("packet pool: hit:%.1f%%(%lld/%lld), buffer hit:%.1f%%(%lld/%lld), outstanding:%lld, cached:%d",
+                allocs > 0 ? pool.alloc_hits * 100.0 / allocs : 0.0, pool.alloc_hits, allocs,
+                buffers > 0 ? pool.buffer_hits * 100.0 / buffers : 0.0, pool.buffer_hits, buffers,
+                pool.outstanding, pool.cached);
         pre_debug_time_ = cur_time;
     }
 }
 
 void RtspPusher::checkPacketQueueDuration()
 {
-    PacketQueueStats stats;
-    queue_->GetStats(&stats);
-    if(stats.audio_duration > max_queue_duration_ || stats.video_duration > max_queue_duration_) {
-        msg_queue_->notify_msg3(MSG_RTSP_QUEUE_DURATION, stats.audio_duration, stats.video_duration);
-        LogWarn("drop packet -> a:%lld, v:%lld, th:%d", stats.audio_duration, stats.video_duration,
-                max_queue_duration_);
-        queue_->Drop(false, max_queue_duration_);
+    // 和Drop用同一个口径(包数*帧时长), 按pts算的时长超限时Drop可能认为没有超限, 什么都不丢
+    int64_t audio_duration = queue_->GetQueuedDuration(E_AUDIO_TYPE);
+    int64_t video_duration = queue_->GetQueuedDuration(E_VIDEO_TYPE);
+    if(audio_duration <= max_queue_duration_ && video_duration <= max_queue_duration_) {
+        return;
+    }
+    PacketDropResult drop;
+    queue_->Drop(false, max_queue_duration_, &drop);
+    if(E_DROP_NONE == drop.reasons) {
+        // 超限但没有可丢的(比如视频只剩一个GOP), 每秒最多提示一次
+        int64_t cur_time = TimesUtil::GetTimeMillisecond();
+        if(cur_time - pre_overflow_warn_time_ >= 1000) {
+            LogWarn("queue over limit but nothing droppable -> a:%lld, v:%lld, th:%d",
+                    audio_duration, video_duration, max_queue_duration_);
+            pre_overflow_warn_time_ = cur_time;
+        }
+        return;
     }
+    LogWarn("drop packet -> a:%lld, v:%lld, th:%d, reasons:0x%x, disposable:%d, gop:%d(%d pkts), audio:%d, bytes:%d",
+            audio_duration, video_duration, max_queue_duration_, drop.reasons,
+            drop.disposable_packets, drop.gops, drop.gop_packets, drop.audio_packets, drop.bytes);
+    // 只在真正丢了包时把丢包结果通知出去
+    QueueDurationEvent event;
+    event.audio_duration = audio_duration;
+    event.video_duration = video_duration;
+    event.drop = drop;
+    event_bus_->Publish(event);
 }
 
 int RtspPusher::sendPacket(AVPacket *pkt, MediaType media_type)
@@ -260,12 +378,14 @@ int RtspPusher::sendPacket(AVPacket *pkt, MediaType media_type)
         LogError("unknown mediatype:%d", media_type);
         return -1;
     }
-    pkt->pts = av_rescale_q(pkt->pts, src_time_base, dst_time_base);
     pkt->duration = 0;
+    av_packet_rescale_ts(pkt, src_time_base, dst_time_base);     // pts和dts都要转换, 有B帧时两者不同
     RestTiemout();
     int ret = av_write_frame(fmt_ctx_, pkt);
     if(ret < 0) {
-        msg_queue_->notify_msg2(MSG_RTSP_ERROR, ret);
+        RtspErrorEvent event;
+        event.error = ret;
+        event_bus_->Publish(event);
         char str_error[512] = {0};
         av_strerror(ret, str_error, sizeof(str_error) -1);
         LogError("av_write_frame failed:%s", str_error);        // 出错没有回调给PushWork
@@ -4,7 +4,8 @@
 #include "mediabase.h"
 #include "commonlooper.h"
 #include "packetqueue.h"
-#include "messagequeue.h"
+#include "eventbus.h"
+#include "histogram.h"
 extern "C" {
 #include "libavformat/avformat.h"
 #include "libavformat/avio.h"
@@ -15,11 +16,19 @@ extern "C" {
 class RtspPusher: public CommonLooper
 {
 public:
-    RtspPusher( MessageQueue *msg_queue);
+    RtspPusher(EventBus *event_bus);
     virtual ~RtspPusher();
     RET_CODE Init(const Properties& properties);
     void DeInit();
+    // 停止推流前调用: 推流线程发完队列里已有的包后写trailer退出, 最多等timeout毫秒
+    // 超时返回RET_FAIL, 剩下的包由DeInit丢弃; 调用前要先停掉所有Push的线程
+    RET_CODE Drain(int timeout);
     RET_CODE Push(AVPacket *pkt, MediaType media_type);
+    // 推流队列是否积压到高水位, 编码端据此跳帧
+    bool IsBackpressured(MediaType media_type);
+    // 包从Push到av_write_frame返回的排队时延(us), reset为true时读取后清零
+    // debugQueue每次打印后会清零, 所以读到的是上一次打印之后的样本
+    void GetDwellStats(MediaType media_type, HistogramStats *stats, bool reset = false);
     // 连接服务器，如果连接成功则启动线程
     RET_CODE Connect();
 
@@ -35,8 +44,8 @@ public:
 private:
     int64_t pre_debug_time_ = 0;
     int64_t debug_interval_ = 2000;
-    void debugQueue(int64_t interval);  // 按时间间隔打印packetqueue的状况
-    // 监测队列的缓存情况
+    void debugQueue(int64_t interval, const PacketQueueStats &stats);  // 按时间间隔打印packetqueue的状况
+    // 监测队列的缓存情况, 超过max_queue_duration_时按优先级丢包
     void checkPacketQueueDuration();
     int sendPacket(AVPacket *pkt, MediaType media_type);
     // 整个输出流的上下文
@@ -61,11 +70,28 @@ private:
 
     // 队列最大限制时长
     int max_queue_duration_ = 500;  // 默认100ms
+    int64_t pre_overflow_warn_time_ = 0;    // 超限但没有可丢的包时, 限制告警频率
+    std::atomic<bool> drain_request_{false};    // 队列发空后退出Loop
+    int queue_capacity_ = 1024;     // 音频、视频队列各自预分配的包数
+    int interleave_window_ = 50;    // 音视频交织时等待另一路的最长时间ms
+    int batch_size_ = 64;           // 发送线程一次最多取出的包数
+    // 内存预算, 0表示不限制
+    int audio_max_packets_ = 0;
+    int audio_max_bytes_ = 1024*1024;
+    int video_max_packets_ = 0;
+    int video_max_bytes_ = 16*1024*1024;
+    int high_water_percent_ = 80;
+    // 上一次通知出去的背压状态, 分别只由音频、视频的Push线程读写
+    bool audio_backpressure_ = false;
+    bool video_backpressure_ = false;
+    // 排队时延直方图
+    LatencyHistogram audio_dwell_;
+    LatencyHistogram video_dwell_;
 
     // 处理超时
     int timeout_;
     int64_t pre_time_ = 0;      // 记录调用ffmpeg api之前的时间
-    MessageQueue *msg_queue_ = NULL;
+    EventBus *event_bus_ = NULL;
 };
 
 #endif // RTSPPUSHER_H
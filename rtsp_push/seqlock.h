@@ -0,0 +1,54 @@
+﻿#ifndef SEQLOCK_H
+#define SEQLOCK_H
+#include <atomic>
+#include <stdint.h>
+#include <string.h>
+
+// 顺序锁: 只能有一个写线程, 任意线程读
+// 写线程不会被读线程阻塞, 读线程读到一半遇到写入时重试, 保证读到的是一份完整的快照
+// T需要是可以memcpy的简单结构体
+template <typename T>
+class SeqLock
+{
+public:
+    SeqLock()
+    {
+        for(int i = 0; i < kWords; i++) {
+            words_[i].store(0, std::memory_order_relaxed);
+        }
+    }
+    void Store(const T &value)
+    {
+        uint64_t words[kWords] = {0};
+        memcpy(words, &value, sizeof(T));
+        uint32_t seq = seq_.load(std::memory_order_relaxed);
+        seq_.store(seq + 1, std::memory_order_relaxed);     // 奇数表示正在写
+        std::atomic_thread_fence(std::memory_order_release);
+        for(int i = 0; i < kWords; i++) {
+            words_[i].store(words[i], std::memory_order_relaxed);
+        }
+        seq_.store(seq + 2, std::memory_order_release);
+    }
+    T Load() const
+    {
+        uint64_t words[kWords];
+        uint32_t seq0, seq1;
+        do {
+            seq0 = seq_.load(std::memory_order_acquire);
+            for(int i = 0; i < kWords; i++) {
+                words[i] = words_[i].load(std::memory_order_relaxed);
+            }
+            std::atomic_thread_fence(std::memory_order_acquire);
+            seq1 = seq_.load(std::memory_order_relaxed);
+        } while((seq0 & 1) || seq0 != seq1);
+        T value;
+        memcpy(&value, words, sizeof(T));
+        return value;
+    }
+private:
+    enum { kWords = (sizeof(T) + 7) / 8 };
+    std::atomic<uint32_t> seq_{0};
+    std::atomic<uint64_t> words_[kWords];
+};
+
+#endif // SEQLOCK_H
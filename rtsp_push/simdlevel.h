@@ -0,0 +1,73 @@
+﻿#ifndef SIMDLEVEL_H
+#define SIMDLEVEL_H
+
+// x86上SIMD指令集的运行时检测, 音频、视频格式转换共用
+// 不需要整个工程加-mavx2, 只有用SIMD_TARGET_AVX2标记的函数用AVX2编译, 运行时确认CPU支持后才调用
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define SIMD_X86 1
+#ifdef _MSC_VER
+#include <intrin.h>
+#define SIMD_TARGET_AVX2
+#else
+#define SIMD_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+typedef enum SimdLevel
+{
+    SIMD_NONE = 0,      // 标量实现
+    SIMD_SSE2,
+    SIMD_AVX2
+}SimdLevel;
+
+inline SimdLevel DetectSimdLevel()
+{
+#ifdef SIMD_X86
+#ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 0);
+    int max_leaf = info[0];
+    __cpuid(info, 1);
+    bool sse2 = (info[3] & (1 << 26)) != 0;
+    bool osxsave = (info[2] & (1 << 27)) != 0;
+    bool avx = (info[2] & (1 << 28)) != 0;
+    bool avx2 = false;
+    if(max_leaf >= 7 && osxsave && avx && (_xgetbv(0) & 6) == 6) {     // 操作系统保存了YMM寄存器
+        __cpuidex(info, 7, 0);
+        avx2 = (info[1] & (1 << 5)) != 0;
+    }
+#else
+    __builtin_cpu_init();
+    bool sse2 = __builtin_cpu_supports("sse2");
+    bool avx2 = __builtin_cpu_supports("avx2");
+#endif
+    if(avx2) {
+        return SIMD_AVX2;
+    }
+    if(sse2) {
+        return SIMD_SSE2;
+    }
+#endif
+    return SIMD_NONE;
+}
+
+// CPU支持的最高指令集, 只检测一次
+inline SimdLevel CpuSimdLevel()
+{
+    static SimdLevel s_cpu_level = DetectSimdLevel();
+    return s_cpu_level;
+}
+
+inline const char *SimdLevelName(SimdLevel level)
+{
+    switch(level) {
+    case SIMD_AVX2:
+        return "avx2";
+    case SIMD_SSE2:
+        return "sse2";
+    default:
+        return "c";
+    }
+}
+
+#endif // SIMDLEVEL_H
@@ -0,0 +1,129 @@
+﻿#ifndef SPSCQUEUE_H
+#define SPSCQUEUE_H
+#include <atomic>
+#include <vector>
+#include <stddef.h>
+
+// 单生产者/单消费者的有界环形队列, 容量在构造时一次性分配
+// Push只能在生产者线程调用, Front/Pop只能在消费者线程调用, 两端都不加锁
+template <typename T>
+class SpscQueue
+{
+public:
+    explicit SpscQueue(size_t capacity)
+    {
+        size_t size = 2;
+        while(size < capacity) {        // 向上取2的幂, 方便用mask取下标
+            size <<= 1;
+        }
+        buffer_.resize(size);
+        mask_ = size - 1;
+    }
+    // 返回false说明队列已满
+    bool Push(const T &item)
+    {
+        size_t tail = tail_.load(std::memory_order_relaxed);
+        if(tail - head_cache_ > mask_) {
+            head_cache_ = head_.load(std::memory_order_acquire);    // 缓存失效才去读对端的下标
+            if(tail - head_cache_ > mask_) {
+                return false;
+            }
+        }
+        buffer_[tail & mask_] = item;
+        tail_.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+    // 生产者判断是否已满; 只有生产者会让队列变满, 所以返回false后的下一次Push一定成功
+    bool Full()
+    {
+        size_t tail = tail_.load(std::memory_order_relaxed);
+        if(tail - head_cache_ > mask_) {
+            head_cache_ = head_.load(std::memory_order_acquire);
+        }
+        return tail - head_cache_ > mask_;
+    }
+    // 读取队首但不出队, 返回NULL说明队列为空
+    T *Front()
+    {
+        size_t head = head_.load(std::memory_order_relaxed);
+        if(head == tail_cache_) {
+            tail_cache_ = tail_.load(std::memory_order_acquire);
+            if(head == tail_cache_) {
+                return NULL;
+            }
+        }
+        return &buffer_[head & mask_];
+    }
+    // 返回false说明队列为空
+    bool Pop(T *item)
+    {
+        T *front = Front();
+        if(!front) {
+            return false;
+        }
+        *item = *front;
+        head_.store(head_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+        return true;
+    }
+    // 消费者查看队首之后第index个元素, 超出已入队的范围返回NULL
+    T *Peek(size_t index)
+    {
+        size_t head = head_.load(std::memory_order_relaxed);
+        if(tail_cache_ - head <= index) {
+            tail_cache_ = tail_.load(std::memory_order_acquire);
+            if(tail_cache_ - head <= index) {
+                return NULL;
+            }
+        }
+        return &buffer_[(head + index) & mask_];
+    }
+    // 消费者删除满足pred(item, index)的元素, 其余元素保持原有顺序, 返回删除的数量
+    // index为元素相对队首的位置; 被删除元素的资源由pred负责释放
+    // 从队尾往队首压缩, 最后推进head_, 生产者只会写tail_之后的位置, 所以不需要加锁
+    template <typename Pred>
+    size_t RemoveIf(Pred pred)
+    {
+        size_t head = head_.load(std::memory_order_relaxed);
+        size_t tail = tail_.load(std::memory_order_acquire);
+        tail_cache_ = tail;
+        size_t write = tail;
+        for(size_t read = tail; read != head; ) {
+            read--;
+            if(pred(buffer_[read & mask_], read - head)) {
+                continue;
+            }
+            write--;
+            if(write != read) {
+                buffer_[write & mask_] = buffer_[read & mask_];
+            }
+        }
+        head_.store(write, std::memory_order_release);
+        return write - head;
+    }
+    bool Empty() const
+    {
+        return head_.load(std::memory_order_acquire) == tail_.load(std::memory_order_acquire);
+    }
+    size_t Size() const
+    {
+        return tail_.load(std::memory_order_acquire) - head_.load(std::memory_order_acquire);
+    }
+    size_t Capacity() const
+    {
+        return mask_ + 1;
+    }
+private:
+    std::vector<T> buffer_;
+    size_t mask_ = 0;
+    // 生产者、消费者的下标用padding隔到不同的cache line, 避免伪共享
+    // (c++11的new不保证alignas(64)的对齐, 所以这里不用alignas)
+    char pad0_[64];
+    std::atomic<size_t> head_{0};   // 消费者写
+    size_t tail_cache_ = 0;         // 消费者缓存的tail_
+    char pad1_[64];
+    std::atomic<size_t> tail_{0};   // 生产者写
+    size_t head_cache_ = 0;         // 生产者缓存的head_
+    char pad2_[64];
+};
+
+#endif // SPSCQUEUE_H
@@ -0,0 +1,587 @@
+﻿#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string>
+#include <thread>
+#include <chrono>
+#include <vector>
+#include "spscqueue.h"
+#include "seqlock.h"
+#include "packetqueue.h"
+#include "packetpool.h"
+
+// SpscQueue/PacketQueue的单元测试, 不依赖测试框架, 失败时打印位置并返回非0
+static int g_failed = 0;
+
+#define CHECK(cond) do { \
+    if(!(cond)) { \
+        printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+        g_failed++; \
+        return; \
+    } \
+} while(0)
+
+// 容量向上取2的幂, 最小为2
+static void testSpscCapacity()
+{
+    CHECK(SpscQueue<int>(0).Capacity() == 2);
+    CHECK(SpscQueue<int>(2).Capacity() == 2);
+    CHECK(SpscQueue<int>(5).Capacity() == 8);
+    CHECK(SpscQueue<int>(1024).Capacity() == 1024);
+}
+
+// 下标一直递增, 反复绕过环尾, 每一圈都检查满/空边界和FIFO顺序
+static void testSpscWrapAround()
+{
+    SpscQueue<int> queue(4);
+    int next_push = 0;
+    int next_pop = 0;
+    for(int round = 0; round < 1000; round++) {
+        int fill = round % 5;               // 0~4个, 4个时正好写满
+        for(int i = 0; i < fill; i++) {
+            CHECK(queue.Push(next_push));
+            next_push++;
+        }
+        CHECK(queue.Size() == (size_t)fill);
+        CHECK(queue.Full() == (fill == 4));
+        if(fill == 4) {
+            CHECK(!queue.Push(-1));         // 满了不能再入队, 也不能覆盖
+        }
+        for(int i = 0; i < fill; i++) {
+            CHECK(queue.Peek(i) && *queue.Peek(i) == next_pop + i);
+        }
+        CHECK(queue.Peek(fill) == NULL);
+        int value = -1;
+        for(int i = 0; i < fill; i++) {
+            CHECK(queue.Pop(&value));
+            CHECK(value == next_pop);
+            next_pop++;
+        }
+        CHECK(queue.Empty());
+        CHECK(queue.Front() == NULL);
+        CHECK(!queue.Pop(&value));
+    }
+}
+
+// RemoveIf跨过环尾压缩: 删除后剩余元素保持顺序, index相对队首, 之后继续入队出队正常
+static void testSpscRemoveIfWrap()
+{
+    for(int offset = 0; offset < 8; offset++) {         // 队首落在环的每一个位置
+        SpscQueue<int> queue(8);
+        int value = 0;
+        for(int i = 0; i < offset; i++) {
+            CHECK(queue.Push(-1));
+            CHECK(queue.Pop(&value));
+        }
+        for(int i = 0; i < 8; i++) {
+            CHECK(queue.Push(i));
+        }
+        std::vector<size_t> indexes;
+        size_t removed = queue.RemoveIf([&indexes](int &item, size_t index) {
+            indexes.push_back(index);
+            return item % 2 == 0 || item == 7;
+        });
+        CHECK(removed == 5);
+        CHECK(indexes.size() == 8);
+        for(size_t i = 0; i < indexes.size(); i++) {
+            CHECK(indexes[i] == 7 - i);     // 从队尾往队首遍历
+        }
+        CHECK(queue.Size() == 3);
+        // 腾出来的位置可以继续入队, 顺序接在剩余元素后面
+        for(int i = 8; i < 13; i++) {
+            CHECK(queue.Push(i));
+        }
+        CHECK(queue.Full());
+        const int expect[] = {1, 3, 5, 8, 9, 10, 11, 12};
+        for(size_t i = 0; i < sizeof(expect) / sizeof(expect[0]); i++) {
+            CHECK(queue.Pop(&value));
+            CHECK(value == expect[i]);
+        }
+        CHECK(queue.Empty());
+    }
+}
+
+// 删除全部/一个都不删
+static void testSpscRemoveIfEdge()
+{
+    SpscQueue<int> queue(4);
+    CHECK(queue.RemoveIf([](int &, size_t) { return true; }) == 0);
+    for(int i = 0; i < 3; i++) {
+        CHECK(queue.Push(i));
+    }
+    CHECK(queue.RemoveIf([](int &, size_t) { return false; }) == 0);
+    CHECK(queue.Size() == 3);
+    CHECK(queue.RemoveIf([](int &, size_t) { return true; }) == 3);
+    CHECK(queue.Empty());
+    CHECK(queue.Push(3));
+    int value = -1;
+    CHECK(queue.Pop(&value) && value == 3);
+}
+
+// 生产者、消费者各一个线程, 小容量让下标绕很多圈, 消费者检查序号连续
+static void testSpscConcurrent()
+{
+    const int64_t count = 2000000;
+    SpscQueue<int64_t> queue(16);
+    std::thread producer([&queue, count]() {
+        for(int64_t i = 0; i < count; ) {
+            if(queue.Push(i)) {
+                i++;
+            } else {
+                std::this_thread::yield();
+            }
+        }
+    });
+    int64_t expect = 0;
+    int64_t value = 0;
+    bool ordered = true;
+    while(expect < count) {
+        if(!queue.Pop(&value)) {
+            std::this_thread::yield();
+            continue;
+        }
+        if(value != expect) {
+            ordered = false;
+        }
+        expect++;
+    }
+    producer.join();
+    CHECK(ordered);
+    CHECK(queue.Empty());
+}
+
+typedef struct seq_sample
+{
+    int64_t values[5];      // 一次Store里所有字段相同, 读到不一样说明读到了写了一半的数据
+}SeqSample;
+
+// 一个写线程不停地Store, 两个读线程检查每次Load的快照完整并且不会倒退
+static void testSeqLockSnapshot()
+{
+    const int64_t count = 2000000;
+    SeqLock<SeqSample> lock;
+    std::atomic<bool> done{false};
+    std::atomic<int> torn{0};
+    std::atomic<int> backwards{0};
+    auto reader = [&lock, &done, &torn, &backwards]() {
+        int64_t last = 0;
+        while(!done) {
+            SeqSample sample = lock.Load();
+            for(int i = 1; i < 5; i++) {
+                if(sample.values[i] != sample.values[0]) {
+                    torn++;
+                }
+            }
+            if(sample.values[0] < last) {
+                backwards++;
+            }
+            last = sample.values[0];
+        }
+    };
+    std::thread reader1(reader);
+    std::thread reader2(reader);
+    SeqSample sample;
+    for(int64_t value = 1; value <= count; value++) {
+        for(int i = 0; i < 5; i++) {
+            sample.values[i] = value;
+        }
+        lock.Store(sample);
+    }
+    done = true;
+    reader1.join();
+    reader2.join();
+    CHECK(0 == torn);
+    CHECK(0 == backwards);
+    CHECK(lock.Load().values[4] == count);
+}
+
+static AVPacket *allocPacket(int64_t pts, int flags, int size)
+{
+    AVPacket *pkt = PacketPool::GetInstance()->Alloc();
+    av_new_packet(pkt, size);
+    pkt->pts = pts;
+    pkt->dts = pts;
+    pkt->flags = flags;
+    return pkt;
+}
+
+// 音视频两个环按入队序号合并, Pop的顺序和Push的顺序一致
+static void testPacketQueueOrder()
+{
+    PacketQueue queue(20, 40, 8);
+    const MediaType types[] = {E_VIDEO_TYPE, E_AUDIO_TYPE, E_AUDIO_TYPE, E_VIDEO_TYPE, E_AUDIO_TYPE, E_VIDEO_TYPE};
+    for(int round = 0; round < 100; round++) {          // 每个环容量8, 多轮之后下标会绕过环尾
+        for(int i = 0; i < 6; i++) {
+            CHECK(queue.Push(allocPacket(round * 6 + i, 0, 100), types[i]) == 0);
+        }
+        CHECK(queue.GetAudioPackets() == 3);
+        CHECK(queue.GetVideoPackets() == 3);
+        for(int i = 0; i < 6; i++) {
+            AVPacket *pkt = NULL;
+            MediaType media_type;
+            CHECK(queue.PopWithTimeout(&pkt, media_type, 0) == 1);
+            CHECK(pkt->pts == round * 6 + i);
+            CHECK(media_type == types[i]);
+            PacketPool::GetInstance()->Free(&pkt);
+        }
+        CHECK(queue.Empty());
+    }
+}
+
+// 环满时Push失败, 包仍归调用者; 出队一个之后又可以入队
+static void testPacketQueueFull()
+{
+    PacketQueue queue(20, 40, 4);
+    for(int i = 0; i < 4; i++) {
+        CHECK(queue.Push(allocPacket(i, 0, 10), E_AUDIO_TYPE) == 0);
+    }
+    AVPacket *extra = allocPacket(4, 0, 10);
+    CHECK(queue.Push(extra, E_AUDIO_TYPE) < 0);
+    CHECK(queue.Push(allocPacket(100, 0, 10), E_VIDEO_TYPE) == 0);     // 视频是另一个环, 不受影响
+    AVPacket *pkt = NULL;
+    MediaType media_type;
+    CHECK(queue.PopWithTimeout(&pkt, media_type, 0) == 1 && pkt->pts == 0);
+    PacketPool::GetInstance()->Free(&pkt);
+    CHECK(queue.Push(extra, E_AUDIO_TYPE) == 0);
+    queue.Drop(true, 0);
+    CHECK(queue.Empty());
+    CHECK(queue.GetAudioPackets() == 0 && queue.GetVideoPackets() == 0);
+}
+
+// 空队列超时返回0, Abort后返回-1, 等待中的消费者被唤醒
+static void testPacketQueueAbort()
+{
+    PacketQueue queue(20, 40, 4);
+    AVPacket *pkt = NULL;
+    MediaType media_type;
+    CHECK(queue.PopWithTimeout(&pkt, media_type, 1) == 0);
+    std::thread consumer([&queue]() {
+        AVPacket *pkt = NULL;
+        MediaType media_type;
+        queue.Pop(&pkt, media_type);
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    queue.Abort();
+    consumer.join();
+    CHECK(queue.PopWithTimeout(&pkt, media_type, 0) == -1);
+}
+
+// PopBatch不交织时按入队顺序一次取完就绪的包, 最多max_packets个
+static void testPopBatch()
+{
+    PacketQueue queue(20, 40, 16);
+    AVPacket *pkts[8];
+    MediaType media_types[8];
+    int64_t enqueue_times[8] = {0};
+    CHECK(queue.PopBatch(NULL, media_types, 8, 0) == -1);
+    CHECK(queue.PopBatch(pkts, media_types, 0, 0) == -1);
+    CHECK(queue.PopBatch(pkts, media_types, 8, 1) == 0);      // 空队列等待超时
+    for(int i = 0; i < 10; i++) {
+        CHECK(queue.Push(allocPacket(i, 0, 10), i % 3 ? E_AUDIO_TYPE : E_VIDEO_TYPE) == 0);
+    }
+    int count = queue.PopBatch(pkts, media_types, 8, 0, 0, enqueue_times);
+    CHECK(8 == count);
+    for(int i = 0; i < count; i++) {
+        CHECK(pkts[i]->pts == i);
+        CHECK(media_types[i] == (i % 3 ? E_AUDIO_TYPE : E_VIDEO_TYPE));
+        CHECK(enqueue_times[i] > 0);
+        CHECK(0 == i || enqueue_times[i] >= enqueue_times[i - 1]);
+        PacketPool::GetInstance()->Free(&pkts[i]);
+    }
+    count = queue.PopBatch(pkts, media_types, 8, 0);
+    CHECK(2 == count);
+    CHECK(pkts[0]->pts == 8 && pkts[1]->pts == 9);
+    PacketPool::GetInstance()->Free(&pkts[0]);
+    PacketPool::GetInstance()->Free(&pkts[1]);
+    CHECK(queue.Empty());
+    queue.Abort();
+    CHECK(queue.PopBatch(pkts, media_types, 8, 0) == -1);
+}
+
+// PopBatch交织时按时间戳合并两路; 只剩一路并且另一路可能还有更早的包要来时结束本批
+static void testPopBatchInterleaved()
+{
+    PacketQueue queue(20, 40, 16);
+    AVPacket *pkts[8];
+    MediaType media_types[8];
+    // 视频先入队但时间戳更大
+    CHECK(queue.Push(allocPacket(40, 0, 10), E_VIDEO_TYPE) == 0);
+    CHECK(queue.Push(allocPacket(80, 0, 10), E_VIDEO_TYPE) == 0);
+    CHECK(queue.Push(allocPacket(0, 0, 10), E_AUDIO_TYPE) == 0);
+    CHECK(queue.Push(allocPacket(20, 0, 10), E_AUDIO_TYPE) == 0);
+    CHECK(queue.Push(allocPacket(60, 0, 10), E_AUDIO_TYPE) == 0);
+    int count = queue.PopBatch(pkts, media_types, 8, 0, 1000);
+    // 音频0,20 视频40 音频60, 剩下视频80: 音频最后入队的是60 < 80, 可能还有更早的音频, 本批结束
+    CHECK(4 == count);
+    const int64_t expect[] = {0, 20, 40, 60};
+    for(int i = 0; i < count; i++) {
+        CHECK(pkts[i]->pts == expect[i]);
+        PacketPool::GetInstance()->Free(&pkts[i]);
+    }
+    // 音频跟上之后视频80可以出队
+    CHECK(queue.Push(allocPacket(80, 0, 10), E_AUDIO_TYPE) == 0);
+    count = queue.PopBatch(pkts, media_types, 8, 0, 1000);
+    CHECK(2 == count);
+    CHECK(pkts[0]->pts == 80 && pkts[1]->pts == 80);
+    for(int i = 0; i < count; i++) {
+        PacketPool::GetInstance()->Free(&pkts[i]);
+    }
+    CHECK(queue.Empty());
+}
+
+// 有B帧时视频的pts比dts大, 判断另一路是否跟上要用最后入队包的dts, 不能用pts
+static void testPopBatchInterleavedDts()
+{
+    PacketQueue queue(20, 40, 16);
+    AVPacket *pkts[8];
+    MediaType media_types[8];
+    AVPacket *video = allocPacket(180, 0, 10);
+    video->dts = 90;
+    CHECK(queue.Push(video, E_VIDEO_TYPE) == 0);
+    CHECK(queue.PopBatch(pkts, media_types, 8, 0, 1000) == 1);
+    PacketPool::GetInstance()->Free(&pkts[0]);
+    // 视频最后入队的dts是90 < 100, 后面可能还有dts在90~100之间的视频, 音频100要等;
+    // 用pts(180)比较的话音频100会马上出队, 排在之后来的视频95前面
+    CHECK(queue.Push(allocPacket(100, 0, 10), E_AUDIO_TYPE) == 0);
+    std::thread producer([&queue]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        AVPacket *video = allocPacket(140, 0, 10);
+        video->dts = 95;
+        queue.Push(video, E_VIDEO_TYPE);
+    });
+    int count = queue.PopBatch(pkts, media_types, 8, 0, 1000);
+    producer.join();
+    CHECK(1 == count);      // 视频95出队后又只剩音频100, 视频最后的dts 95 < 100, 本批结束
+    CHECK(E_VIDEO_TYPE == media_types[0] && pkts[0]->dts == 95);
+    PacketPool::GetInstance()->Free(&pkts[0]);
+    queue.Drop(true, 0);
+    CHECK(queue.Empty());
+}
+
+// 只有音频超限时, 视频里有可丢的帧也要丢音频, 不能什么都不丢
+static void testPacketQueueDropAudioOnly()
+{
+    PacketQueue queue(20, 40, 64);
+    for(int i = 0; i < 5; i++) {            // 视频200ms, 有非参考帧和第二个I帧, 但没有超限
+        int flags = (0 == i || 3 == i) ? AV_PKT_FLAG_KEY : AV_PKT_FLAG_DISPOSABLE;
+        CHECK(queue.Push(allocPacket(i * 40, flags, 10), E_VIDEO_TYPE) == 0);
+    }
+    for(int i = 0; i < 30; i++) {           // 音频600ms, 超限但不到2倍
+        CHECK(queue.Push(allocPacket(i * 20, 0, 10), E_AUDIO_TYPE) == 0);
+    }
+    CHECK(queue.GetQueuedDuration(E_AUDIO_TYPE) == 600);
+    CHECK(queue.GetQueuedDuration(E_VIDEO_TYPE) == 200);
+    PacketDropResult drop;
+    queue.Drop(false, 500, &drop);
+    CHECK(E_DROP_AUDIO == drop.reasons);
+    CHECK(drop.audio_packets == 5);
+    CHECK(queue.GetQueuedDuration(E_AUDIO_TYPE) == 500);
+    CHECK(queue.GetVideoPackets() == 5);
+    // 没有超限时不丢
+    queue.Drop(false, 500, &drop);
+    CHECK(E_DROP_NONE == drop.reasons);
+    queue.Drop(true, 0);
+}
+
+// 音视频都超限时先丢视频, 音频不到2倍不丢
+static void testPacketQueueDropVideoFirst()
+{
+    PacketQueue queue(20, 40, 64);
+    for(int i = 0; i < 20; i++) {           // 视频800ms, 每5帧一个GOP, 每个GOP里有2个非参考帧
+        int flags = 0 == i % 5 ? AV_PKT_FLAG_KEY : (i % 5 >= 3 ? AV_PKT_FLAG_DISPOSABLE : 0);
+        CHECK(queue.Push(allocPacket(i * 40, flags, 10), E_VIDEO_TYPE) == 0);
+    }
+    for(int i = 0; i < 30; i++) {           // 音频600ms
+        CHECK(queue.Push(allocPacket(i * 20, 0, 10), E_AUDIO_TYPE) == 0);
+    }
+    PacketDropResult drop;
+    queue.Drop(false, 500, &drop);
+    CHECK(drop.reasons & E_DROP_DISPOSABLE);
+    CHECK(drop.disposable_packets == 8);    // 800ms需要丢掉8帧, 正好8个非参考帧
+    CHECK(!(drop.reasons & E_DROP_GOP));
+    CHECK(queue.GetQueuedDuration(E_VIDEO_TYPE) == 480);
+    CHECK(drop.audio_packets == 5);         // 视频丢完已经不超限, 音频自己超限, 丢到500ms
+    CHECK(queue.GetQueuedDuration(E_AUDIO_TYPE) == 500);
+    queue.Drop(true, 0);
+}
+
+// 生产者、消费者并发时, 另一个线程读到的统计始终自洽: 包数在[0, 容量]内, 字节数和包数对得上
+static void testPacketQueueStatsConcurrent()
+{
+    const int count = 200000;
+    const int pkt_size = 16;
+    PacketQueue queue(20, 40, 64);
+    std::atomic<bool> done{false};
+    std::atomic<int> bad{0};
+    std::thread monitor([&queue, &done, &bad, pkt_size]() {
+        PacketQueueStats stats;
+        while(!done) {
+            queue.GetStats(&stats);
+            if(stats.video_nb_packets < 0 || stats.video_nb_packets > 64
+                    || stats.video_size != stats.video_nb_packets * pkt_size) {
+                bad++;
+            }
+        }
+    });
+    std::thread producer([&queue, count, pkt_size]() {
+        for(int i = 0; i < count; ) {
+            AVPacket *pkt = allocPacket(i, 0, pkt_size);
+            if(queue.Push(pkt, E_VIDEO_TYPE) == 0) {
+                i++;
+            } else {
+                PacketPool::GetInstance()->Free(&pkt);
+                std::this_thread::yield();
+            }
+        }
+    });
+    for(int received = 0; received < count; ) {
+        AVPacket *pkt = NULL;
+        MediaType media_type;
+        if(queue.PopWithTimeout(&pkt, media_type, 10) == 1) {
+            PacketPool::GetInstance()->Free(&pkt);
+            received++;
+        }
+    }
+    producer.join();
+    done = true;
+    monitor.join();
+    CHECK(0 == bad);
+    PacketQueueStats stats;
+    queue.GetStats(&stats);
+    CHECK(0 == stats.video_nb_packets && 0 == stats.video_size);
+    CHECK(count - 1 == stats.video_back_pts && count - 1 == stats.video_front_pts);
+}
+
+// 两个生产者线程和一个消费者线程, 每一路内部的pts保持递增, 总数不丢
+static void testPacketQueueConcurrent()
+{
+    const int count = 200000;
+    PacketQueue queue(20, 40, 64);
+    auto produce = [&queue, count](MediaType media_type) {
+        for(int i = 0; i < count; ) {
+            AVPacket *pkt = allocPacket(i, 0, 16);
+            if(queue.Push(pkt, media_type) == 0) {
+                i++;
+            } else {
+                PacketPool::GetInstance()->Free(&pkt);
+                std::this_thread::yield();
+            }
+        }
+    };
+    std::thread audio(produce, E_AUDIO_TYPE);
+    std::thread video(produce, E_VIDEO_TYPE);
+    int64_t next_pts[2] = {0, 0};
+    int received = 0;
+    bool ordered = true;
+    while(received < count * 2) {
+        AVPacket *pkt = NULL;
+        MediaType media_type;
+        if(queue.PopWithTimeout(&pkt, media_type, 10) != 1) {
+            continue;
+        }
+        int index = E_AUDIO_TYPE == media_type ? 0 : 1;
+        if(pkt->pts != next_pts[index]) {
+            ordered = false;
+        }
+        next_pts[index] = pkt->pts + 1;
+        PacketPool::GetInstance()->Free(&pkt);
+        received++;
+    }
+    audio.join();
+    video.join();
+    CHECK(ordered);
+    CHECK(queue.Empty());
+}
+
+// 超过高水位进入背压; 之后生产者不再入队(和YuvCallback1跳过编码一样), 只靠出队也能回落到一半以下清除
+static void testBackpressureClearsOnPop()
+{
+    PacketQueue queue(20, 40, 64);
+    queue.SetBudget(E_VIDEO_TYPE, 10, 0);
+    queue.SetHighWater(80);
+    for(int i = 0; i < 7; i++) {
+        CHECK(queue.Push(allocPacket(i, AV_PKT_FLAG_KEY, 100), E_VIDEO_TYPE) == 0);
+    }
+    CHECK(!queue.IsBackpressured(E_VIDEO_TYPE));
+    CHECK(queue.Push(allocPacket(7, AV_PKT_FLAG_KEY, 100), E_VIDEO_TYPE) == 0);     // 8/10, 到达80%
+    CHECK(queue.IsBackpressured(E_VIDEO_TYPE));
+    AVPacket *pkts[8];
+    MediaType media_types[8];
+    CHECK(queue.PopBatch(pkts, media_types, 4, 0) == 4);    // 剩4个, 40%不低于一半, 保持
+    CHECK(queue.IsBackpressured(E_VIDEO_TYPE));
+    CHECK(queue.PopWithTimeout(&pkts[4], media_types[4], 0) == 1);  // 剩3个, 30%
+    CHECK(!queue.IsBackpressured(E_VIDEO_TYPE));
+    PacketQueueStats stats;
+    queue.GetStats(&stats);
+    CHECK(stats.video_backpressure == 0);
+    int64_t over_budget_time = stats.video_over_budget_time;
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    queue.GetStats(&stats);
+    CHECK(stats.video_over_budget_time == over_budget_time);        // 清除之后不再增长
+    for(int i = 0; i < 5; i++) {
+        PacketPool::GetInstance()->Free(&pkts[i]);
+    }
+    CHECK(queue.PopBatch(pkts, media_types, 8, 0) == 3);
+    for(int i = 0; i < 3; i++) {
+        PacketPool::GetInstance()->Free(&pkts[i]);
+    }
+}
+
+// 按字节预算进入背压, Drop丢掉非参考帧之后清除
+static void testBackpressureClearsOnDrop()
+{
+    PacketQueue queue(20, 40, 64);
+    queue.SetBudget(E_VIDEO_TYPE, 0, 1000);
+    queue.SetHighWater(80);
+    CHECK(queue.Push(allocPacket(0, AV_PKT_FLAG_KEY, 100), E_VIDEO_TYPE) == 0);
+    for(int i = 1; i < 9; i++) {        // 900字节, 90%
+        CHECK(queue.Push(allocPacket(i * 40, AV_PKT_FLAG_DISPOSABLE, 100), E_VIDEO_TYPE) == 0);
+    }
+    CHECK(queue.IsBackpressured(E_VIDEO_TYPE));
+    PacketDropResult drop;
+    queue.Drop(false, 40, &drop);       // 只保留一帧的时长, 丢掉所有非参考帧
+    CHECK(drop.reasons & E_DROP_DISPOSABLE);
+    CHECK(queue.GetVideoPackets() == 1);
+    CHECK(!queue.IsBackpressured(E_VIDEO_TYPE));
+    queue.Drop(true, 0);
+}
+
+// 日志写到临时目录, 不在源码或者构建目录里留下文件
+static std::string logDir()
+{
+#ifdef _WIN32
+    const char *tmp = getenv("TEMP");
+#else
+    const char *tmp = getenv("TMPDIR");
+#endif
+    return std::string(tmp ? tmp : "/tmp") + "/packetqueue_test_log";
+}
+
+int main()
+{
+    init_logger(logDir().c_str(), (slog_level)(S_ERROR + 1));     // 队列满、abort时会打日志, 测试里不输出, 结果只看CHECK
+    testSpscCapacity();
+    testSpscWrapAround();
+    testSpscRemoveIfWrap();
+    testSpscRemoveIfEdge();
+    testSpscConcurrent();
+    testSeqLockSnapshot();
+    testPacketQueueOrder();
+    testPacketQueueFull();
+    testPacketQueueAbort();
+    testPopBatch();
+    testPopBatchInterleaved();
+    testPopBatchInterleavedDts();
+    testPacketQueueDropAudioOnly();
+    testPacketQueueDropVideoFirst();
+    testPacketQueueConcurrent();
+    testBackpressureClearsOnPop();
+    testBackpressureClearsOnDrop();
+    testPacketQueueStatsConcurrent();
+    if(g_failed) {
+        printf("packetqueue_test: %d failed\n", g_failed);
+        return 1;
+    }
+    printf("packetqueue_test: all passed\n");
+    return 0;
+}
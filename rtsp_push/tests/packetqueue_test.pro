@@ -0,0 +1,25 @@
+TEMPLATE = app
+CONFIG += console c++11
+CONFIG -= app_bundle
+CONFIG -= qt
+
+# PacketQueue/SpscQueue单元测试, 运行返回0表示全部通过
+INCLUDEPATH += $$PWD/..
+
+SOURCES += packetqueue_test.cpp \
+    ../dlog.cpp
+
+HEADERS += \
+    ../spscqueue.h \
+    ../seqlock.h \
+    ../packetqueue.h \
+    ../packetpool.h
+
+#ffmpeg
+INCLUDEPATH += "/usr/local/include"
+
+LIBS += -pthread
+
+LIBS += -L"/usr/local/lib"  \
+-lavcodec \
+-lavutil
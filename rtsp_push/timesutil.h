@@ -63,6 +63,11 @@ public:
 //        return duration_cast<chrono::milliseconds>(high_resolution_clock::now() - m_begin).count();
 
     }
+    // 单调时钟, 不受系统时间调整的影响, 只用于计算时间间隔
+    static inline int64_t GetTimeMicrosecond()
+    {
+        return duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count();
+    }
 //private:
 //    static time_point<high_resolution_clock> m_begin;
 };
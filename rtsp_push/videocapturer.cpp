@@ -1,20 +1,54 @@
 ﻿#include "videocapturer.h"
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#ifdef __linux__
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/videodev2.h>
+#endif
 #include "dlog.h"
 #include "timesutil.h"
 #include "avpublishtime.h"
+#include "events.h"
+#include "videoconvert.h"
 extern "C" {
 #include <libswscale/swscale.h>
 #include <libavutil/imgutils.h>
+#include <libavutil/pixdesc.h>
+#include <libavutil/time.h>
 }
 
+// v4l2能直接给出的格式, 名字是v4l2 demuxer的input_format选项
+typedef struct v4l2_format_name
+{
+    uint32_t fourcc;
+    const char *name;
+}V4l2FormatName;
+
+#ifdef __linux__
+static const V4l2FormatName kV4l2Formats[] = {
+    { V4L2_PIX_FMT_YUV420, "yuv420p" },
+    { V4L2_PIX_FMT_NV12, "nv12" },
+    { V4L2_PIX_FMT_YUYV, "yuyv422" },
+    { V4L2_PIX_FMT_UYVY, "uyvy422" },
+    { V4L2_PIX_FMT_MJPEG, "mjpeg" },
+    { V4L2_PIX_FMT_JPEG, "mjpeg" },
+    { V4L2_PIX_FMT_H264, "h264" }
+};
+#endif
+
 VideoCapturer::VideoCapturer()
 {
+    thread_name_ = "video_capture";
     // 注册设备
     avdevice_register_all();
 }
 
 VideoCapturer::~VideoCapturer()
 {
+    Stop();     // 基类析构才停线程就晚了, 采集线程可能还在读已经关掉的设备
     CloseCamera();
     if(sws_ctx_) {
         sws_freeContext(sws_ctx_);
@@ -23,8 +57,9 @@ VideoCapturer::~VideoCapturer()
     if(frame_) {
         av_frame_free(&frame_);
     }
-    if(yuv_frame_) {
-        av_frame_free(&yuv_frame_);
+    if(frame_pool_) {
+        delete frame_pool_;
+        frame_pool_ = nullptr;
     }
 }
 
@@ -32,14 +67,23 @@ RET_CODE VideoCapturer::Init(const Properties &properties)
 {
     // 获取参数
     device_name_ = properties.GetProperty("device_name", "/dev/video0");
+    device_format_ = properties.GetProperty("device_format", "v4l2");
+    input_format_ = properties.GetProperty("input_format", "");
     width_ = properties.GetProperty("width", 1280);
     height_ = properties.GetProperty("height", 720);
     pixel_format_ = properties.GetProperty("pixel_format", AV_PIX_FMT_YUV420P);
     fps_ = properties.GetProperty("fps", 25);
+    convert_slices_ = properties.GetProperty("convert_slices", 1);
+    frame_pool_size_ = properties.GetProperty("frame_pool_size", 8);
     frame_duration_ = 1000.0 / fps_;
+    SetThreadProperties(properties.GetChildren("thread"));
 
     // 分配缓冲区
-    yuv_buf_size_ = width_ * height_ * 3 / 2; // YUV420格式
+    yuv_buf_size_ = av_image_get_buffer_size((AVPixelFormat)pixel_format_, width_, height_, 1);
+    if (yuv_buf_size_ <= 0) {
+        LogError("Unsupported pixel_format:%d", pixel_format_);
+        return RET_FAIL;
+    }
     yuv_buf_ = new uint8_t[yuv_buf_size_];
 
     // 打开摄像头
@@ -51,26 +95,117 @@ RET_CODE VideoCapturer::Init(const Properties &properties)
     return RET_OK;
 }
 
-RET_CODE VideoCapturer::OpenCamera()
+std::vector<std::string> VideoCapturer::probeInputFormats()
+{
+    std::vector<std::string> formats;
+#ifdef __linux__
+    int fd = open(device_name_.c_str(), O_RDWR | O_NONBLOCK);
+    if (fd < 0) {
+        return formats;
+    }
+    struct v4l2_fmtdesc desc;
+    memset(&desc, 0, sizeof(desc));
+    desc.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    for (desc.index = 0; ioctl(fd, VIDIOC_ENUM_FMT, &desc) == 0; desc.index++) {
+        for (size_t i = 0; i < sizeof(kV4l2Formats) / sizeof(kV4l2Formats[0]); i++) {
+            if (kV4l2Formats[i].fourcc == desc.pixelformat
+                    && std::find(formats.begin(), formats.end(), kV4l2Formats[i].name) == formats.end()) {
+                formats.push_back(kV4l2Formats[i].name);
+            }
+        }
+    }
+    close(fd);
+#endif
+    return formats;
+}
+
+int VideoCapturer::inputFormatCost(const std::string &input_format)
+{
+    AVPixelFormat fmt = av_get_pix_fmt(input_format.c_str());
+    if (fmt == AV_PIX_FMT_NONE) {
+        return input_format == "mjpeg" ? 3 : 4;     // 压缩格式要先解码, H.264解码还有延迟
+    }
+    if (fmt == pixel_format_) {
+        return 0;                                   // 和编码器一致, 不用转换
+    }
+    if (pixel_format_ == AV_PIX_FMT_YUV420P && VideoConvertSupported(fmt)) {
+        return 1;                                   // 只是重排
+    }
+    return 2;                                       // sws
+}
+
+int VideoCapturer::openInput(const std::string &input_format)
 {
-    int ret;
     AVDictionary *options = nullptr;
-    
+
     // 设置摄像头参数
     char resolution[32];
     snprintf(resolution, sizeof(resolution), "%dx%d", width_, height_);
     av_dict_set(&options, "video_size", resolution, 0);
     av_dict_set(&options, "framerate", std::to_string(fps_).c_str(), 0);
-    av_dict_set(&options, "input_format", "yuyv422", 0);
 
     // 打开摄像头设备
-    AVInputFormat *ifmt = av_find_input_format("v4l2");
-    if (!ifmt) {
-        LogError("Cannot find v4l2 input format");
-        return RET_FAIL;
+    AVInputFormat *ifmt = nullptr;
+    if (!device_format_.empty()) {
+        ifmt = av_find_input_format(device_format_.c_str());
+        if (!ifmt) {
+            LogError("Cannot find %s input format", device_format_.c_str());
+            av_dict_free(&options);
+            return AVERROR_DEMUXER_NOT_FOUND;
+        }
+    }
+    if (!input_format.empty()) {
+        av_dict_set(&options, "input_format", input_format.c_str(), 0);
+    }
+    paced_by_device_ = (ifmt != nullptr);
+
+    int ret = avformat_open_input(&fmt_ctx_, device_name_.c_str(), ifmt, &options);
+    av_dict_free(&options);
+    return ret;
+}
+
+RET_CODE VideoCapturer::OpenCamera()
+{
+    int ret;
+
+    // 候选的输入格式按转换代价排序, 设备不支持的(打开失败)换下一个
+    std::vector<std::string> candidates;
+    std::string offered;
+    if (!input_format_.empty()) {
+        candidates.push_back(input_format_);        // 指定了就只用这个
+    } else if (device_format_ == "v4l2") {
+        candidates = probeInputFormats();
+        for (size_t i = 0; i < candidates.size(); i++) {
+            offered += candidates[i] + " ";
+        }
+#ifdef __linux__
+        if (candidates.empty()) {   // 查询失败时逐个尝试
+            for (size_t i = 0; i < sizeof(kV4l2Formats) / sizeof(kV4l2Formats[0]); i++) {
+                if (std::find(candidates.begin(), candidates.end(), kV4l2Formats[i].name) == candidates.end()) {
+                    candidates.push_back(kV4l2Formats[i].name);
+                }
+            }
+        }
+#endif
+        std::stable_sort(candidates.begin(), candidates.end(),
+                         [this](const std::string &a, const std::string &b) {
+            return inputFormatCost(a) < inputFormatCost(b);
+        });
+    }
+    if (candidates.empty()) {
+        candidates.push_back("");   // 文件或者其他设备, 由demuxer决定
     }
 
-    ret = avformat_open_input(&fmt_ctx_, device_name_.c_str(), ifmt, &options);
+    ret = AVERROR(EINVAL);
+    for (size_t i = 0; i < candidates.size(); i++) {
+        ret = openInput(candidates[i]);
+        if (ret >= 0) {
+            LogInfo("video capture: device offers [%s], use %s", offered.c_str(),
+                    candidates[i].empty() ? "default" : candidates[i].c_str());
+            break;
+        }
+        LogWarn("video capture: open %s with %s failed:%d", device_name_.c_str(), candidates[i].c_str(), ret);
+    }
     if (ret < 0) {
         LogError("Cannot open camera");
         return RET_FAIL;
@@ -98,6 +233,50 @@ RET_CODE VideoCapturer::OpenCamera()
 
     // 获取解码器参数
     AVCodecParameters *codecParams = fmt_ctx_->streams[video_stream_idx]->codecpar;
+    src_width_ = codecParams->width;
+    src_height_ = codecParams->height;
+    src_pix_fmt_ = codecParams->format;
+    AVRational frame_rate = fmt_ctx_->streams[video_stream_idx]->avg_frame_rate;
+    frame_interval_us_ = (frame_rate.num > 0 && frame_rate.den > 0)
+            ? av_rescale(1000000, frame_rate.den, frame_rate.num) : 1000000 / fps_;
+
+    // 分配转换用的Frame
+    frame_ = av_frame_alloc();
+    if (!frame_pool_) {
+        frame_pool_ = new FramePool(width_, height_, pixel_format_, frame_pool_size_);
+    }
+
+    if (codecParams->codec_id == AV_CODEC_ID_RAWVIDEO && src_pix_fmt_ != AV_PIX_FMT_NONE) {
+        // 原始格式不需要解码, 数据包直接送给转换
+        raw_frame_size_ = av_image_get_buffer_size((AVPixelFormat)src_pix_fmt_, src_width_, src_height_, 1);
+        if (raw_frame_size_ <= 0) {
+            LogError("Invalid raw frame %s %dx%d",
+                     av_get_pix_fmt_name((AVPixelFormat)src_pix_fmt_), src_width_, src_height_);
+            return RET_FAIL;
+        }
+        const char *path;
+        if (passThrough(src_pix_fmt_, src_width_, src_height_)) {
+            path = "none";
+        } else if (directConvert(src_pix_fmt_, src_width_, src_height_)) {
+            path = SimdLevelName(VideoConvertGetSimdLevel());
+        } else {
+            path = "sws";
+            sws_ctx_ = sws_getContext(src_width_, src_height_, (AVPixelFormat)src_pix_fmt_,
+                                      width_, height_, (AVPixelFormat)pixel_format_,
+                                      SWS_BILINEAR, nullptr, nullptr, nullptr);
+            if (!sws_ctx_) {
+                LogError("Cannot create sws context");
+                return RET_FAIL;
+            }
+        }
+        raw_input_ = true;
+        LogInfo("video capture: raw %s %dx%d -> %s %dx%d, skip decoder, convert by %s(slices:%d)",
+                av_get_pix_fmt_name((AVPixelFormat)src_pix_fmt_), src_width_, src_height_,
+                av_get_pix_fmt_name((AVPixelFormat)pixel_format_), width_, height_,
+                path, convert_slices_);
+        return RET_OK;
+    }
+    raw_input_ = false;
 
     // 查找解码器
     const AVCodec *codec = avcodec_find_decoder(codecParams->codec_id);
@@ -126,27 +305,9 @@ RET_CODE VideoCapturer::OpenCamera()
         LogError("Could not open codec");
         return RET_FAIL;
     }
-
-    // 分配转换用的Frame
-    frame_ = av_frame_alloc();
-    yuv_frame_ = av_frame_alloc();
-    yuv_frame_->format = AV_PIX_FMT_YUV420P;
-    yuv_frame_->width = width_;
-    yuv_frame_->height = height_;
-    ret = av_frame_get_buffer(yuv_frame_, 0);
-    if (ret < 0) {
-        LogError("Could not allocate frame data");
-        return RET_FAIL;
-    }
-
-    // 创建格式转换上下文
-    sws_ctx_ = sws_getContext(width_, height_, AV_PIX_FMT_YUYV422,
-                             width_, height_, AV_PIX_FMT_YUV420P,
-                             SWS_BILINEAR, nullptr, nullptr, nullptr);
-    if (!sws_ctx_) {
-        LogError("Cannot create sws context");
-        return RET_FAIL;
-    }
+    // 解码后的像素格式(比如MJPEG是yuvj422p)要等第一帧解出来才确定, sws在convertFrame里创建
+    LogInfo("video capture: %s %dx%d, decode by %s",
+            avcodec_get_name(codecParams->codec_id), src_width_, src_height_, codec->name);
 
     return RET_OK;
 }
@@ -158,9 +319,9 @@ void VideoCapturer::CloseCamera()
         frame_ = nullptr;
     }
 
-    if (yuv_frame_) {
-        av_frame_free(&yuv_frame_);
-        yuv_frame_ = nullptr;
+
+    if (codec_ctx_) {
+        avcodec_free_context(&codec_ctx_);
     }
 
     if (fmt_ctx_) {
@@ -177,54 +338,222 @@ void VideoCapturer::CloseCamera()
 void VideoCapturer::Loop()
 {
     AVPacket *packet = av_packet_alloc();
-    
+    if (!paced_by_device_) {
+        timer_.Start(frame_duration_ * 1000);
+    }
+
     while (!request_abort_) {
+        if (!paced_by_device_) {
+            timer_.WaitNext();
+        }
         int ret = av_read_frame(fmt_ctx_, packet);
         if (ret < 0) {
             LogError("Failed to read frame");
+            if (!capture_error_ && event_bus_) {
+                CaptureErrorEvent event;
+                event.media_type = E_VIDEO_TYPE;
+                event.error = ret;
+                event_bus_->Publish(event);
+            }
+            capture_error_ = true;
             std::this_thread::sleep_for(std::chrono::milliseconds(10));
             continue;
         }
-
-        // 解码视频帧
-        ret = avcodec_send_packet(codec_ctx_, packet);
-        if (ret < 0) {
-            LogError("Error sending packet for decoding");
-            continue;
-        }
-
-        while (ret >= 0) {
-            ret = avcodec_receive_frame(codec_ctx_, frame_);
-            if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) {
-                break;
-            } else if (ret < 0) {
-                LogError("Error during decoding");
-                break;
+        capture_error_ = false;
+        int64_t begin_us = TimesUtil::GetTimeMicrosecond();
+        int64_t capture_us = captureTime(packet, begin_us);
+
+        if (raw_input_) {
+            // 原始图像按格式拆成平面指针, 不拷贝
+            if (packet->size >= raw_frame_size_) {
+                frame_->format = src_pix_fmt_;
+                frame_->width = src_width_;
+                frame_->height = src_height_;
+                av_image_fill_arrays(frame_->data, frame_->linesize, packet->data,
+                                     (AVPixelFormat)src_pix_fmt_, src_width_, src_height_, 1);
+                // 引用v4l2的mmap缓冲区, 不用转换时直接送给编码器也不会被libavcodec再拷贝一次
+                if (packet->buf) {
+                    frame_->buf[0] = av_buffer_ref(packet->buf);
+                }
+                outputFrame(frame_, begin_us, capture_us);
+                av_frame_unref(frame_);     // 尽快还给驱动
+            } else {
+                LogWarn("video capture: short frame %d < %d", packet->size, raw_frame_size_);
+            }
+        } else {
+            // MJPEG/H.264需要先解码
+            ret = avcodec_send_packet(codec_ctx_, packet);
+            if (ret < 0) {
+                LogError("Error sending packet for decoding");
             }
-            
-            // 转换格式到YUV420P
-            sws_scale(sws_ctx_, frame_->data, frame_->linesize, 0, height_,
-                     yuv_frame_->data, yuv_frame_->linesize);
-
-            // // 回调数据
-            // if (callback_) {
-            //     callback_(yuv_frame_->data[0], yuv_buf_size_);
-            // }
-
-            
-            // 回调数据
-            if (frame_callback_) {
-                frame_callback_(yuv_frame_, yuv_buf_size_);
+            while (ret >= 0) {
+                ret = avcodec_receive_frame(codec_ctx_, frame_);
+                if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) {
+                    break;
+                } else if (ret < 0) {
+                    LogError("Error during decoding");
+                    break;
+                }
+                outputFrame(frame_, begin_us, capture_us);
             }
         }
 
         av_packet_unref(packet);
-        std::this_thread::sleep_for(std::chrono::milliseconds(static_cast<int>(frame_duration_)));
     }
 
     av_packet_free(&packet);
 }
 
+void VideoCapturer::outputFrame(AVFrame *src, int64_t begin_us, int64_t capture_us)
+{
+    AVFrame *out = src;
+    AVFrame *pool_frame = nullptr;
+    if (passThrough(src->format, src->width, src->height)) {
+        // 已经是编码器要的格式和尺寸, 直接回调
+        passed_.fetch_add(1, std::memory_order_relaxed);
+    } else {
+        // 每帧转换到池子里的新缓冲区, 下游还在用的帧不会被覆盖
+        pool_frame = frame_pool_->Get();
+        if (!pool_frame) {
+            // 下游积压了frame_pool_size帧还没处理完, 丢掉这一帧
+            pool_dropped_.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        int64_t convert_begin = TimesUtil::GetTimeMicrosecond();
+        if (directConvert(src->format, src->width, src->height)) {
+            // 同尺寸的打包422(或者分片的NV12)只是重排, 不需要sws
+            VideoConvertToI420Sliced(src->data, src->linesize, (AVPixelFormat)src->format,
+                                     src->width, src->height, pool_frame->data, pool_frame->linesize,
+                                     convert_executor_, convert_slices_);
+        } else {
+            // 参数不变时直接返回原来的context
+            sws_ctx_ = sws_getCachedContext(sws_ctx_, src->width, src->height, (AVPixelFormat)src->format,
+                                            width_, height_, (AVPixelFormat)pixel_format_,
+                                            SWS_BILINEAR, nullptr, nullptr, nullptr);
+            if (!sws_ctx_) {
+                LogError("Cannot create sws context");
+                av_frame_free(&pool_frame);
+                return;
+            }
+            sws_scale(sws_ctx_, src->data, src->linesize, 0, src->height,
+                      pool_frame->data, pool_frame->linesize);
+        }
+        convert_cost_.Record(TimesUtil::GetTimeMicrosecond() - convert_begin);
+        out = pool_frame;
+    }
+    capture_cost_.Record(TimesUtil::GetTimeMicrosecond() - begin_us);
+
+    // // 回调数据
+    // if (callback_) {
+    //     callback_(yuv_frame_->data[0], yuv_buf_size_);
+    // }
+
+    // 回调数据
+    capture_latency_.Record(TimesUtil::GetTimeMicrosecond() - capture_us);
+    frames_.fetch_add(1, std::memory_order_relaxed);
+    if (frame_callback_) {
+        frame_callback_(out, yuv_buf_size_);
+    }
+    // 下游要继续用的话已经av_frame_clone了自己的引用
+    av_frame_free(&pool_frame);
+
+    int64_t cur_time = TimesUtil::GetTimeMillisecond();
+    if (cur_time - pre_debug_time_ > 5000) {
+        VideoCaptureStats stats;
+        GetCaptureStats(&stats, true);
+        FramePoolStats pool_stats;
+        frame_pool_->GetStats(&pool_stats);
+        LogInfo("video capture(%s): frames:%lld, passed:%lld, dropped:%lld(pool:%lld), pool:%lld/%d in flight:%lld, "
+                "cost p50:%lldus p99:%lldus max:%lldus, "
+                "convert p50:%lldus p99:%lldus max:%lldus, latency p50:%lldus p99:%lldus max:%lldus",
+                raw_input_ ? "raw" : "decode", stats.frames, stats.passed, stats.dropped, stats.pool_dropped,
+                pool_stats.allocated, frame_pool_size_, pool_stats.in_flight,
+                stats.cost.p50, stats.cost.p99, stats.cost.max,
+                stats.convert.p50, stats.convert.p99, stats.convert.max,
+                stats.latency.p50, stats.latency.p99, stats.latency.max);
+        pre_debug_time_ = cur_time;
+    }
+}
+
+bool VideoCapturer::passThrough(int src_format, int src_width, int src_height)
+{
+    return src_format == pixel_format_ && src_width == width_ && src_height == height_;
+}
+
+bool VideoCapturer::directConvert(int src_format, int src_width, int src_height)
+{
+    if (pixel_format_ != AV_PIX_FMT_YUV420P || !VideoConvertSupported((AVPixelFormat)src_format)
+            || src_width != width_ || src_height != height_) {
+        return false;
+    }
+    if (src_format == AV_PIX_FMT_NV12) {
+        return convert_executor_ && convert_slices_ > 1;
+    }
+    return true;
+}
+
+int64_t VideoCapturer::captureTime(const AVPacket *packet, int64_t begin_us)
+{
+    if (!paced_by_device_ || packet->pts == AV_NOPTS_VALUE) {
+        return begin_us;
+    }
+    AVRational time_base = fmt_ctx_->streams[packet->stream_index]->time_base;
+    int64_t ts = av_rescale_q(packet->pts, time_base, AVRational{1, 1000000});
+    if (ts_clock_ == kClockUnknown) {
+        // v4l2的时间戳一般是单调时钟, 也有驱动用系统时间; 和现在相差10秒以内才认为是这个时钟
+        if (llabs(ts - begin_us) < 10000000) {
+            ts_clock_ = kClockMonotonic;
+        } else if (llabs(ts - av_gettime()) < 10000000) {
+            ts_clock_ = kClockRealtime;
+        } else {
+            ts_clock_ = kClockNone;
+            LogWarn("video capture: unknown timestamp clock, latency measured from read");
+        }
+    }
+    if (ts_clock_ == kClockNone) {
+        return begin_us;
+    }
+    int64_t capture_us = (ts_clock_ == kClockMonotonic) ? ts : begin_us - (av_gettime() - ts);
+
+    // 两帧之间超过1.5个帧间隔说明驱动没有空闲缓冲区, 丢了帧
+    if (pre_capture_us_ >= 0) {
+        int64_t gap = capture_us - pre_capture_us_;
+        if (gap * 2 > frame_interval_us_ * 3) {
+            dropped_.fetch_add((gap + frame_interval_us_ / 2) / frame_interval_us_ - 1,
+                               std::memory_order_relaxed);
+        }
+    }
+    pre_capture_us_ = capture_us;
+    return capture_us;
+}
+
+void VideoCapturer::GetCaptureStats(VideoCaptureStats *stats, bool reset)
+{
+    if (reset) {
+        stats->frames = frames_.exchange(0, std::memory_order_relaxed);
+        stats->passed = passed_.exchange(0, std::memory_order_relaxed);
+        stats->dropped = dropped_.exchange(0, std::memory_order_relaxed);
+        stats->pool_dropped = pool_dropped_.exchange(0, std::memory_order_relaxed);
+    } else {
+        stats->frames = frames_.load(std::memory_order_relaxed);
+        stats->passed = passed_.load(std::memory_order_relaxed);
+        stats->dropped = dropped_.load(std::memory_order_relaxed);
+        stats->pool_dropped = pool_dropped_.load(std::memory_order_relaxed);
+    }
+    capture_cost_.GetStats(&stats->cost, reset);
+    convert_cost_.GetStats(&stats->convert, reset);
+    capture_latency_.GetStats(&stats->latency, reset);
+}
+
+void VideoCapturer::GetFramePoolStats(FramePoolStats *stats)
+{
+    if (frame_pool_) {
+        frame_pool_->GetStats(stats);
+    } else {
+        memset(stats, 0, sizeof(*stats));
+    }
+}
+
 void VideoCapturer::AddCallback(function<void(uint8_t*, int32_t)> callback)
 {
     callback_ = callback;
@@ -234,3 +563,13 @@ void VideoCapturer::AddCallback1(function<void(AVFrame *, int32_t)> callback)
 {
     frame_callback_ = callback; 
 }
+
+void VideoCapturer::SetEventBus(EventBus *event_bus)
+{
+    event_bus_ = event_bus;
+}
+
+void VideoCapturer::SetExecutor(Executor *executor)
+{
+    convert_executor_ = executor;
+}
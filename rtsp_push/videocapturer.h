@@ -2,8 +2,14 @@
 #define VIDEOCAPTURER_H
 
 #include <functional>
+#include <vector>
+#include <string>
 #include "commonlooper.h"
 #include "mediabase.h"
+#include "eventbus.h"
+#include "histogram.h"
+#include "deadlinetimer.h"
+#include "framepool.h"
 extern "C" {
 #include <libavdevice/avdevice.h>
 #include <libavformat/avformat.h>
@@ -12,6 +18,19 @@ extern "C" {
 
 using std::function;
 
+class Executor;
+
+typedef struct video_capture_stats
+{
+    int64_t frames;             // 回调的帧数
+    int64_t passed;             // 其中不用转换直接回调的帧数
+    int64_t dropped;            // 按设备时间戳的间隔推算出的驱动丢帧数
+    int64_t pool_dropped;       // 下游积压, 帧池取不到帧丢掉的帧数
+    HistogramStats cost;        // 每帧从读到数据包到可以编码的耗时(us), 包括解码和转换, 不含回调里的编码
+    HistogramStats convert;     // 每帧格式转换(sws或VideoConvertToI420)的耗时(us), 不用转换的帧不统计
+    HistogramStats latency;     // 从设备采集(驱动时间戳)到回调的时延(us)
+}VideoCaptureStats;
+
 class VideoCapturer: public CommonLooper
 {
 public:
@@ -20,25 +39,58 @@ public:
     /**
      * @brief Init
      * @param "device_name", 设备名称，如"/dev/video0"
+     *          "device_format", 输入格式, 缺省为"v4l2"; 为空时按文件打开(测试用), 按帧率定时读取
      *          "width", 宽度，缺省为1280
      *          "height", 高度，缺省为720
-     *          "format", 像素格式，AVPixelFormat对应的值，缺省为AV_PIX_FMT_YUV420P
+     *          "pixel_format", 输出的像素格式(编码器的输入格式)，AVPixelFormat对应的值，缺省为AV_PIX_FMT_YUV420P
+     *          "input_format", 设备的输入格式, 比如"yuyv422"、"nv12"、"mjpeg"; 缺省为空,
+     *                  查询设备支持的格式, 按转换到pixel_format的代价选择: 相同 < 重排 < sws < 解码
      *          "fps", 帧数，缺省为25
+     *          "convert_slices", 转换成YUV420P时分成几片并行(需要SetExecutor), 缺省为1
+     *          "frame_pool_size", 转换输出的帧池里最多有多少帧在下游没处理完, 缺省为8, 0为不限制
+     *          "thread.xxx", 采集线程的调度属性, 见CommonLooper::SetThreadProperties
      * @return
      */
     RET_CODE Init(const Properties& properties);
     virtual void Loop();
     void AddCallback(function<void(uint8_t*, int32_t)> callback);
+    // frame带引用计数, 只保证在回调期间有效; 要交给其他线程处理时用av_frame_clone增加引用,
+    // 不会拷贝图像数据, 采集也不会覆盖这一帧
     void AddCallback1(function<void(AVFrame*, int32_t)> callback);
+    // 采集出错时发布CaptureErrorEvent
+    void SetEventBus(EventBus *event_bus);
+    // 格式转换分片时和这个线程池一起转换, Init之前调用(NV12是否用VideoConvertToI420取决于它)
+    void SetExecutor(Executor *executor);
+    // reset为true时读取后清零
+    void GetCaptureStats(VideoCaptureStats *stats, bool reset = false);
+    // 转换输出帧池的大小和在途帧数
+    void GetFramePoolStats(FramePoolStats *stats);
 private:
     RET_CODE OpenCamera();
     void CloseCamera();
+    // 设备支持的输入格式(v4l2 VIDIOC_ENUM_FMT), 查询失败返回空
+    std::vector<std::string> probeInputFormats();
+    int inputFormatCost(const std::string &input_format);
+    int openInput(const std::string &input_format);
+    // 需要时转换成pixel_format_并回调, begin_us是读到数据包的时间, capture_us是采集时间(单调时钟)
+    void outputFrame(AVFrame *src, int64_t begin_us, int64_t capture_us);
+    // 格式和尺寸都和输出一致, 不用转换
+    bool passThrough(int src_format, int src_width, int src_height);
+    // 输出YUV420P时, 同尺寸的YUYV422/UYVY422用VideoConvertToI420, 其他的用sws
+    // NV12单线程时sws一样快(bench/README.md), 只有分片转换时才用VideoConvertToI420
+    bool directConvert(int src_format, int src_width, int src_height);
+    // 数据包的设备时间戳换算成单调时钟, 同时按时间戳的间隔统计丢帧
+    int64_t captureTime(const AVPacket *packet, int64_t begin_us);
     
     std::string device_name_;
+    std::string device_format_;
+    std::string input_format_;
     int width_ = 1280;
     int height_ = 720;
     int pixel_format_ = AV_PIX_FMT_YUV420P;
     int fps_ = 25;
+    int convert_slices_ = 1;
+    int frame_pool_size_ = 8;
     double frame_duration_ = 40;
 
     AVFormatContext *fmt_ctx_ = nullptr;
@@ -54,7 +106,42 @@ private:
     // 添加格式转换相关成员
     SwsContext *sws_ctx_ = nullptr;
     AVFrame *frame_ = nullptr;
-    AVFrame *yuv_frame_ = nullptr;
+    FramePool *frame_pool_ = nullptr;     // 转换的输出
+
+    // 原始格式(yuyv422等)的数据包直接当作图像, 不经过rawvideo解码器; MJPEG/H.264才需要解码
+    bool raw_input_ = false;
+    int src_width_ = 0;
+    int src_height_ = 0;
+    int src_pix_fmt_ = AV_PIX_FMT_NONE;
+    int raw_frame_size_ = 0;        // 一帧原始图像的字节数
+
+    // 设备由av_read_frame阻塞到下一帧, 不需要再睡; 文件按帧率的绝对时间点读取
+    bool paced_by_device_ = true;
+    DeadlineTimer timer_;
+
+    // 设备时间戳用的时钟, 第一帧时判断
+    enum {
+        kClockUnknown,
+        kClockMonotonic,
+        kClockRealtime,
+        kClockNone          // 不是当前时间(文件), 按读到的时间算
+    };
+    int ts_clock_ = kClockUnknown;
+    int64_t pre_capture_us_ = -1;
+    int64_t frame_interval_us_ = 40000;
+
+    std::atomic<int64_t> frames_{0};
+    std::atomic<int64_t> passed_{0};
+    std::atomic<int64_t> dropped_{0};
+    std::atomic<int64_t> pool_dropped_{0};
+    LatencyHistogram capture_cost_;
+    LatencyHistogram convert_cost_;
+    LatencyHistogram capture_latency_;
+    int64_t pre_debug_time_ = 0;
+
+    EventBus *event_bus_ = nullptr;
+    Executor *convert_executor_ = nullptr;    // 分片转换用, 和CommonLooper::executor_(协作模式)无关
+    bool capture_error_ = false;    // 已经发布过出错事件, 恢复正常前不再发布
 };
 
 #endif // VIDEOCAPTURER_H
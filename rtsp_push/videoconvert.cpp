@@ -0,0 +1,344 @@
+﻿#include <string.h>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <memory>
+#include "videoconvert.h"
+#include "executor.h"
+
+#ifdef SIMD_X86
+#include <emmintrin.h>
+#include <immintrin.h>
+#endif
+
+// 打包422格式的两行 -> I420的两行亮度和一行色度, 按像素[start, width)转换, start是偶数, SIMD实现用来处理尾巴
+// 只剩一行时(高度是奇数)s1 == s0, y1 == y0
+typedef void (*Packed422Func)(const uint8_t *s0, const uint8_t *s1, uint8_t *y0, uint8_t *y1,
+                              uint8_t *u, uint8_t *v, int start, int width);
+// NV12的一行UVUV... -> U、V两行, 按色度下标[start, end)转换
+typedef void (*SplitUvFunc)(const uint8_t *uv, uint8_t *u, uint8_t *v, int start, int end);
+
+// y_off: 亮度在每两个字节里的位置; c_off: U在每四个字节里的位置, V在c_off+2
+static inline void packed422RowC(const uint8_t *s0, const uint8_t *s1, uint8_t *y0, uint8_t *y1,
+                                 uint8_t *u, uint8_t *v, int start, int width, int y_off, int c_off)
+{
+    for(int x = start; x < width; x++) {
+        y0[x] = s0[x * 2 + y_off];
+        y1[x] = s1[x * 2 + y_off];
+    }
+    for(int i = start / 2; i < (width + 1) / 2; i++) {
+        u[i] = (uint8_t)((s0[i * 4 + c_off] + s1[i * 4 + c_off] + 1) >> 1);
+        v[i] = (uint8_t)((s0[i * 4 + c_off + 2] + s1[i * 4 + c_off + 2] + 1) >> 1);
+    }
+}
+
+static void yuyvRowC(const uint8_t *s0, const uint8_t *s1, uint8_t *y0, uint8_t *y1,
+                     uint8_t *u, uint8_t *v, int start, int width)
+{
+    packed422RowC(s0, s1, y0, y1, u, v, start, width, 0, 1);
+}
+
+static void uyvyRowC(const uint8_t *s0, const uint8_t *s1, uint8_t *y0, uint8_t *y1,
+                     uint8_t *u, uint8_t *v, int start, int width)
+{
+    packed422RowC(s0, s1, y0, y1, u, v, start, width, 1, 0);
+}
+
+static void splitUvC(const uint8_t *uv, uint8_t *u, uint8_t *v, int start, int end)
+{
+    for(int i = start; i < end; i++) {
+        u[i] = uv[i * 2];
+        v[i] = uv[i * 2 + 1];
+    }
+}
+
+#ifdef SIMD_X86
+// ---------------- SSE2 ----------------
+// 每次16个像素: 每行32字节, 输出16个亮度, 8个U, 8个V
+// 色度先用pavgb对上下两行整体取平均(亮度字节顺带算了, 不用), 再拆开
+static inline void packed422RowSse2(const uint8_t *s0, const uint8_t *s1, uint8_t *y0, uint8_t *y1,
+                                    uint8_t *u, uint8_t *v, int start, int width, bool uyvy)
+{
+    const __m128i mask = _mm_set1_epi16(0x00FF);
+    int x = start;
+    for(; x + 16 <= width; x += 16) {
+        __m128i a0 = _mm_loadu_si128((const __m128i *)(s0 + x * 2));
+        __m128i a1 = _mm_loadu_si128((const __m128i *)(s0 + x * 2 + 16));
+        __m128i b0 = _mm_loadu_si128((const __m128i *)(s1 + x * 2));
+        __m128i b1 = _mm_loadu_si128((const __m128i *)(s1 + x * 2 + 16));
+        __m128i c0 = _mm_avg_epu8(a0, b0);
+        __m128i c1 = _mm_avg_epu8(a1, b1);
+        __m128i ya, yb;
+        if(uyvy) {
+            ya = _mm_packus_epi16(_mm_srli_epi16(a0, 8), _mm_srli_epi16(a1, 8));
+            yb = _mm_packus_epi16(_mm_srli_epi16(b0, 8), _mm_srli_epi16(b1, 8));
+            c0 = _mm_and_si128(c0, mask);
+            c1 = _mm_and_si128(c1, mask);
+        } else {
+            ya = _mm_packus_epi16(_mm_and_si128(a0, mask), _mm_and_si128(a1, mask));
+            yb = _mm_packus_epi16(_mm_and_si128(b0, mask), _mm_and_si128(b1, mask));
+            c0 = _mm_srli_epi16(c0, 8);
+            c1 = _mm_srli_epi16(c1, 8);
+        }
+        _mm_storeu_si128((__m128i *)(y0 + x), ya);
+        _mm_storeu_si128((__m128i *)(y1 + x), yb);
+        __m128i uv = _mm_packus_epi16(c0, c1);      // U0 V0 U1 V1 ... U7 V7
+        uv = _mm_packus_epi16(_mm_and_si128(uv, mask), _mm_srli_epi16(uv, 8));  // U0..U7 V0..V7
+        _mm_storel_epi64((__m128i *)(u + x / 2), uv);
+        _mm_storel_epi64((__m128i *)(v + x / 2), _mm_srli_si128(uv, 8));
+    }
+    packed422RowC(s0, s1, y0, y1, u, v, x, width, uyvy ? 1 : 0, uyvy ? 0 : 1);
+}
+
+static void yuyvRowSse2(const uint8_t *s0, const uint8_t *s1, uint8_t *y0, uint8_t *y1,
+                        uint8_t *u, uint8_t *v, int start, int width)
+{
+    packed422RowSse2(s0, s1, y0, y1, u, v, start, width, false);
+}
+
+static void uyvyRowSse2(const uint8_t *s0, const uint8_t *s1, uint8_t *y0, uint8_t *y1,
+                        uint8_t *u, uint8_t *v, int start, int width)
+{
+    packed422RowSse2(s0, s1, y0, y1, u, v, start, width, true);
+}
+
+static void splitUvSse2(const uint8_t *uv, uint8_t *u, uint8_t *v, int start, int end)
+{
+    const __m128i mask = _mm_set1_epi16(0x00FF);
+    int i = start;
+    for(; i + 16 <= end; i += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i *)(uv + i * 2));
+        __m128i b = _mm_loadu_si128((const __m128i *)(uv + i * 2 + 16));
+        _mm_storeu_si128((__m128i *)(u + i), _mm_packus_epi16(_mm_and_si128(a, mask), _mm_and_si128(b, mask)));
+        _mm_storeu_si128((__m128i *)(v + i), _mm_packus_epi16(_mm_srli_epi16(a, 8), _mm_srli_epi16(b, 8)));
+    }
+    splitUvC(uv, u, v, i, end);
+}
+
+// ---------------- AVX2 ----------------
+// packus按128位通道分别打包, 结果的64位块是a低 b低 a高 b高, 用permute4x64(0xD8)恢复成a b的顺序
+#define VIDEO_PACK_ORDER 0xD8
+
+// 每次32个像素: 每行64字节, 输出32个亮度, 16个U, 16个V
+SIMD_TARGET_AVX2 static inline void packed422RowAvx2(const uint8_t *s0, const uint8_t *s1, uint8_t *y0, uint8_t *y1,
+                                                     uint8_t *u, uint8_t *v, int start, int width, bool uyvy)
+{
+    const __m256i mask = _mm256_set1_epi16(0x00FF);
+    int x = start;
+    for(; x + 32 <= width; x += 32) {
+        __m256i a0 = _mm256_loadu_si256((const __m256i *)(s0 + x * 2));
+        __m256i a1 = _mm256_loadu_si256((const __m256i *)(s0 + x * 2 + 32));
+        __m256i b0 = _mm256_loadu_si256((const __m256i *)(s1 + x * 2));
+        __m256i b1 = _mm256_loadu_si256((const __m256i *)(s1 + x * 2 + 32));
+        __m256i c0 = _mm256_avg_epu8(a0, b0);
+        __m256i c1 = _mm256_avg_epu8(a1, b1);
+        __m256i ya, yb;
+        if(uyvy) {
+            ya = _mm256_packus_epi16(_mm256_srli_epi16(a0, 8), _mm256_srli_epi16(a1, 8));
+            yb = _mm256_packus_epi16(_mm256_srli_epi16(b0, 8), _mm256_srli_epi16(b1, 8));
+            c0 = _mm256_and_si256(c0, mask);
+            c1 = _mm256_and_si256(c1, mask);
+        } else {
+            ya = _mm256_packus_epi16(_mm256_and_si256(a0, mask), _mm256_and_si256(a1, mask));
+            yb = _mm256_packus_epi16(_mm256_and_si256(b0, mask), _mm256_and_si256(b1, mask));
+            c0 = _mm256_srli_epi16(c0, 8);
+            c1 = _mm256_srli_epi16(c1, 8);
+        }
+        _mm256_storeu_si256((__m256i *)(y0 + x), _mm256_permute4x64_epi64(ya, VIDEO_PACK_ORDER));
+        _mm256_storeu_si256((__m256i *)(y1 + x), _mm256_permute4x64_epi64(yb, VIDEO_PACK_ORDER));
+        __m256i uv = _mm256_permute4x64_epi64(_mm256_packus_epi16(c0, c1), VIDEO_PACK_ORDER);
+        uv = _mm256_packus_epi16(_mm256_and_si256(uv, mask), _mm256_srli_epi16(uv, 8));
+        uv = _mm256_permute4x64_epi64(uv, VIDEO_PACK_ORDER);   // U0..U15 V0..V15
+        _mm_storeu_si128((__m128i *)(u + x / 2), _mm256_castsi256_si128(uv));
+        _mm_storeu_si128((__m128i *)(v + x / 2), _mm256_extracti128_si256(uv, 1));
+    }
+    packed422RowC(s0, s1, y0, y1, u, v, x, width, uyvy ? 1 : 0, uyvy ? 0 : 1);
+}
+
+SIMD_TARGET_AVX2 static void yuyvRowAvx2(const uint8_t *s0, const uint8_t *s1, uint8_t *y0, uint8_t *y1,
+                                         uint8_t *u, uint8_t *v, int start, int width)
+{
+    packed422RowAvx2(s0, s1, y0, y1, u, v, start, width, false);
+}
+
+SIMD_TARGET_AVX2 static void uyvyRowAvx2(const uint8_t *s0, const uint8_t *s1, uint8_t *y0, uint8_t *y1,
+                                         uint8_t *u, uint8_t *v, int start, int width)
+{
+    packed422RowAvx2(s0, s1, y0, y1, u, v, start, width, true);
+}
+
+SIMD_TARGET_AVX2 static void splitUvAvx2(const uint8_t *uv, uint8_t *u, uint8_t *v, int start, int end)
+{
+    const __m256i mask = _mm256_set1_epi16(0x00FF);
+    int i = start;
+    for(; i + 32 <= end; i += 32) {
+        __m256i a = _mm256_loadu_si256((const __m256i *)(uv + i * 2));
+        __m256i b = _mm256_loadu_si256((const __m256i *)(uv + i * 2 + 32));
+        __m256i uu = _mm256_packus_epi16(_mm256_and_si256(a, mask), _mm256_and_si256(b, mask));
+        __m256i vv = _mm256_packus_epi16(_mm256_srli_epi16(a, 8), _mm256_srli_epi16(b, 8));
+        _mm256_storeu_si256((__m256i *)(u + i), _mm256_permute4x64_epi64(uu, VIDEO_PACK_ORDER));
+        _mm256_storeu_si256((__m256i *)(v + i), _mm256_permute4x64_epi64(vv, VIDEO_PACK_ORDER));
+    }
+    splitUvC(uv, u, v, i, end);
+}
+#endif
+
+static std::atomic<int> &currentSimdLevel()
+{
+    static std::atomic<int> s_level(CpuSimdLevel());
+    return s_level;
+}
+
+static Packed422Func selectPacked422(AVPixelFormat src_fmt, SimdLevel level)
+{
+    bool uyvy = (src_fmt == AV_PIX_FMT_UYVY422);
+#ifdef SIMD_X86
+    if(level >= SIMD_AVX2) {
+        return uyvy ? uyvyRowAvx2 : yuyvRowAvx2;
+    }
+    if(level >= SIMD_SSE2) {
+        return uyvy ? uyvyRowSse2 : yuyvRowSse2;
+    }
+#endif
+    return uyvy ? uyvyRowC : yuyvRowC;
+}
+
+static SplitUvFunc selectSplitUv(SimdLevel level)
+{
+#ifdef SIMD_X86
+    if(level >= SIMD_AVX2) {
+        return splitUvAvx2;
+    }
+    if(level >= SIMD_SSE2) {
+        return splitUvSse2;
+    }
+#endif
+    return splitUvC;
+}
+
+bool VideoConvertSupported(AVPixelFormat src_fmt)
+{
+    return src_fmt == AV_PIX_FMT_YUYV422 || src_fmt == AV_PIX_FMT_UYVY422 || src_fmt == AV_PIX_FMT_NV12;
+}
+
+int VideoConvertToI420(const uint8_t *const src[], const int src_linesize[], AVPixelFormat src_fmt,
+                       int width, int height, uint8_t *const dst[], const int dst_linesize[],
+                       int slice_y, int slice_h)
+{
+    if(!VideoConvertSupported(src_fmt) || width <= 0 || height <= 0
+            || slice_y < 0 || (slice_y & 1) || slice_h < 0 || slice_y + slice_h > height) {
+        return -1;
+    }
+    SimdLevel level = (SimdLevel)currentSimdLevel().load(std::memory_order_relaxed);
+    int slice_end = slice_y + slice_h;
+    if(src_fmt == AV_PIX_FMT_NV12) {
+        for(int y = slice_y; y < slice_end; y++) {
+            memcpy(dst[0] + (int64_t)y * dst_linesize[0], src[0] + (int64_t)y * src_linesize[0], width);
+        }
+        SplitUvFunc func = selectSplitUv(level);
+        int chroma_width = (width + 1) / 2;
+        for(int y = slice_y / 2; y < (slice_end + 1) / 2; y++) {
+            func(src[1] + (int64_t)y * src_linesize[1],
+                 dst[1] + (int64_t)y * dst_linesize[1], dst[2] + (int64_t)y * dst_linesize[2],
+                 0, chroma_width);
+        }
+        return 0;
+    }
+    Packed422Func func = selectPacked422(src_fmt, level);
+    for(int y = slice_y; y < slice_end; y += 2) {
+        const uint8_t *s0 = src[0] + (int64_t)y * src_linesize[0];
+        uint8_t *y0 = dst[0] + (int64_t)y * dst_linesize[0];
+        bool last = (y + 1 >= height);      // 高度是奇数时最后一行单独成对
+        func(s0, last ? s0 : s0 + src_linesize[0], y0, last ? y0 : y0 + dst_linesize[0],
+             dst[1] + (int64_t)(y / 2) * dst_linesize[1], dst[2] + (int64_t)(y / 2) * dst_linesize[2],
+             0, width);
+    }
+    return 0;
+}
+
+// 分片任务可能在调用者返回之后才被executor执行(分片已经被别人领完), 状态用shared_ptr保存
+typedef struct slice_job
+{
+    const uint8_t *src[2];
+    int src_linesize[2];
+    AVPixelFormat src_fmt;
+    int width;
+    int height;
+    uint8_t *dst[3];
+    int dst_linesize[3];
+    int slices;
+    int slice_h;
+    std::atomic<int> next;      // 下一个没人领的分片
+    std::mutex mutex;
+    std::condition_variable cond;
+    int done;
+    int ret;
+}SliceJob;
+
+static void runSlices(SliceJob *job)
+{
+    int i;
+    while((i = job->next.fetch_add(1)) < job->slices) {
+        int y = i * job->slice_h;
+        int h = job->height - y < job->slice_h ? job->height - y : job->slice_h;
+        int ret = VideoConvertToI420(job->src, job->src_linesize, job->src_fmt, job->width, job->height,
+                                     job->dst, job->dst_linesize, y, h);
+        std::lock_guard<std::mutex> lock(job->mutex);
+        if(ret < 0) {
+            job->ret = ret;
+        }
+        if(++job->done == job->slices) {
+            job->cond.notify_all();
+        }
+    }
+}
+
+int VideoConvertToI420Sliced(const uint8_t *const src[], const int src_linesize[], AVPixelFormat src_fmt,
+                             int width, int height, uint8_t *const dst[], const int dst_linesize[],
+                             Executor *executor, int slices)
+{
+    if(slices > (height + 1) / 2) {
+        slices = (height + 1) / 2;
+    }
+    if(!executor || slices <= 1) {
+        return VideoConvertToI420(src, src_linesize, src_fmt, width, height, dst, dst_linesize, 0, height);
+    }
+    std::shared_ptr<SliceJob> job = std::make_shared<SliceJob>();
+    job->src[0] = src[0];
+    job->src_linesize[0] = src_linesize[0];
+    job->src[1] = (src_fmt == AV_PIX_FMT_NV12) ? src[1] : NULL;     // 打包格式只有一个平面
+    job->src_linesize[1] = (src_fmt == AV_PIX_FMT_NV12) ? src_linesize[1] : 0;
+    job->src_fmt = src_fmt;
+    job->width = width;
+    job->height = height;
+    for(int i = 0; i < 3; i++) {
+        job->dst[i] = dst[i];
+        job->dst_linesize[i] = dst_linesize[i];
+    }
+    job->slice_h = (((height + slices - 1) / slices) + 1) & ~1;     // 分片的行数是偶数, 色度行不跨片
+    job->slices = (height + job->slice_h - 1) / job->slice_h;
+    job->next = 0;
+    job->done = 0;
+    job->ret = 0;
+    for(int i = 1; i < job->slices; i++) {
+        // Shutdown之后投递失败也没关系, 剩下的分片由调用线程自己转换
+        executor->Post([job]() { runSlices(job.get()); });
+    }
+    runSlices(job.get());
+    std::unique_lock<std::mutex> lock(job->mutex);
+    job->cond.wait(lock, [&job]() { return job->done == job->slices; });
+    return job->ret;
+}
+
+SimdLevel VideoConvertGetSimdLevel()
+{
+    return (SimdLevel)currentSimdLevel().load(std::memory_order_relaxed);
+}
+
+void VideoConvertSetSimdLevel(SimdLevel level)
+{
+    if(level > CpuSimdLevel()) {
+        level = CpuSimdLevel();
+    }
+    currentSimdLevel().store(level, std::memory_order_relaxed);
+}
@@ -0,0 +1,50 @@
+﻿#ifndef VIDEOCONVERT_H
+#define VIDEOCONVERT_H
+
+#include <stdint.h>
+#include "simdlevel.h"
+extern "C" {
+#include <libavutil/pixfmt.h>
+}
+
+class Executor;
+
+// 采集格式 -> YUV420P(I420), 代替同尺寸的sws_scale
+// YUYV422/UYVY422: 拆出亮度, 色度上下两行取平均((a+b+1)>>1); NV12: 亮度拷贝, 色度拆成两个平面
+// 这些转换只是重排加垂直方向的平均, 有SSE2/AVX2实现, 运行时按CPU支持的指令集选择, 所有实现的输出逐位相同
+// 同尺寸时和sws_scale(SWS_BILINEAR)的输出逐位相同(bench/videoconvert_bench对比过)
+// 打包422比sws快1.5~10倍; NV12单线程和sws一样快, 只在需要分片转换时才有意义
+
+// 是否支持这个输入格式
+bool VideoConvertSupported(AVPixelFormat src_fmt);
+/**
+ * @brief VideoConvertToI420 转换一片(slice)
+ * @param src           输入的平面, 比如AVFrame::data; 打包格式只有src[0]
+ * @param src_linesize  输入每个平面一行的字节数
+ * @param src_fmt       AV_PIX_FMT_YUYV422/AV_PIX_FMT_UYVY422/AV_PIX_FMT_NV12
+ * @param width         宽
+ * @param height        整幅图的高
+ * @param dst           输出的Y、U、V平面
+ * @param dst_linesize  输出每个平面一行的字节数
+ * @param slice_y       这一片的第一行, 必须是偶数
+ * @param slice_h       这一片的行数, 除了最后一片必须是偶数
+ * @return 0成功, -1格式不支持或参数错误
+ */
+int VideoConvertToI420(const uint8_t *const src[], const int src_linesize[], AVPixelFormat src_fmt,
+                       int width, int height, uint8_t *const dst[], const int dst_linesize[],
+                       int slice_y, int slice_h);
+/**
+ * @brief VideoConvertToI420Sliced 整幅图按水平条带分成slices片, 调用线程和executor一起转换, 全部完成后返回
+ *        executor为NULL或者slices<=1时在调用线程转换
+ *        调用线程自己也领取分片, 只等已经在执行的分片, 在executor的工作线程里调用也不会死锁
+ * @return 同VideoConvertToI420
+ */
+int VideoConvertToI420Sliced(const uint8_t *const src[], const int src_linesize[], AVPixelFormat src_fmt,
+                             int width, int height, uint8_t *const dst[], const int dst_linesize[],
+                             Executor *executor, int slices);
+// 当前使用的指令集
+SimdLevel VideoConvertGetSimdLevel();
+// 限制使用的指令集(比如对比测试), 超过CPU支持的按CPU支持的
+void VideoConvertSetSimdLevel(SimdLevel level);
+
+#endif // VIDEOCONVERT_H
@@ -0,0 +1,109 @@
+﻿#include <string.h>
+#include "videoencodelooper.h"
+#include "dlog.h"
+#include "timesutil.h"
+
+VideoEncodeLooper::VideoEncodeLooper()
+{
+    thread_name_ = "video_encode";
+}
+
+VideoEncodeLooper::~VideoEncodeLooper()
+{
+    Stop();
+    if(queue_) {
+        delete queue_;
+        queue_ = NULL;
+    }
+}
+
+RET_CODE VideoEncodeLooper::Init(const Properties &properties)
+{
+    int queue_size = properties.GetProperty("queue_size", 3);
+    std::string drop_policy = properties.GetProperty("drop_policy", "drop_oldest");
+    if(queue_size <= 0) {
+        LogError("VideoEncodeLooper: invalid queue_size:%d", queue_size);
+        return RET_ERR_ARGUMENTOUTOFRANGE;
+    }
+    FrameQueuePolicy policy = FrameQueuePolicyFromName(drop_policy);
+    if(drop_policy != FrameQueuePolicyName(policy)) {
+        LogWarn("VideoEncodeLooper: unknown drop_policy:%s, use %s",
+                drop_policy.c_str(), FrameQueuePolicyName(policy));
+    }
+    queue_ = new FrameQueue(queue_size, policy);
+    SetThreadProperties(properties.GetChildren("thread"));
+    LogInfo("VideoEncodeLooper: queue_size:%d, drop_policy:%s", queue_size, FrameQueuePolicyName(policy));
+    return RET_OK;
+}
+
+void VideoEncodeLooper::Stop()
+{
+    // 唤醒阻塞在队列上的采集线程和编码线程
+    if(queue_) {
+        queue_->Abort();
+    }
+    CommonLooper::Stop();
+}
+
+bool VideoEncodeLooper::Push(AVFrame *frame, int64_t pts)
+{
+    if(!queue_) {
+        return false;
+    }
+    AVFrame *ref = av_frame_clone(frame);
+    if(!ref) {
+        LogError("VideoEncodeLooper: av_frame_clone failed");
+        return false;
+    }
+    ref->pts = pts;
+    return queue_->Push(ref);
+}
+
+void VideoEncodeLooper::AddCallback(function<void(AVFrame *, int64_t)> callback)
+{
+    callback_ = callback;
+}
+
+void VideoEncodeLooper::Loop()
+{
+    pre_debug_time_ = TimesUtil::GetTimeMillisecond();
+    while(!request_abort_) {
+        AVFrame *frame = NULL;
+        int ret = queue_->Pop(&frame, 100);
+        if(ret < 0) {
+            break;
+        }
+        if(ret > 0) {
+            int64_t begin_us = TimesUtil::GetTimeMicrosecond();
+            if(callback_) {
+                callback_(frame, frame->pts);
+            }
+            encode_cost_.Record(TimesUtil::GetTimeMicrosecond() - begin_us);
+            av_frame_free(&frame);
+        }
+
+        int64_t cur_time = TimesUtil::GetTimeMillisecond();
+        if(cur_time - pre_debug_time_ > 5000) {
+            VideoEncodeStats stats;
+            GetEncodeStats(&stats, true);
+            LogInfo("video encode(%s): pushed:%lld, encoded:%lld, dropped:%lld, blocked:%lld, "
+                    "depth:%d max:%d, encode p50:%lldus p99:%lldus max:%lldus",
+                    FrameQueuePolicyName(queue_->GetPolicy()), stats.queue.pushed, stats.queue.popped,
+                    stats.queue.dropped, stats.queue.blocked, stats.queue.depth, stats.queue.max_depth,
+                    stats.encode.p50, stats.encode.p99, stats.encode.max);
+            pre_debug_time_ = cur_time;
+        }
+    }
+    // 退出时队列里剩下的帧不再编码
+    queue_->Flush();
+}
+
+void VideoEncodeLooper::GetEncodeStats(VideoEncodeStats *stats, bool reset)
+{
+    if(queue_) {
+        queue_->GetStats(&stats->queue, reset);
+    } else {
+        memset(&stats->queue, 0, sizeof(stats->queue));
+    }
+    encode_cost_.GetStats(&stats->encode, reset);
+}
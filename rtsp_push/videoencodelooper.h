@@ -0,0 +1,53 @@
+﻿#ifndef VIDEOENCODELOOPER_H
+#define VIDEOENCODELOOPER_H
+
+#include <functional>
+#include "commonlooper.h"
+#include "mediabase.h"
+#include "histogram.h"
+#include "framequeue.h"
+extern "C" {
+#include <libavutil/frame.h>
+}
+
+using std::function;
+
+typedef struct video_encode_stats
+{
+    FrameQueueStats queue;      // 采集到编码之间的队列
+    HistogramStats encode;      // 每帧回调(编码+推入发送队列)的耗时(us)
+}VideoEncodeStats;
+
+// 独立的视频编码线程, 采集线程只负责把帧放进有界队列, 编码慢时不拖慢采集
+// 编码跟不上时按drop_policy丢帧或者阻塞采集
+class VideoEncodeLooper: public CommonLooper
+{
+public:
+    VideoEncodeLooper();
+    virtual ~VideoEncodeLooper();
+    /**
+     * @brief Init
+     * @param "queue_size", 队列里最多排几帧, 缺省为3
+     *        "drop_policy", 队列满时的处理: "drop_oldest"(缺省, 丢最早的帧, 延迟最小)/
+     *                "drop_newest"(丢新来的帧)/"block"(阻塞采集线程, 不丢帧)
+     *        "thread.xxx", 编码线程的调度属性, 见CommonLooper::SetThreadProperties
+     * @return
+     */
+    RET_CODE Init(const Properties &properties);
+    virtual void Loop();
+    virtual void Stop();
+    // 在采集线程调用, 只增加frame的引用(av_frame_clone), 不拷贝图像数据
+    // 返回false表示这一帧被丢掉
+    bool Push(AVFrame *frame, int64_t pts);
+    // 在编码线程回调, frame只在回调期间有效
+    void AddCallback(function<void(AVFrame *, int64_t)> callback);
+    // reset为true时读取后清零
+    void GetEncodeStats(VideoEncodeStats *stats, bool reset = false);
+private:
+    FrameQueue *queue_ = NULL;
+    function<void(AVFrame *, int64_t)> callback_ = nullptr;
+    LatencyHistogram encode_cost_;
+    int64_t pre_debug_time_ = 0;
+};
+
+#endif // VIDEOENCODELOOPER_H